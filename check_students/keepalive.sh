@@ -0,0 +1,35 @@
+#!/bin/bash
+
+# Keeps more idle keep-alive connections open than the server has workers (set pool_size below <idle-connections>
+# in pool mode) and checks that a new client is still served right away
+
+PORT=80
+MAX_TIME=2
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <idle-connections> [port]"
+	exit 1
+fi
+[ $# -gt 1 ] && PORT=$2
+
+
+# every connection sends one HTTP/1.1 request and then stays open without sending anything else
+for i in $(seq 1 $1); do
+	exec {fd}<>/dev/tcp/localhost/$PORT || exit 1
+	printf "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n" >&$fd
+	IDLE="$IDLE $fd"
+done
+sleep 1
+
+# new client has to be served well before keep-alive timeout of idle connections
+STATUS=$(curl -s -o /dev/null -m $MAX_TIME -w "%{http_code} %{time_total}" http://localhost:$PORT/index.html)
+
+for fd in $IDLE; do
+	exec {fd}<&-
+done
+
+echo "idle connections: $1, new client: $STATUS"
+case "$STATUS" in
+	200*) echo "PASS"; exit 0 ;;
+	*) echo "FAIL (not served within $MAX_TIME seconds)"; exit 1 ;;
+esac
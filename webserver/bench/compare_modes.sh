@@ -0,0 +1,30 @@
+#!/bin/sh
+# Runs the same loadgen load against each connection handling model and prints one JSON result line per mode
+# usage: compare_modes.sh [port] [modes...]   (run from webserver directory after make bench, default modes: thread epoll uring)
+# Load is set with LOADGEN_ARGS (default: 50 keep-alive connections for 5 seconds over the whole www tree), e.g.
+# LOADGEN_ARGS="-c 50 -n 1000 -k 0 -u /index.html" matches check.sh ab run, add -r <rate> for open-loop latency comparison
+
+PORT=${1:-8080}
+[ $# -gt 0 ] && shift
+MODES=${*:-thread epoll uring}
+CONF=/tmp/compare_modes.conf
+LOADGEN_ARGS=${LOADGEN_ARGS:--c 50 -d 5 -w ../www}
+
+if [ ! -x bin/loadgen ]; then
+	echo "bin/loadgen is missing, build it with make bench"
+	exit 1
+fi
+
+for MODE in $MODES; do
+	grep -v '^server_mode' bin/.lab3-config > $CONF
+	printf "\nserver_mode = %s\nlog_level = error\n" "$MODE" >> $CONF
+	(cd bin && exec ./webserver -c $CONF -p $PORT >/dev/null) & # exec, so PID is the server and not the subshell
+	PID=$!
+	sleep 1
+
+	printf '{"server_mode":"%s",' "$MODE"
+	bin/loadgen -p $PORT $LOADGEN_ARGS 2>/dev/null | sed 's/^{//'
+
+	kill $PID
+	wait $PID 2>/dev/null
+done
@@ -0,0 +1,550 @@
+// HTTP load generator (measures a running server, e.g. one started by compare_modes.sh)
+// closed-loop - every connection sends its next request as soon as previous response arrived (-r 0, default)
+// open-loop   - requests are sent at fixed total rate (-r <requests/s>) and latency is measured from their scheduled
+//               send time, so server stalls show up in latency instead of silently lowering the request rate
+// Latencies are recorded into log-linear histogram (HdrHistogram style, under 1% value error) per thread and merged
+// usage: loadgen [-h ipv4] [-p port] [-c connections] [-t threads] [-d seconds | -n requests] [-k 0|1] [-r rate]
+//                [-u path]... [-w www_dir]
+// Human readable summary goes to stderr, one JSON object to stdout
+#include <common.h>
+
+#define LG_URLS_MAX 4096
+#define LG_REQUEST_MAX 1024
+#define LG_HEAD_MAX 8192
+#define LG_READ_SIZE 65536
+
+// Histogram: values below LG_SUB_BUCKETS are exact, above them every power of two is split into LG_SUB_BUCKETS/2 buckets
+#define LG_SUB_BUCKETS 128
+#define LG_HIST_SIZE (LG_SUB_BUCKETS + 48 * (LG_SUB_BUCKETS / 2))
+
+typedef struct {
+    unsigned long counts[LG_HIST_SIZE];
+    unsigned long total;
+    unsigned long min;
+    unsigned long max;
+    double sum;
+} lg_hist_t;
+
+typedef enum {
+    LG_IDLE = 0,   // Waiting for next (scheduled) request
+    LG_CONNECTING,
+    LG_WRITING,
+    LG_READING,
+    LG_DONE,       // Request limit reached
+} lg_state_t;
+
+typedef struct {
+    int fd;
+    lg_state_t state;
+    int reused; // Connection already carried a response (server may close it idle)
+    const char* request;
+    size_t request_len;
+    size_t sent;
+    char head[LG_HEAD_MAX + 1];
+    size_t head_len;
+    int status;
+    long body_left; // -1 - read until server closes connection
+    int server_close;
+    double start_ns; // Latency is measured from here (scheduled time in open-loop mode)
+    double next_ns;  // Scheduled time of next request
+} lg_conn_t;
+
+typedef struct {
+    pthread_t thread;
+    lg_conn_t* conns;
+    int conn_count;
+    unsigned int random;
+    lg_hist_t hist;
+    unsigned long responses;
+    unsigned long bytes;
+    unsigned long status_classes[6]; // 1xx..5xx (index 0 - unparsable)
+    unsigned long connect_errors;
+    unsigned long io_errors;
+} lg_worker_t;
+
+// Options
+static struct sockaddr_in server_addr;
+static const char* host = "127.0.0.1";
+static int port = 80;
+static int connections = 50;
+static int threads = 0;
+static double duration = 10;
+static long request_limit = 0; // 0 - run for duration
+static int keepalive = 1;
+static double rate = 0; // Requests per second, 0 - closed-loop
+static char* urls[LG_URLS_MAX];
+static int url_count = 0;
+
+// Shared run state
+static char* requests[LG_URLS_MAX];
+static size_t request_lens[LG_URLS_MAX];
+static atomic_long requests_started = 0;
+static double start_ns;
+static double deadline_ns; // 0 - no deadline
+static double interval_ns; // Open-loop interval between requests of one connection
+
+// Helper function - nanoseconds of monotonic clock
+double lg_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Helper function - histogram bucket of value
+int lg_hist_index(unsigned long value)
+{
+    int shift;
+
+    if (value < LG_SUB_BUCKETS) {
+        return (int)value;
+    }
+    shift = (63 - __builtin_clzl(value)) - 6; // value >> shift lies in [LG_SUB_BUCKETS/2, LG_SUB_BUCKETS)
+    if (shift > 48) {
+        return LG_HIST_SIZE - 1;
+    }
+    return LG_SUB_BUCKETS + (shift - 1) * (LG_SUB_BUCKETS / 2) + (int)(value >> shift) - LG_SUB_BUCKETS / 2;
+}
+
+// Helper function - highest value which falls into histogram bucket
+unsigned long lg_hist_value(int index)
+{
+    int shift;
+
+    if (index < LG_SUB_BUCKETS) {
+        return index;
+    }
+    shift = (index - LG_SUB_BUCKETS) / (LG_SUB_BUCKETS / 2) + 1;
+    return ((unsigned long)((index - LG_SUB_BUCKETS) % (LG_SUB_BUCKETS / 2) + LG_SUB_BUCKETS / 2 + 1) << shift) - 1;
+}
+
+void lg_hist_record(lg_hist_t* hist, unsigned long value)
+{
+    hist->counts[lg_hist_index(value)]++;
+    if (hist->total == 0 || value < hist->min) { hist->min = value; }
+    if (value > hist->max) { hist->max = value; }
+    hist->total++;
+    hist->sum += value;
+}
+
+void lg_hist_merge(lg_hist_t* into, const lg_hist_t* from)
+{
+    int i;
+
+    if (from->total == 0) {
+        return;
+    }
+    for (i = 0; i < LG_HIST_SIZE; i++) {
+        into->counts[i] += from->counts[i];
+    }
+    if (into->total == 0 || from->min < into->min) { into->min = from->min; }
+    if (from->max > into->max) { into->max = from->max; }
+    into->total += from->total;
+    into->sum += from->sum;
+}
+
+// Helper function - value at percentile (0-100), capped with exact maximum
+unsigned long lg_hist_percentile(const lg_hist_t* hist, double percentile)
+{
+    unsigned long wanted = (unsigned long)(hist->total * percentile / 100.0 + 0.5);
+    unsigned long seen = 0;
+    int i;
+
+    if (wanted == 0) {
+        wanted = 1;
+    }
+    for (i = 0; i < LG_HIST_SIZE; i++) {
+        seen += hist->counts[i];
+        if (seen >= wanted) {
+            return (lg_hist_value(i) < hist->max) ? lg_hist_value(i) : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// Helper function - add every regular file below dir (doc_root relative path) to URL mix, _errors directory is skipped
+void lg_add_tree(const char* doc_root, const char* dir)
+{
+    char path[PATH_MAX];
+    struct dirent* dirent;
+    struct stat stats;
+    DIR* dirp;
+
+    snprintf(path, sizeof(path), "%s%s", doc_root, dir);
+    if ((dirp = opendir(path)) == NULL) {
+        fprintf(stderr, "[ERROR] [loadgen] Failed to open directory \"%s\", error: %s\n", path, strerror(errno));
+        return;
+    }
+
+    while ((dirent = readdir(dirp)) != NULL && url_count < LG_URLS_MAX) {
+        if (dirent->d_name[0] == '.' || (dir[1] == '\0' && strcmp(dirent->d_name, "_errors") == 0)) {
+            continue;
+        }
+        if (snprintf(path, sizeof(path), "%s%s%s", doc_root, dir, dirent->d_name) >= (int)sizeof(path) || stat(path, &stats) != 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s%s%s", dir, dirent->d_name, S_ISDIR(stats.st_mode) ? "/" : "");
+        if (S_ISDIR(stats.st_mode)) {
+            lg_add_tree(doc_root, path);
+        } else if (S_ISREG(stats.st_mode)) {
+            urls[url_count++] = strdup(path);
+        }
+    }
+
+    closedir(dirp);
+}
+
+// Helper function - close connection and schedule next request after delay (0 - at scheduled time)
+void lg_conn_reset(lg_conn_t* conn, double now, double delay_ns)
+{
+    if (conn->fd >= 0) {
+        close(conn->fd); // Also removes it from epoll set
+        conn->fd = -1;
+    }
+    conn->reused = 0;
+    conn->state = LG_IDLE;
+    if (delay_ns > 0 && conn->next_ns < now + delay_ns) {
+        conn->next_ns = now + delay_ns;
+    }
+}
+
+// Helper function - begin next request on connection (connecting first if needed)
+void lg_conn_start(lg_worker_t* worker, int epfd, lg_conn_t* conn, double now)
+{
+    struct epoll_event event;
+    int url;
+
+    if (request_limit > 0 && atomic_fetch_add(&requests_started, 1) >= request_limit) {
+        if (conn->fd >= 0) {
+            close(conn->fd);
+            conn->fd = -1;
+        }
+        conn->state = LG_DONE;
+        return;
+    }
+
+    worker->random ^= worker->random << 13; worker->random ^= worker->random >> 17; worker->random ^= worker->random << 5;
+    url = worker->random % url_count;
+    conn->request = requests[url];
+    conn->request_len = request_lens[url];
+    conn->sent = 0;
+    conn->head_len = 0;
+    conn->status = 0;
+    conn->body_left = -2; // Header not received yet
+    conn->server_close = 0;
+    conn->start_ns = (rate > 0) ? conn->next_ns : now;
+
+    event.data.ptr = conn;
+    if (conn->fd >= 0) {
+        conn->state = LG_WRITING;
+        event.events = EPOLLOUT;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+        return;
+    }
+
+    if ((conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
+        worker->connect_errors++;
+        lg_conn_reset(conn, now, 1e7);
+        return;
+    }
+    if (connect(conn->fd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0 && errno != EINPROGRESS) {
+        worker->connect_errors++;
+        lg_conn_reset(conn, now, 1e7);
+        return;
+    }
+    conn->state = LG_CONNECTING;
+    event.events = EPOLLOUT;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &event);
+}
+
+// Helper function - parse response header (status, Content-Length, Connection: close)
+// Returns header length, 0 if header is not complete yet
+size_t lg_parse_head(lg_conn_t* conn)
+{
+    char* end;
+    char* line;
+    char* next;
+
+    conn->head[conn->head_len] = '\0';
+    if ((end = strstr(conn->head, "\r\n\r\n")) == NULL) {
+        return 0;
+    }
+
+    if (strncmp(conn->head, "HTTP/1.", 7) == 0) {
+        conn->status = atoi(conn->head + 9);
+    }
+    conn->body_left = (conn->status == 204 || conn->status == 304 || (conn->status >= 100 && conn->status < 200)) ? 0 : -1;
+    for (line = strstr(conn->head, "\r\n") + 2; line < end; line = next + 2) {
+        next = strstr(line, "\r\n");
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            conn->body_left = atol(line + 15);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line + 11, "close") != NULL && strcasestr(line + 11, "close") < next) {
+            conn->server_close = 1;
+        }
+    }
+
+    return end + 4 - conn->head;
+}
+
+// Helper function - response completed: record it and schedule next request
+void lg_conn_complete(lg_worker_t* worker, lg_conn_t* conn, double now)
+{
+    lg_hist_record(&worker->hist, (unsigned long)((now - conn->start_ns) / 1000));
+    worker->responses++;
+    worker->status_classes[(conn->status >= 100 && conn->status < 600) ? conn->status / 100 : 0]++;
+
+    conn->next_ns = (rate > 0) ? conn->next_ns + interval_ns : now;
+    if (!keepalive || conn->server_close) {
+        lg_conn_reset(conn, now, 0);
+    } else {
+        conn->reused = 1;
+        conn->state = LG_IDLE;
+    }
+}
+
+// Helper function - handle readiness of connection socket
+void lg_conn_event(lg_worker_t* worker, int epfd, lg_conn_t* conn)
+{
+    static __thread char buffer[LG_READ_SIZE];
+    struct epoll_event event;
+    socklen_t err_len = sizeof(int);
+    size_t head_len, head_received, copy;
+    ssize_t bytes;
+    int err = 0;
+
+    if (conn->state == LG_CONNECTING) {
+        if (getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+            worker->connect_errors++;
+            lg_conn_reset(conn, lg_now_ns(), 1e7);
+            return;
+        }
+        conn->state = LG_WRITING;
+    }
+
+    if (conn->state == LG_WRITING) {
+        while (conn->sent < conn->request_len) {
+            if ((bytes = send(conn->fd, conn->request + conn->sent, conn->request_len - conn->sent, MSG_NOSIGNAL)) < 0) {
+                if (errno == EAGAIN) {
+                    return;
+                }
+                worker->io_errors++;
+                lg_conn_reset(conn, lg_now_ns(), 1e7);
+                return;
+            }
+            conn->sent += bytes;
+        }
+        conn->state = LG_READING;
+        event.data.ptr = conn;
+        event.events = EPOLLIN;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &event);
+        return;
+    }
+
+    if (conn->state != LG_READING) {
+        return;
+    }
+    while ((bytes = recv(conn->fd, buffer, sizeof(buffer), 0)) > 0) {
+        worker->bytes += bytes;
+        if (conn->body_left == -2) { // Still in header
+            head_received = conn->head_len + bytes;
+            copy = ((size_t)bytes < LG_HEAD_MAX - conn->head_len) ? (size_t)bytes : LG_HEAD_MAX - conn->head_len;
+            memcpy(conn->head + conn->head_len, buffer, copy);
+            conn->head_len += copy;
+            if ((head_len = lg_parse_head(conn)) == 0) {
+                if (conn->head_len == LG_HEAD_MAX) {
+                    worker->io_errors++;
+                    lg_conn_reset(conn, lg_now_ns(), 1e7);
+                    return;
+                }
+                continue;
+            }
+            bytes = head_received - head_len; // Body bytes which arrived with header
+        }
+        if (conn->body_left > 0) {
+            conn->body_left -= (bytes < conn->body_left) ? bytes : conn->body_left;
+        }
+        if (conn->body_left == 0) {
+            lg_conn_complete(worker, conn, lg_now_ns());
+            return;
+        }
+    }
+
+    if (bytes == 0 && conn->body_left == -1) { // Body delimited by connection close
+        conn->server_close = 1;
+        lg_conn_complete(worker, conn, lg_now_ns());
+    } else if (bytes == 0 || errno != EAGAIN) {
+        // Idle keep-alive connection closed by server before anything was received: retry with fresh connection
+        if (bytes == 0 && conn->reused && conn->head_len == 0) {
+            lg_conn_reset(conn, lg_now_ns(), 0);
+            atomic_fetch_sub(&requests_started, 1);
+            return;
+        }
+        worker->io_errors++;
+        lg_conn_reset(conn, lg_now_ns(), 1e7);
+    }
+}
+
+// Worker thread - drive its connections with own epoll instance until deadline or request limit
+void* lg_worker(void* arg)
+{
+    lg_worker_t* worker = (lg_worker_t*)arg;
+    struct epoll_event events[256];
+    double now, wake_ns;
+    int epfd, active, timeout, n, i;
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        fprintf(stderr, "[ERROR] [loadgen] Failed to create epoll instance, error: %s\n", strerror(errno));
+        return NULL;
+    }
+
+    while (1) {
+        now = lg_now_ns();
+        if (deadline_ns > 0 && now >= deadline_ns) {
+            break;
+        }
+
+        active = 0;
+        wake_ns = (deadline_ns > 0) ? deadline_ns : now + 1e8;
+        for (i = 0; i < worker->conn_count; i++) {
+            if (worker->conns[i].state == LG_IDLE && worker->conns[i].next_ns <= now) {
+                lg_conn_start(worker, epfd, &worker->conns[i], now);
+            }
+            if (worker->conns[i].state == LG_IDLE && worker->conns[i].next_ns < wake_ns) {
+                wake_ns = worker->conns[i].next_ns;
+            }
+            active += (worker->conns[i].state != LG_DONE);
+        }
+        if (active == 0) {
+            break;
+        }
+
+        timeout = (wake_ns > now) ? (int)((wake_ns - now) / 1e6) + 1 : 0;
+        if ((n = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), timeout)) < 0 && errno != EINTR) {
+            fprintf(stderr, "[ERROR] [loadgen] epoll_wait failed, error: %s\n", strerror(errno));
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            lg_conn_event(worker, epfd, (lg_conn_t*)events[i].data.ptr);
+        }
+    }
+
+    for (i = 0; i < worker->conn_count; i++) {
+        if (worker->conns[i].fd >= 0) {
+            close(worker->conns[i].fd);
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+    lg_worker_t* workers;
+    lg_hist_t* hist;
+    unsigned long responses = 0, bytes = 0, connect_errors = 0, io_errors = 0, status_classes[6] = { 0 };
+    double elapsed;
+    int opt, i, c, w;
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:d:n:k:r:u:w:")) != -1) {
+        switch (opt) {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'c': connections = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'n': request_limit = atol(optarg); break;
+            case 'k': keepalive = atoi(optarg); break;
+            case 'r': rate = atof(optarg); break;
+            case 'u': if (url_count < LG_URLS_MAX) { urls[url_count++] = optarg; } break;
+            case 'w': lg_add_tree(optarg, "/"); break;
+            default:
+                fprintf(stderr, "usage: %s [-h ipv4] [-p port] [-c connections] [-t threads] [-d seconds | -n requests] [-k 0|1] [-r rate] "
+                    "[-u path]... [-w www_dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (url_count == 0) {
+        urls[url_count++] = "/index.html";
+    }
+    if (connections <= 0 || port <= 0 || port > 65535 || rate < 0 || (request_limit <= 0 && duration <= 0)) {
+        fprintf(stderr, "[ERROR] [loadgen] Invalid options\n");
+        return 1;
+    }
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (threads > connections) {
+        threads = connections;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, strcmp(host, "localhost") == 0 ? "127.0.0.1" : host, &server_addr.sin_addr) != 1) {
+        fprintf(stderr, "[ERROR] [loadgen] \"%s\" is not an IPv4 address\n", host);
+        return 1;
+    }
+
+    for (i = 0; i < url_count; i++) {
+        requests[i] = (char*)malloc(LG_REQUEST_MAX);
+        request_lens[i] = snprintf(requests[i], LG_REQUEST_MAX, "GET %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: loadgen\r\n%s\r\n",
+            urls[i], host, port, keepalive ? "" : "Connection: close\r\n");
+        if (request_lens[i] >= LG_REQUEST_MAX) {
+            fprintf(stderr, "[ERROR] [loadgen] URL \"%s\" is too long\n", urls[i]);
+            return 1;
+        }
+    }
+
+    workers = (lg_worker_t*)calloc(threads, sizeof(lg_worker_t));
+    hist = (lg_hist_t*)calloc(1, sizeof(lg_hist_t));
+    interval_ns = (rate > 0) ? 1e9 * connections / rate : 0;
+    start_ns = lg_now_ns();
+    deadline_ns = (request_limit > 0) ? 0 : start_ns + duration * 1e9;
+
+    // Connections are spread over threads, open-loop schedules are staggered so requests are evenly spaced in time
+    for (w = 0, c = 0; w < threads; w++) {
+        workers[w].conn_count = connections / threads + (w < connections % threads);
+        workers[w].conns = (lg_conn_t*)calloc(workers[w].conn_count, sizeof(lg_conn_t));
+        workers[w].random = 2463534242u + w * 7919u;
+        for (i = 0; i < workers[w].conn_count; i++, c++) {
+            workers[w].conns[i].fd = -1;
+            workers[w].conns[i].next_ns = start_ns + interval_ns * c / connections;
+        }
+    }
+    for (w = 0; w < threads; w++) {
+        pthread_create(&workers[w].thread, NULL, lg_worker, &workers[w]);
+    }
+    for (w = 0; w < threads; w++) {
+        pthread_join(workers[w].thread, NULL);
+        lg_hist_merge(hist, &workers[w].hist);
+        responses += workers[w].responses;
+        bytes += workers[w].bytes;
+        connect_errors += workers[w].connect_errors;
+        io_errors += workers[w].io_errors;
+        for (i = 0; i < 6; i++) {
+            status_classes[i] += workers[w].status_classes[i];
+        }
+    }
+    elapsed = (lg_now_ns() - start_ns) / 1e9;
+
+    fprintf(stderr, "%lu responses in %.2f s (%.1f req/s, %.2f MB/s), %d URLs, %d connections, %d threads, keep-alive %s, %s\n",
+        responses, elapsed, responses / elapsed, bytes / elapsed / 1e6, url_count, connections, threads, keepalive ? "on" : "off",
+        (rate > 0) ? "open-loop" : "closed-loop");
+    fprintf(stderr, "latency us: min %lu p50 %lu p90 %lu p99 %lu p99.9 %lu max %lu, errors: connect %lu io %lu, non-2xx/3xx %lu\n",
+        hist->min, lg_hist_percentile(hist, 50), lg_hist_percentile(hist, 90), lg_hist_percentile(hist, 99), lg_hist_percentile(hist, 99.9),
+        hist->max, connect_errors, io_errors, status_classes[0] + status_classes[1] + status_classes[4] + status_classes[5]);
+
+    printf("{\"mode\":\"%s\",\"rate\":%.1f,\"connections\":%d,\"threads\":%d,\"keepalive\":%s,\"urls\":%d,"
+        "\"duration_s\":%.3f,\"responses\":%lu,\"bytes\":%lu,\"throughput_rps\":%.1f,"
+        "\"status\":{\"1xx\":%lu,\"2xx\":%lu,\"3xx\":%lu,\"4xx\":%lu,\"5xx\":%lu,\"invalid\":%lu},"
+        "\"errors\":{\"connect\":%lu,\"io\":%lu},"
+        "\"latency_us\":{\"min\":%lu,\"mean\":%.1f,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p99_9\":%lu,\"max\":%lu}}\n",
+        (rate > 0) ? "open" : "closed", rate, connections, threads, keepalive ? "true" : "false", url_count,
+        elapsed, responses, bytes, responses / elapsed,
+        status_classes[1], status_classes[2], status_classes[3], status_classes[4], status_classes[5], status_classes[0],
+        connect_errors, io_errors,
+        hist->min, (hist->total > 0) ? hist->sum / hist->total : 0.0, lg_hist_percentile(hist, 50), lg_hist_percentile(hist, 90),
+        lg_hist_percentile(hist, 99), lg_hist_percentile(hist, 99.9), hist->max);
+
+    return (responses > 0) ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Microbenchmark of per-request receive/parse cost
+// "legacy"  - original thread_handle_request(...) loop: 8 KB memset per connection, recv into socket buffer,
+//             byte-by-byte copy into message buffer with shifting termination window, '\0'-delimited chunks
+// "current" - recv directly into connection request buffer, memchr(...) driven termination search resumed per chunk
+// recv(...) is emulated with memcpy(...) of chunk_size bytes, both variants end with parse_http_request(...)
+#include <http.h>
+
+#define BENCH_ITERATIONS 500000
+
+static const char bench_request[] =
+    "GET /images/DoYouEvenCrit.jpg HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:8080/index.html\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "\r\n";
+
+static volatile size_t bench_sink; // Keeps results observable, so compiler can't drop the work
+
+// Original request reading (see header comment), returns parsed request length
+size_t legacy_read(const char* request, size_t request_len, size_t chunk_size, http_request_t* http_request)
+{
+    char byte1 = '\0', byte2 = '\0', byte3 = '\0', byte4 = '\0';
+    int terminated = 0;
+    int sbuffer_itr = 0;
+    int message_itr = 0;
+    size_t offset = 0;
+    size_t read_bytes;
+    char socket_buffer[CONF_SOCK_BUFSIZE+1];
+    char message_buffer[CONF_REQ_BUFSIZE+1];
+    memset(message_buffer, 0, CONF_REQ_BUFSIZE+1);
+
+    while (!terminated && offset < request_len) {
+        read_bytes = (request_len - offset < chunk_size) ? request_len - offset : chunk_size;
+        memcpy(socket_buffer, request + offset, read_bytes);
+        offset += read_bytes;
+        socket_buffer[read_bytes] = '\0';
+        sbuffer_itr = 0;
+
+        while (socket_buffer[sbuffer_itr] != '\0') {
+            if (message_itr > CONF_REQ_BUFSIZE) {
+                return 0;
+            }
+            byte4 = byte3; byte3 = byte2; byte2 = byte1;
+            byte1 = socket_buffer[sbuffer_itr];
+            message_buffer[message_itr] = socket_buffer[sbuffer_itr];
+            if ((byte4 == '\r' && byte3 == '\n' && byte2 == '\r' && byte1 == '\n') || (byte2 == '\n' && byte1 == '\n')) {
+                terminated = 1;
+                break;
+            }
+            sbuffer_itr++;
+            message_itr++;
+        }
+    }
+
+    if (!terminated || parse_http_request(message_buffer, http_request) != 0) {
+        return 0;
+    }
+    return message_itr + 1;
+}
+
+// Current request reading (same steps as conn_read_request(...)/conn_handle_request(...)), returns parsed request length
+size_t current_read(const char* request, size_t request_len, size_t chunk_size, char* request_buf, http_request_t* http_request)
+{
+    size_t buf_len = 0;
+    size_t scan_pos = 0;
+    size_t request_end = 0;
+    size_t read_bytes;
+
+    while (request_end == 0 && buf_len < request_len) {
+        read_bytes = (request_len - buf_len < chunk_size) ? request_len - buf_len : chunk_size;
+        memcpy(request_buf + buf_len, request + buf_len, read_bytes);
+        buf_len += read_bytes;
+        request_end = http_request_end(request_buf, scan_pos, buf_len);
+        scan_pos = buf_len;
+    }
+
+    if (request_end == 0 || memchr(request_buf, '\0', request_end) != NULL) {
+        return 0;
+    }
+    request_buf[request_end] = '\0';
+    if (parse_http_request(request_buf, http_request) != 0) {
+        return 0;
+    }
+    return request_end;
+}
+
+// Helper function - nanoseconds of monotonic clock
+double bench_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main()
+{
+    static char request_buf[CONF_REQ_BUFSIZE+1];
+    size_t chunk_sizes[] = { sizeof(bench_request), 64, 8 };
+    size_t request_len = sizeof(bench_request) - 1;
+    http_request_t http_request;
+    double start, legacy_ns, current_ns;
+    int i, c;
+
+    // Both variants must agree before they are compared
+    if (legacy_read(bench_request, request_len, request_len, &http_request) != request_len ||
+        current_read(bench_request, request_len, request_len, request_buf, &http_request) != request_len) {
+        printf("[ERROR] [parse_bench] Benchmark request was not parsed\n");
+        return 1;
+    }
+
+    printf("[INFO] [parse_bench] %zu byte request, %d iterations\n", request_len, BENCH_ITERATIONS);
+    printf("%-12s %14s %14s %10s\n", "chunk_size", "legacy_ns", "current_ns", "speedup");
+    for (c = 0; c < (int)(sizeof(chunk_sizes) / sizeof(chunk_sizes[0])); c++) {
+        start = bench_now_ns();
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+            bench_sink += legacy_read(bench_request, request_len, chunk_sizes[c], &http_request);
+        }
+        legacy_ns = (bench_now_ns() - start) / BENCH_ITERATIONS;
+
+        start = bench_now_ns();
+        for (i = 0; i < BENCH_ITERATIONS; i++) {
+            bench_sink += current_read(bench_request, request_len, chunk_sizes[c], request_buf, &http_request);
+        }
+        current_ns = (bench_now_ns() - start) / BENCH_ITERATIONS;
+
+        printf("%-12zu %14.1f %14.1f %9.2fx\n", chunk_sizes[c], legacy_ns, current_ns, legacy_ns / current_ns);
+    }
+
+    return 0;
+}
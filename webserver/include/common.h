@@ -1,19 +1,42 @@
 #ifndef WEBSERVER_COMMON_H
 #define WEBSERVER_COMMON_H
 
+// GNU/Linux extensions (accept4, splice, CPU affinity etc.), must be defined before any system header
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 // C standard and Linux system headers
 #include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <dirent.h>
 #include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <linux/limits.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <zlib.h>
 
 #endif // WEBSERVER_COMMON_H
\ No newline at end of file
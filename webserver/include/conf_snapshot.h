@@ -0,0 +1,40 @@
+#ifndef CONF_SNAPSHOT_H
+#define CONF_SNAPSHOT_H
+#include <common.h>
+#include <config.h>
+
+// Published config snapshot, immutable once published
+// Every thread serving connections holds reference to one snapshot and switches to current one once it sees that reload
+// published a new generation (single relaxed load per check), so request path reads its config through plain pointer
+// (no locks, no reference counting per connection), and old snapshot is freed once last thread has moved on from it
+typedef struct conf_snapshot {
+    config_t conf;
+    int refs; // Published reference plus one per thread holding snapshot (protected by snapshot lock)
+    unsigned long generation; // 1 for startup config, incremented by every reload
+} conf_snapshot_t;
+
+// Remember config file for reloads: its directory is kept open, so file can be reread after chroot
+// Raw values of the file are remembered too (settings which need restart are compared with values of previous read on reload)
+// Run this BEFORE chroot_doc_root(...)
+// Returns 0 on success, 1 on failure
+int conf_reload_init(const char* filename);
+
+// Publish initial config snapshot (copy of conf as it is after validation and startup adjustments)
+// Run this BEFORE any connection is created
+// Returns 0 on success, 1 on failure
+int conf_publish(const config_t* conf);
+
+// Config snapshot held by calling thread, switched to current one first if reload published a new one since
+// Pointer stays valid until this thread calls conf_current() again after next reload (or exits), so it must not be kept
+// across waits by anything else (connections refresh their config pointer at every processing step)
+const config_t* conf_current();
+
+// Reread config file and publish it as new current snapshot (run by signal thread on SIGHUP)
+// Runtime-tunable settings (timeouts, keep-alive, socket options, gzip level, metrics path, log level, drain timeout) apply to every
+// connection from its next processing step (threads switch to new snapshot on their next conf_current()),
+// settings which need restart keep their running values (changes of them are reported once as warnings)
+// Old snapshot stays valid for threads still holding it
+// Returns 0 on success, 1 if config file couldn't be read or parsed (current snapshot stays in use)
+int conf_reload();
+
+#endif // CONF_SNAPSHOT_H
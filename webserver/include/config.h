@@ -7,7 +7,30 @@
 
 // Socket / Request buffer sizes
 #define CONF_SOCK_BUFSIZE 8192
-#define CONF_REQ_BUFSIZE 8192
+#define CONF_REQ_BUFSIZE 8192 // Default request_buffer_size
+
+// Connection handling models
+typedef enum {
+    SERVER_MODE_THREAD = 0, // Blocking sockets, one thread per accepted connection
+    SERVER_MODE_EPOLL,      // Non-blocking sockets, single epoll event loop thread
+    SERVER_MODE_POOL,       // Non-blocking sockets, fixed-size work-stealing worker pool (waiting connections are parked in poller)
+    SERVER_MODE_REUSEPORT,  // Non-blocking sockets, one SO_REUSEPORT listener with its own epoll loop per CPU (pinned thread)
+    SERVER_MODE_URING,      // Single io_uring completion loop thread (falls back to epoll when io_uring is not available)
+} server_mode_t;
+
+// Log levels (messages below configured level are not formatted nor written)
+typedef enum {
+    LOG_LEVEL_INFO = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF,
+} log_level_t;
+
+// Access log line formats
+typedef enum {
+    ACCESS_LOG_COMMON = 0, // Common Log Format
+    ACCESS_LOG_COMBINED,   // Combined Log Format (Common Log Format plus Referer and User-Agent)
+} access_log_format_t;
 
 typedef struct {
     // Listening port for accepting client connections
@@ -19,12 +42,84 @@ typedef struct {
     // 0: run webserver normally
     // 1: run webserver as daemon
     int as_daemon;
+
+    // Connection handling model ("thread", "epoll", "pool", "reuseport" or "uring")
+    server_mode_t server_mode;
+
+    // Worker pool mode: amount of worker threads (0 - one per online CPU) and per-worker queue depth
+    int pool_size;
+    int pool_queue_depth;
+
+    // Reuseport mode: amount of listener/event loop threads (0 - one per CPU the server is allowed to run on)
+    int reuseport_size;
+
+    // Persistent (keep-alive) connections: idle timeout in seconds and maximum requests per connection (1 - disable keep-alive)
+    int keepalive_timeout;
+    int keepalive_max_requests;
+
+    // Slow client deadlines in seconds: whole request header must arrive within header_timeout of its first byte (or of accept),
+    // response sending gives up when client takes no bytes for send_timeout
+    int header_timeout;
+    int send_timeout;
+
+    // Memory ceiling of client connections in bytes (0 - unlimited), turned into maximum amount of open connections
+    // (connections beyond it are closed right away), and stack size of connection serving threads (0 - system default)
+    size_t conn_memory_limit;
+    size_t thread_stack_size;
+
+    // Connection buffers and sockets: request buffer size in bytes (longest accepted request header), listening socket backlog,
+    // and options of accepted sockets: TCP_NODELAY flag and SO_SNDBUF/SO_RCVBUF sizes (0 - kernel default with autotuning)
+    size_t request_buffer_size;
+    int listen_backlog;
+    int tcp_nodelay;
+    size_t socket_send_buffer;
+    size_t socket_receive_buffer;
+
+    // In-memory document cache: byte budget (0 - disabled) and maximum size of single cached document
+    size_t file_cache_size;
+    size_t file_cache_max_file;
+
+    // Shared mmap-ed documents (too big for document cache): mapped bytes budget (0 - disabled) and maximum size of single mapped document
+    size_t mmap_cache_size;
+    size_t mmap_max_file;
+
+    // Resolved path and metadata cache: maximum entries (0 - disabled) and lifetime of missing/forbidden document entries in seconds
+    int meta_cache_entries;
+    int meta_cache_negative_ttl;
+
+    // mime.types-style file with extension to Content-Type mapping (empty - built-in types only)
+    char mime_types[PATH_MAX];
+
+    // On-the-fly gzip compression level (1-9) of cached compressible documents, 0 - only precompressed .gz/.br sidecars are served
+    int gzip_level;
+
+    // Reserved URL path of Prometheus metrics page, only served to localhost clients (empty - disabled)
+    char metrics_path[PATH_MAX];
+
+    // Logging: error log file (empty - stdout), access log file (empty - disabled), access log format and minimum logged level
+    char error_log[PATH_MAX];
+    char access_log[PATH_MAX];
+    access_log_format_t access_log_format;
+    log_level_t log_level;
+
+    // Log rotation: when log file exceeds byte size and/or after interval in seconds (0 - disabled)
+    size_t log_rotate_size;
+    int log_rotate_interval;
+
+    // Graceful shutdown and restart: pid file (empty - not written) and seconds open connections get to finish
+    // when server drains (SIGQUIT/SIGTERM, or after handing its listening sockets to new instance on SIGUSR2)
+    char pid_file[PATH_MAX];
+    int drain_timeout;
 } config_t;
 
 // Parse configuration file ".lab3-config" and fill passed config_t object
 // Run this BEFORE override_conf(...)
 int read_conf_file(config_t* config, const char* filename);
 
+// Parse configuration from already opened config file (e.g. config reload), file is closed afterwards
+// Returns 0 on successful read, 1 on read failure
+int read_conf_stream(config_t* config, FILE* filePtr);
+
 // Parse program arguments and override configuration object with them
 // Overrides:
 // -d : config_t->as_daemon = true
@@ -48,6 +143,15 @@ int validate_conf(config_t* config);
 // 0 if successful, 1 if not
 int chroot_doc_root(config_t* config);
 
+// Server mode enum to config string
+const char* server_mode_str(server_mode_t mode);
+
+// Log level enum to config string
+const char* log_level_str(log_level_t level);
+
+// Access log format enum to config string
+const char* access_log_format_str(access_log_format_t format);
+
 // Print given config object
 void print_conf(config_t* config);
 
@@ -0,0 +1,109 @@
+#ifndef CONN_H
+#define CONN_H
+#include <common.h>
+#include <config.h>
+#include <http.h>
+#include <timer_wheel.h>
+
+// Maximum amount of pipelined requests whose responses are queued on a connection at once
+#define CONN_PIPELINE_MAX 8
+
+// Connection states (recv -> parse -> send)
+typedef enum {
+    CONN_STATE_READ,  // Receiving request bytes until termination signal
+    CONN_STATE_WRITE, // Sending queued responses
+    CONN_STATE_CLOSE, // Connection is finished and should be destroyed
+} conn_state_t;
+
+// Connection deadlines, the one matching what connection waits for applies
+typedef enum {
+    CONN_TIMEOUT_IDLE,   // Waiting for next request on persistent connection (conf->keepalive_timeout)
+    CONN_TIMEOUT_HEADER, // Receiving request, counted from its first byte and not extended by trickled bytes (conf->header_timeout)
+    CONN_TIMEOUT_SEND,   // Sending responses, extended whenever client takes more bytes (conf->send_timeout)
+} conn_timeout_t;
+
+// Request line (and headers for access log) of queued response, for logging once response is sent
+// Points into request_buf, which keeps its requests until whole queue is sent
+typedef struct {
+    const char* method; // NULL if request couldn't be parsed
+    const char* uri;
+    const char* version;
+    const char* referer; // Not terminated, NULL if missing
+    size_t referer_len;
+    const char* user_agent; // Not terminated, NULL if missing
+    size_t user_agent_len;
+    unsigned long received_us; // When request was received (for request latency metrics)
+} conn_request_log_t;
+
+// Client connection state machine, shared by blocking (thread) and non-blocking (epoll, pool) server modes
+// Every complete (pipelined) request in request_buf is parsed and its response queued, then the queue is sent in one go
+// Persistent connections loop back from CONN_STATE_WRITE to CONN_STATE_READ for the next requests
+typedef struct conn {
+    int socket_id;
+    char client_addr[INET6_ADDRSTRLEN]; // Client IP address for access log ("-" if access log is disabled)
+    const config_t* conf; // Config snapshot held by thread serving connection (switched to it at every processing step, never modified)
+    conn_state_t state;
+
+    size_t request_len; // Bytes received into request_buf
+    size_t parse_pos; // Start of first request in request_buf which has no queued response yet
+    size_t scan_pos; // Position in request_buf up to which termination signal was searched for
+    int requests_served; // Amount of fully sent responses on this connection
+    conn_timeout_t timeout; // Deadline which currently applies
+    unsigned long deadline_ms; // When connection times out (timer_now_ms() clock)
+    int blocking; // 1 - blocking socket, deadlines are enforced with socket timeouts (event loops use timer wheels instead)
+    http_request_t request; // Currently parsed request (only used while its response is prepared)
+
+    // Queued responses (in request order), responses must not be moved because their segments point into themselves
+    http_response_t responses[CONN_PIPELINE_MAX];
+    conn_request_log_t request_logs[CONN_PIPELINE_MAX];
+    int response_count; // Queued responses
+    int response_sent; // Fully sent queued responses
+
+    // Intrusive list links and deadline timer, used by server modes which track their open connections
+    struct conn* prev;
+    struct conn* next;
+    wheel_timer_t timer;
+    void* backend; // State server mode keeps per connection (reserved next to object by connection pool, NULL if mode has none)
+
+    char request_buf[]; // Raw request bytes (received directly into this buffer), conf->request_buffer_size+1 bytes long
+} conn_t;
+
+// Format IP address of socket address into buf (INET6_ADDRSTRLEN bytes fit any), "-" unless it is IPv4 or IPv6 address
+// Listening sockets may be IPv6 ones (inherited through LISTEN_FDS), so client addresses are kept in sockaddr_storage
+// Returns port of address, 0 if address isn't IPv4 or IPv6 one
+int conn_addr_str(const struct sockaddr_storage* addr, char* buf, size_t size);
+
+// Take connection object for accepted client socket from connection pool (its buffers are recycled between connections)
+// Connection reads config snapshot of thread which serves it, so config reloads apply from its next processing step
+// Returns NULL if connection limit is reached (errno ENOBUFS) or allocation failed
+conn_t* conn_create(int socket_id);
+
+// Report accepted client socket whose connection couldn't be created (right after conn_create(...) failed), caller then closes it
+void conn_create_failed(int socket_id);
+
+// Close connection socket and return connection object to connection pool
+void conn_destroy(conn_t* conn);
+
+// Deadline name for log messages
+const char* conn_timeout_str(conn_timeout_t timeout);
+
+// Report connection which missed its deadline (idle ones quietly, stalled clients as warnings), caller then closes it
+void conn_timed_out(conn_t* conn);
+
+// Advance connection state machine as far as socket allows
+// Blocking sockets are processed until CONN_STATE_CLOSE (or CONN_STATE_READ/CONN_STATE_WRITE once their deadline passed),
+// non-blocking sockets return CONN_STATE_READ/CONN_STATE_WRITE when they would block
+conn_state_t conn_process(conn_t* conn);
+
+// Completion-based I/O (io_uring), where caller receives and sends for the connection:
+// Account bytes received by caller directly into request_buf + request_len (0 - only re-check buffered bytes)
+// and queue responses for complete requests
+// Returns new state: CONN_STATE_READ (receive more), CONN_STATE_WRITE (send queued responses) or CONN_STATE_CLOSE
+conn_state_t conn_received(conn_t* conn, size_t bytes);
+
+// Account progress of queued responses sent by caller (segments advanced with advance_http_responses(...),
+// file body progress updated in response), send_ec is HTTP_SEND_DONE for progress or HTTP_SEND_ERROR (errno set) for failure
+// Returns new state: CONN_STATE_WRITE (keep sending), CONN_STATE_READ (receive next requests) or CONN_STATE_CLOSE
+conn_state_t conn_sent(conn_t* conn, int send_ec);
+
+#endif // CONN_H
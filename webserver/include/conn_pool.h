@@ -0,0 +1,48 @@
+#ifndef CONN_POOL_H
+#define CONN_POOL_H
+#include <common.h>
+#include <config.h>
+#include <conn.h>
+
+// Connection objects carved from one slab allocation (and moved between thread cache and shared free list at once)
+#define CONN_POOL_SLAB 16
+
+// Free objects thread keeps for itself, beyond that CONN_POOL_SLAB of them go back to shared free list
+#define CONN_POOL_CACHE (2 * CONN_POOL_SLAB)
+
+// How many times thread short of objects walks other threads' caches (only once whole budget is allocated)
+#define CONN_POOL_COLLECT_PASSES 4
+
+// Free connection objects of one thread (event loop, worker), so taking and returning objects doesn't contend with
+// other threads, its lock is only ever contended when thread short of objects takes them (connection limit reached)
+typedef struct conn_cache {
+    pthread_mutex_t lock;
+    conn_t* free_conns; // Linked through their next pointers
+    int count;
+    struct conn_cache* next; // All caches ever created (protected by pool lock)
+    struct conn_cache* next_released; // Caches of exited threads, reused by new ones (protected by pool lock)
+} conn_cache_t;
+
+// Setup process-wide pool of connection objects (with their request/response buffers and parsed request),
+// objects carry request buffer of conf->request_buffer_size bytes and per-connection state of conf->server_mode (conn->backend)
+// Maximum amount of connections is derived from conf->conn_memory_limit (0 - unlimited) and memory one connection costs
+// in conf->server_mode (connection object, plus thread stack of conf->thread_stack_size in thread mode)
+// Run this BEFORE any connection is created
+void conn_pool_init(const config_t* conf);
+
+// Maximum amount of open connections (0 - unlimited)
+int conn_pool_limit();
+
+// Amount of open connections (connection objects taken from the pool)
+int conn_pool_used();
+
+// Take connection object from the pool (not initialized, recycled objects keep contents of their previous connection)
+// Objects come from cache of calling thread, shared free list (and its lock) is only used to refill it slab at a time
+// Returns NULL if connection limit is reached (errno ENOBUFS) or memory allocation failed (errno ENOMEM)
+conn_t* conn_pool_get();
+
+// Return connection object to the pool (objects are recycled, slab memory is never released)
+// Object goes to cache of calling thread, cache of exiting thread goes back to shared free list
+void conn_pool_put(conn_t* conn);
+
+#endif // CONN_POOL_H
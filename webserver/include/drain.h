@@ -0,0 +1,32 @@
+#ifndef DRAIN_H
+#define DRAIN_H
+#include <common.h>
+
+// How often waiting for open connections to finish checks them
+#define DRAIN_POLL_MS 50
+
+// Graceful shutdown (SIGQUIT/SIGTERM, or previous instance after listening socket handoff):
+// listeners stop accepting (listening sockets stay open in processes sharing them, so queued and new connections are
+// accepted there), responses stop offering keep-alive, and process exits once open connections are finished
+// or conf->drain_timeout seconds passed
+
+// Setup drain notification, run this BEFORE starting listening
+// Returns 0 on success, 1 on failure
+int drain_init();
+
+// Start draining (only first call has effect)
+void drain_start();
+
+// Check if server is draining
+int draining();
+
+// File descriptor which becomes (and stays) readable once draining starts, for waking up poll(...)/epoll_wait(...)
+int drain_event_fd();
+
+// Check if drain timeout passed (connections still open then are closed by exiting)
+int drain_expired();
+
+// Wait until all connections are finished or drain timeout passes, run by listener once it stopped accepting
+void drain_finish();
+
+#endif // DRAIN_H
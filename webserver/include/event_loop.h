@@ -0,0 +1,25 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+#include <config.h>
+
+// Maximum number of readiness events handled per epoll_wait(...) call
+#define EPOLL_MAX_EVENTS 256
+
+// Starts epoll-based web listening: single thread, non-blocking sockets,
+// every connection is a state machine (recv -> parse -> send) driven by readiness events
+// Returns 0 after draining, 1 on failure
+int epoll_listen(config_t* conf);
+
+// Event loop of reuseport mode, each one owns its listening socket and connections accepted from it
+typedef struct {
+    int index; // Loop index (selects CPU the loop is pinned to)
+    int listen_sock; // Own SO_REUSEPORT listening socket
+} reuseport_loop_t;
+
+// Starts SO_REUSEPORT sharded web listening: conf->reuseport_size listening sockets on the same port,
+// each served by its own epoll event loop thread pinned to its own CPU (kernel spreads new connections between them)
+// Failure of any event loop makes server drain and exit with failure
+// Returns 0 after draining, 1 on failure
+int reuseport_listen(config_t* conf);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,63 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+#include <common.h>
+#include <config.h>
+#include <http_date.h>
+
+// Amount of hash table buckets (power of two)
+#define FILE_CACHE_BUCKETS 1024
+
+// On-the-fly gzip variant states of cached document
+#define FILE_CACHE_GZIP_NONE    0 // Not compressed yet
+#define FILE_CACHE_GZIP_READY   1 // gzip_data holds compressed contents
+#define FILE_CACHE_GZIP_USELESS 2 // Compression didn't make document smaller (or failed), document is always sent as is
+
+// Cached document: file bytes plus everything needed for response header
+// Entries are reference counted, evicted/invalidated entries are freed when their last user releases them
+typedef struct file_cache_entry {
+    char* doc_path; // Cache key (request doc_path)
+    char* resolved_path; // Real file path (for invalidation on file changes)
+    char* data; // File contents
+    struct stat stats;
+    const char* content_type;
+    char last_modified[HTTP_DATE_MAX]; // Formatted Last-Modified header value (formatted once, when document is cached)
+    char etag[HTTP_ETAG_MAX]; // Formatted ETag header value (formatted once, when document is cached)
+    int gzip_state; // On-the-fly gzip variant: FILE_CACHE_GZIP_NONE, FILE_CACHE_GZIP_READY or FILE_CACHE_GZIP_USELESS (protected by cache lock)
+    char* gzip_data; // gzip compressed file contents (FILE_CACHE_GZIP_READY only)
+    size_t gzip_len;
+    int refs; // References held by the cache (while entry is in it) and by responses using data (protected by cache lock)
+
+    struct file_cache_entry* hash_next; // Hash bucket chain
+    struct file_cache_entry* lru_prev; // LRU list (head is most recently used)
+    struct file_cache_entry* lru_next;
+} file_cache_entry_t;
+
+// Setup process-wide document cache with byte budget conf->file_cache_size (0 - cache is disabled)
+// and subscribe it to file change notifications, run this BEFORE fs_watch_start(...)
+void file_cache_init(const config_t* conf);
+
+// Check if document of given size is allowed to be cached (nothing is, once file changes could go unnoticed)
+int file_cache_accepts(off_t size);
+
+// Get cached document by doc_path
+// Returns referenced entry (release it with file_cache_release(...)), NULL if document is not cached
+file_cache_entry_t* file_cache_lookup(const char* doc_path);
+
+// Generation of cache contents (changes on every invalidation), take it before stat-ing a document for file_cache_insert(...)
+unsigned long file_cache_generation();
+
+// Read document file (already opened as fd, with stats) and add it to the cache
+// Document is not added if files changed since generation was taken (cached data could be stale)
+// Returns referenced entry (release it with file_cache_release(...)), NULL if document couldn't be read or cached
+file_cache_entry_t* file_cache_insert(const char* doc_path, const char* resolved_path, int fd, const struct stat* stats,
+    const char* content_type, unsigned long generation);
+
+// Get gzip compressed variant of cached document (compressed with zlib level only once per cached file version,
+// compressed bytes count towards cache budget and are freed together with entry)
+// Returns 0 if entry->gzip_data/gzip_len can be used, 1 if document should be sent uncompressed
+int file_cache_gzip(file_cache_entry_t* entry, int level);
+
+// Release reference to cache entry
+void file_cache_release(file_cache_entry_t* entry);
+
+#endif // FILE_CACHE_H
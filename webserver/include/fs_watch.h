@@ -0,0 +1,24 @@
+#ifndef FS_WATCH_H
+#define FS_WATCH_H
+#include <common.h>
+
+// Maximum amount of change subscribers (caches which need invalidation)
+#define FS_WATCH_MAX_SUBSCRIBERS 8
+
+// Change callback, called from the watcher thread with path of changed file or directory
+// (directory changes concern every path below it), NULL path means "anything could have changed" (event queue overflow)
+typedef void (*fs_watch_cb_t)(const char* path);
+
+// Register change callback, run this BEFORE fs_watch_start(...)
+// Returns 0 on success, 1 if there are too many subscribers
+int fs_watch_subscribe(fs_watch_cb_t callback);
+
+// Recursively watch directory tree at root with inotify and start watcher thread which notifies subscribers
+// Returns 0 on success, 1 on failure (also when some directory of the tree can't be watched)
+int fs_watch_start(const char* root);
+
+// Check if some directory of the watched tree went unwatched after start (e.g. inotify watch limit reached),
+// changes below it are not noticed, so caches must not take new entries anymore
+int fs_watch_lost();
+
+#endif // FS_WATCH_H
@@ -0,0 +1,54 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+#include <common.h>
+
+// Listening socket inheritance and handoff to new server instance (zero-downtime restart/upgrade)
+// Server takes listening sockets passed with LISTEN_FDS/LISTEN_PID environment variables (sockets are fds 3, 4, ...),
+// which is both systemd socket activation and how instance started by handoff gets sockets of its predecessor
+// On SIGUSR2 running server passes its listening sockets to exec helper (forked before chroot, so it can still execute the
+// server binary) and it starts new instance with them, old instance keeps accepting until new one is listening and then drains
+
+// Maximum amount of listening sockets passed between instances
+#define HANDOFF_MAX_FDS 64
+
+// Environment variable with PID of instance which handed its listening sockets over (drained once new instance is listening)
+#define HANDOFF_PID_ENV "WEBSERVER_HANDOFF_PID"
+
+// Take over listening sockets passed in LISTEN_FDS (only if LISTEN_PID is this process) and previous instance PID of handoff
+// Passing variables are removed from environment, so they are not inherited further
+// Run this BEFORE daemon_detach(...) (LISTEN_PID names process started with them)
+// Returns 0 on success, 1 on failure
+int handoff_inherit();
+
+// Take inherited listening socket bound to given port
+// Returns listening socket, -1 if none was inherited for the port
+int handoff_take_listen_socket(uint16_t port);
+
+// Remember listening socket, so it is passed to new instance on handoff
+void handoff_add_listen_socket(int listen_sock);
+
+// Start exec helper process, which starts new instances with same arguments (argv) on handoff
+// Run this BEFORE chroot_doc_root(...) and BEFORE creating any threads
+// Returns 0 on success, 1 on failure
+int handoff_start_helper(char const* argv[]);
+
+// Hand listening sockets over to new server instance started by exec helper (run by signal thread on SIGUSR2)
+// This instance keeps serving until new one reports it is listening (handoff_ready(...)), then it drains
+// Returns 0 on success, 1 on failure
+int handoff_exec();
+
+// Remember pid file, written with PID of this process once it is listening (handoff_ready(...))
+// Its directory is kept open, so file can be written and removed after chroot
+// Run this BEFORE chroot_doc_root(...), AFTER daemon_detach(...)
+// Returns 0 on success, 1 on failure
+int handoff_set_pid_file(const char* path);
+
+// Remove pid file, unless it names another process already (instance which took listening sockets over)
+void handoff_remove_pid_file();
+
+// Report that listening sockets are set up: closes inherited sockets nobody took over, writes pid file
+// and tells previous instance (if this one was started by handoff) to drain
+// Run this once, AFTER every listening socket is opened
+void handoff_ready();
+
+#endif // HANDOFF_H
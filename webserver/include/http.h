@@ -2,6 +2,9 @@
 #define HTTP_H
 #include <common.h>
 #include <config.h>
+#include <file_cache.h>
+#include <map_cache.h>
+#include <http_date.h>
 
 // Content-type defines/enums
 #define CONTENT_TEXT_PLAIN       "text/plain"               // .txt
@@ -23,12 +26,8 @@ const char* doc_content_type(const char* docpath);
 #define HTTP_VERSION_1_0 "HTTP/1.0"
 #define HTTP_VERSION_1_1 "HTTP/1.1"
 #define HTTP_VERSION_2_0 "HTTP/2.0"
-#define HTTP_VERSION HTTP_VERSION_1_0
+#define HTTP_VERSION HTTP_VERSION_1_0 // Response version for HTTP/1.0 (and unparseable) requests, others get HTTP/1.1
 #define HTTP_HEADER_SERVER "BTH students"
-#define HTTP_DEFAULT_DATE "Thu, 1 Jan 1970 00:00:00 GMT" // Use in case of datetime formatting errors
-
-// Formats
-#define HTTP_DATETIME_FORMAT "%a, %d %b %Y %X GMT"
 
 // Valid methods
 #define HTTP_METHOD_HEAD "HEAD"
@@ -41,9 +40,12 @@ const char* doc_content_type(const char* docpath);
 // Implemented status codes
 typedef enum {
     HTTP_STATUS_OK = 200,
+    HTTP_STATUS_PARTIALCONTENT = 206,
+    HTTP_STATUS_NOTMODIFIED = 304,
     HTTP_STATUS_BADREQUEST = 400,
     HTTP_STATUS_FORBIDDEN = 403,
     HTTP_STATUS_NOTFOUND = 404,
+    HTTP_STATUS_RANGENOTSATISFIABLE = 416,
     HTTP_STATUS_INTERNALSERVERERROR = 500,
     HTTP_STATUS_NOTIMPLEMENTED = 501,
 } http_status_t;
@@ -66,6 +68,7 @@ typedef struct {
     char doc_path[PATH_MAX]; // Document path extracted and copied from URI
     char* version; // Pointer to the HTTP Version
     char* header_fields; // Pointer to Header fields
+    int keep_alive; // 1 if connection should stay open after response (HTTP/1.1 default or "Connection: keep-alive")
 } http_request_t;
 
 /*
@@ -74,6 +77,7 @@ Date: Wed, 10 Oct 2018 18:39:41 GMT
 Content-Type: text/html
 Content-Length: 1087
 Last-Modified: Wed, 10 Oct 2018 15:26:09 GMT
+ETag: "2a1c3f-43f-5bbe1a41.1d0c4b8"
 Server: BTH students
 \r\n                                           <--- Header/Body divider
 <html>                                         <--- Body content start
@@ -83,15 +87,162 @@ Server: BTH students
 </html>                                        <--- We close connection when body is fully sent (body being contents of some document/resource)
 */
 
+// Bytes moved per splice(...) call when sendfile(...) can't be used for document file
+#define HTTP_SPLICE_CHUNK 65536
+
+// Maximum amount of in-memory response segments (header, body parts)
+#define HTTP_RESPONSE_IOV_MAX 4
+
+// Maximum amount of segments gathered into one sendmsg(...) call when sending several (pipelined) responses
+#define HTTP_SEND_BATCH_IOV_MAX 64
+
+// Size of formatted response header buffer (responses never echo client input, so headers stay small)
+#define HTTP_RESPONSE_HEADER_MAX 1024
+
+// Maximum amount of byte ranges served in one response (requests asking for more get whole document)
+#define HTTP_RANGES_MAX 8
+
+// Size of multipart/byteranges part header buffer (boundary, Content-Type and Content-Range of one part)
+#define HTTP_PART_HEADER_MAX 256
+
+// Document byte range (inclusive bounds, as in Content-Range)
+typedef struct {
+    off_t first;
+    off_t last;
+} http_byte_range_t;
+
+// multipart/byteranges body of multi-range response, parts are loaded into response one at a time
+// (part header plus cached document slice or file range, then closing boundary)
+typedef struct {
+    char boundary[64];
+    const char* content_type; // Document Content-Type (repeated in every part)
+    off_t size; // Whole document size (for Content-Range)
+    http_byte_range_t ranges[HTTP_RANGES_MAX];
+    int count;
+    int index; // Next part to load (count - closing boundary, count + 1 - all parts loaded)
+    char part_header[HTTP_PART_HEADER_MAX]; // Header of currently transmitted part (or closing boundary)
+} http_multipart_t;
+
+typedef struct http_error_pages http_error_pages_t;
+
+// Prepared HTTP response: in-memory segments (header, cached or mapped document, pre-rendered error page) plus optional document file
+// Sending progress is kept inside, so transmission can be resumed on non-blocking sockets
+// In-memory segments are gathered into one writev-like sendmsg(...) call,
+// document file bodies are transmitted zero-copy with sendfile(...) (splice(...) through a pipe as fallback)
+typedef struct {
+    http_status_t status;
+    const char* version; // HTTP version of response (matches request version)
+    int keep_alive; // 1 if connection stays open after response was sent
+    off_t body_len; // Body bytes of response (for access log)
+    char header[HTTP_RESPONSE_HEADER_MAX]; // Formatted response header
+    char date[HTTP_DATE_MAX]; // Formatted Date header value (for pre-rendered error responses)
+    struct iovec iov[HTTP_RESPONSE_IOV_MAX]; // In-memory segments, in transmission order
+    int iov_count;
+    int iov_index; // First segment which is not fully sent yet (partially sent segments are advanced in place)
+    file_cache_entry_t* body_cache; // Cache entry which in-memory body belongs to (released together with response)
+    map_cache_entry_t* body_map; // Shared mapping which in-memory body belongs to (released together with response)
+    const char* body_data; // In-memory body: cached document, its gzip variant or mapped document (NULL if body is not in memory)
+    int body_fd; // Document file descriptor (-1 if body is not a file)
+    off_t body_offset; // File offset of next byte to transmit
+    off_t body_remaining; // File bytes not yet transmitted (excluding bytes in body_pipe)
+    int body_pipe[2]; // splice(...) fallback pipe, created on first use (-1 otherwise)
+    size_t body_piped; // File bytes currently sitting in body_pipe
+    http_multipart_t* multipart; // Remaining parts of multi-range response (NULL for other responses)
+    char* body_buffer; // Generated body owned by response, e.g. metrics page (NULL for other responses)
+    http_error_pages_t* error_pages; // Error page set pre-rendered response points into (released together with response)
+} http_response_t;
+
+// Error statuses which get pre-rendered responses
+#define HTTP_ERROR_STATUSES { HTTP_STATUS_BADREQUEST, HTTP_STATUS_FORBIDDEN, HTTP_STATUS_NOTFOUND, HTTP_STATUS_INTERNALSERVERERROR, HTTP_STATUS_NOTIMPLEMENTED }
+#define HTTP_ERROR_STATUS_COUNT 5
+
+// Pre-rendered error response (header and /_errors/<status>.html body), split around its only per-response part - Date value
+typedef struct {
+    http_status_t status;
+    char* head[2]; // Status line up to Date value, index 0 - HTTP/1.0, 1 - HTTP/1.1 (e.g. "HTTP/1.1 404 Not Found\r\nDate: ")
+    size_t head_len[2];
+    char* tail[2]; // Rest of header and body, index 0 - closed connection, 1 - keep-alive (e.g. "\r\nContent-Type: ...\r\n\r\n<html>...")
+    size_t tail_len[2];
+    size_t body_len; // Error file bytes at the end of tail
+} http_error_page_t;
+
+// Pre-rendered error responses of all HTTP_ERROR_STATUSES, replaced as a whole on reload
+// Responses reference set their segments point into, so replaced set is freed once last of them is released
+struct http_error_pages {
+    http_error_page_t pages[HTTP_ERROR_STATUS_COUNT];
+    int refs; // Reference of current set itself and of responses (protected by error pages lock)
+};
+
+// send_http_response(...) return values
+#define HTTP_SEND_DONE  0 // Response fully sent
+#define HTTP_SEND_ERROR 1 // Socket or file failure (close connection)
+#define HTTP_SEND_AGAIN 2 // Socket would block, call again when socket is writable
+
+// Find header field value by (case-insensitive) field name
+// Returns pointer to value (surrounding whitespace skipped) and sets value_len, NULL if field is not present
+const char* http_header_value(const http_request_t* http_request, const char* name, size_t* value_len);
+
+// Search for request termination signal \r\n\r\n (correct) or \n\n (tolerant) in buf, continuing from scan_from
+// (bytes before scan_from were already searched, they're only looked at to complete signal split between reads)
+// Returns length of request (including termination signal), 0 if not terminated yet
+size_t http_request_end(const char* buf, size_t scan_from, size_t len);
+
 // Parse raw received bytes into http request struct
 // Returns 0 if parsing was successful, 1 if not then its a "400 Bad Request" because of malformed client message
 int parse_http_request(char* message_buf, http_request_t* http_request);
 
-// Send HTTP response based on http_request through socket_id socket
-// Return 0 if sending was successful, 1 if nothing succeeded (in which case you want to close connection)
-int send_http_response(int socket_id, const config_t* conf, const http_request_t* http_request);
+// Prepare HTTP response based on http_request (falls back to error responses on failures)
+// Return 0 if response was prepared, 1 if nothing succeeded (in which case you want to close connection)
+int prepare_http_response(const config_t* conf, const http_request_t* http_request, http_response_t* http_response);
+
+// Check if request asks for metrics page (conf->metrics_path)
+int is_http_metrics_request(const config_t* conf, const http_request_t* http_request);
+
+// Prepare response with current metrics in Prometheus text format, local_client is 1 if request came from loopback address
+// (metrics are only shown to local clients, others get 403)
+// Return 0 if response was prepared, 1 if not (in which case you want to close connection)
+int prepare_http_metrics_response(const config_t* conf, const http_request_t* http_request, int local_client, http_response_t* http_response);
+
+// Load and pre-render error responses for all HTTP_ERROR_STATUSES (run AFTER chroot, again to reload changed error files)
+// Missing error files fall back to hardcoded format
+// Previously loaded pages are freed once responses still pointing into them are released
+// Return 0 if pages were loaded, 1 if not (previously loaded pages stay in use)
+int load_http_error_pages();
+
+// Prepare pre-rendered status error response based on status code (http_request can be NULL)
+// Return 0 if response was prepared, 1 if not (in which case you want to close connection)
+int prepare_http_error_response(const config_t* conf, const http_request_t* http_request, http_status_t status, http_response_t* http_response);
+
+// Gather unsent in-memory segments of responses (starting with first one) into batch for single gathered write
+// Gathering stops after first response with file body (or more byteranges parts), because its remaining bytes must go out before next response
+// Returns amount of gathered segments (0 if first response has only file body left, or everything is sent)
+int gather_http_responses(const http_response_t* http_responses, int count, struct iovec* batch, int batch_max);
+
+// Check if segments gathered with gather_http_responses(...) are followed by more bytes of their last response
+// (file body or further multipart/byteranges parts), so gathered write should carry MSG_MORE and header shares packet with body
+int http_responses_continue(const http_response_t* http_responses, int count);
+
+// Account sent_bytes of segments gathered with gather_http_responses(...) (partially sent segment is advanced in place)
+void advance_http_responses(http_response_t* http_responses, int count, size_t sent_bytes);
+
+// Check if response is fully sent (in-memory segments, file body and all multipart/byteranges parts)
+int http_response_sent(const http_response_t* http_response);
+
+// Load next multipart/byteranges part into response once its current part is fully sent
+// Returns 1 if next part was loaded (continue sending response), 0 otherwise
+int next_http_response_part(http_response_t* http_response);
+
+// Send (or continue sending) count prepared HTTP responses, in order, through socket_id socket
+// In-memory segments of consecutive responses are gathered into one sendmsg(...) (up to response with file body)
+// *sent is amount of fully sent responses (start with 0, keep it between calls)
+// Returns HTTP_SEND_DONE when all are sent, HTTP_SEND_ERROR or HTTP_SEND_AGAIN (only for non-blocking sockets)
+int send_http_responses(int socket_id, http_response_t* http_responses, int count, int* sent);
+
+// Send (or continue sending) prepared HTTP response through socket_id socket
+// Returns HTTP_SEND_DONE, HTTP_SEND_ERROR or HTTP_SEND_AGAIN (only for non-blocking sockets)
+int send_http_response(int socket_id, http_response_t* http_response);
 
-// Send formatted status error response based on status code
-int send_http_error_response(int socket_id, const config_t* conf, const http_request_t* http_request, http_status_t status);
+// Release resources held by prepared response (open document file, splice pipe, cache entry or mapping, multipart state)
+void release_http_response(http_response_t* http_response);
 
 #endif // HTTP_H
\ No newline at end of file
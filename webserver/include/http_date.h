@@ -0,0 +1,32 @@
+#ifndef HTTP_DATE_H
+#define HTTP_DATE_H
+#include <common.h>
+
+#define HTTP_DEFAULT_DATE "Thu, 1 Jan 1970 00:00:00 GMT" // Use in case of datetime formatting errors
+
+// Formats
+#define HTTP_DATETIME_FORMAT "%a, %d %b %Y %X GMT"
+#define HTTP_DATE_MAX 100 // Size of formatted date buffers
+#define HTTP_DATETIME_FORMAT_RFC850  "%A, %d-%b-%y %X GMT" // Obsolete formats, still accepted in conditional request headers
+#define HTTP_DATETIME_FORMAT_ASCTIME "%a %b %e %X %Y"
+#define HTTP_ETAG_MAX 96 // Size of formatted entity tag buffers (room for encoded variant suffix)
+
+// Format time as HTTP date (HTTP_DATETIME_FORMAT, GMT) into out (HTTP_DATE_MAX bytes)
+// Returns formatted length (HTTP_DEFAULT_DATE is used in case of formatting errors)
+size_t format_http_date(time_t t, char* out);
+
+// Parse HTTP date (HTTP_DATETIME_FORMAT, or obsolete RFC 850/asctime formats) of value_len bytes into t
+// Returns 0 on success, 1 if value is not a valid HTTP date
+int parse_http_date(const char* value, size_t value_len, time_t* t);
+
+// Format entity tag of document from its inode, size and modification time into out (HTTP_ETAG_MAX bytes)
+// Tag is weak (W/ prefix) when document was modified during current second, as it may still change within mtime resolution
+// Returns formatted length
+size_t format_http_etag(const struct stat* stats, char* out);
+
+// Copy current Date header value into out (HTTP_DATE_MAX bytes)
+// Process-wide string is re-formatted at most once per second, readers never take locks (seqlock)
+// Returns copied length
+size_t http_date_now(char* out);
+
+#endif // HTTP_DATE_H
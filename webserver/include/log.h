@@ -0,0 +1,67 @@
+#ifndef LOG_H
+#define LOG_H
+#include <common.h>
+#include <config.h>
+
+// Per-thread ring buffer size in bytes (power of two), records which don't fit are dropped (and counted)
+#define LOG_RING_SIZE 32768
+// Maximum length of single formatted log record
+#define LOG_RECORD_MAX 2048
+// Output buffer size per log file of writer thread
+#define LOG_WRITE_BUFSIZE 65536
+// How often writer thread drains ring buffers (milliseconds)
+#define LOG_FLUSH_INTERVAL_MS 50
+
+// Log destinations
+typedef enum {
+    LOG_DEST_ERROR = 0, // Leveled server messages (error_log, stdout if not set)
+    LOG_DEST_ACCESS,    // One line per response (access_log, disabled if not set)
+    LOG_DEST_COUNT,
+} log_dest_t;
+
+// Single producer (owning thread), single consumer (writer thread) byte ring of length-prefixed records
+// Rings of exited threads are drained and then reused by new threads
+typedef struct log_ring {
+    char data[LOG_RING_SIZE];
+    atomic_size_t head; // Total bytes written (only advanced by owning thread)
+    atomic_size_t tail; // Total bytes consumed (only advanced by writer thread)
+    atomic_int state; // LOG_RING_ACTIVE, LOG_RING_RELEASED (owner exited) or LOG_RING_FREE (drained, can be reused)
+    atomic_ulong dropped; // Records dropped because ring was full
+    struct log_ring* next; // Registry of all rings (only grows)
+} log_ring_t;
+
+#define LOG_RING_ACTIVE   0
+#define LOG_RING_RELEASED 1
+#define LOG_RING_FREE     2
+
+// Open log files (error_log, access_log) and apply log level from config
+// Run this BEFORE chroot, directories of log files stay open for rotation afterwards
+// Until log_start(), messages are written directly (synchronously)
+// Returns 0 on success, 1 on failure
+int log_init(const config_t* conf);
+
+// Start background writer thread, from now on logging only copies records into per-thread ring buffers
+// Returns 0 on success, 1 on failure
+int log_start();
+
+// Stop background writer thread once it wrote out records buffered so far (server exit), later messages are written directly
+void log_stop();
+
+// Change minimum logged level (e.g. on config reload), safe while other threads log
+void log_set_level(log_level_t level);
+
+// Check if messages of given level are logged (for skipping work needed only for logging)
+int log_enabled(log_level_t level);
+
+// Check if access log is enabled
+int log_access_enabled();
+
+// Log formatted server message (newline is appended), e.g. log_msg(LOG_LEVEL_INFO, "[main] Started")
+void log_msg(log_level_t level, const char* format, ...) __attribute__ ((format (printf, 2, 3)));
+
+// Log response to access log in Common Log Format (or Combined Log Format with referer/user_agent)
+// Request line parts are NULL for unparsed requests, referer/user_agent are not terminated (NULL if missing)
+void log_access(const char* client_addr, const char* method, const char* uri, const char* version, int status, off_t body_len,
+    const char* referer, size_t referer_len, const char* user_agent, size_t user_agent_len);
+
+#endif // LOG_H
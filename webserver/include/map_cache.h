@@ -0,0 +1,45 @@
+#ifndef MAP_CACHE_H
+#define MAP_CACHE_H
+#include <common.h>
+#include <config.h>
+
+// Amount of hash table buckets (power of two)
+#define MAP_CACHE_BUCKETS 256
+
+// Shared read-only mapping of document file, for documents too big for document cache
+// Every request of the file sends straight from the same mapping (pages are the page cache pages, never copied into heap)
+// Entries are reference counted, evicted/invalidated entries are unmapped when their last user releases them
+typedef struct map_cache_entry {
+    char* resolved_path; // Cache key (real file path, so all doc_paths of one file share its mapping)
+    char* data; // Mapped file contents (only ever passed to kernel, so file truncated meanwhile fails the send with EFAULT instead of SIGBUS)
+    struct stat stats; // Mapped file version (entry is only used for requests which resolved the same version)
+    int refs; // References held by the cache (while entry is in it) and by responses using data (protected by cache lock)
+
+    struct map_cache_entry* hash_next; // Hash bucket chain
+    struct map_cache_entry* lru_prev; // LRU list (head is most recently used)
+    struct map_cache_entry* lru_next;
+} map_cache_entry_t;
+
+// Setup process-wide mapping cache with mapped bytes budget conf->mmap_cache_size (0 - mmap serving is disabled)
+// for documents of up to conf->mmap_max_file bytes, and subscribe it to file change notifications, run this BEFORE fs_watch_start(...)
+void map_cache_init(const config_t* conf);
+
+// Check if document of given size is allowed to be mapped (nothing is, once file changes could go unnoticed)
+int map_cache_accepts(off_t size);
+
+// Check if stats describe the same file version (device, inode, size and modification time match)
+int map_cache_same_file(const struct stat* a, const struct stat* b);
+
+// Get mapping of resolved_path file, if it maps the same file version as stats
+// Returns referenced entry (release it with map_cache_release(...)), NULL if file is not mapped
+map_cache_entry_t* map_cache_lookup(const char* resolved_path, const struct stat* stats);
+
+// Map document file (already opened as fd, expected to be stats version) and add it to the cache
+// Mapping is advised for sequential access and read-ahead of its pages is started
+// Returns referenced entry (release it with map_cache_release(...)), NULL if file changed or couldn't be mapped
+map_cache_entry_t* map_cache_insert(const char* resolved_path, int fd, const struct stat* stats);
+
+// Release reference to cache entry
+void map_cache_release(map_cache_entry_t* entry);
+
+#endif // MAP_CACHE_H
@@ -0,0 +1,52 @@
+#ifndef META_CACHE_H
+#define META_CACHE_H
+#include <common.h>
+#include <config.h>
+
+// Lock shards (power of two) and hash buckets per shard (power of two)
+#define META_CACHE_SHARDS 16
+#define META_CACHE_SHARD_BUCKETS 256
+
+// Resolved document metadata: result of realpath(...) and stat(...) of request doc_path
+typedef struct {
+    int error; // 0 - document exists, otherwise errno of failed lookup (only ENOENT and EACCES results are cached)
+    char resolved_path[PATH_MAX];
+    struct stat stats;
+    const char* content_type;
+} doc_meta_t;
+
+// Cached lookup result, keyed by raw request doc_path
+// Found documents stay until file change notification invalidates them (or file turns out to differ when served),
+// missing/forbidden ones also expire after TTL
+typedef struct meta_cache_entry {
+    char* doc_path;
+    char* resolved_path; // NULL for negative (ENOENT/EACCES) entries
+    struct stat stats;
+    const char* content_type;
+    int error;
+    time_t expires; // Negative entries only
+
+    struct meta_cache_entry* hash_next; // Hash bucket chain
+    struct meta_cache_entry* lru_prev; // Shard LRU list (head is most recently used)
+    struct meta_cache_entry* lru_next;
+} meta_cache_entry_t;
+
+// Setup process-wide metadata cache with conf->meta_cache_entries capacity (0 - cache is disabled)
+// and subscribe it to file change notifications, run this BEFORE fs_watch_start(...)
+void meta_cache_init(const config_t* conf);
+
+// Get cached metadata of doc_path (no filesystem access)
+// Returns 0 if meta was filled from cache, 1 if doc_path has to be resolved (then take meta_cache_generation() first)
+int meta_cache_lookup(const char* doc_path, doc_meta_t* meta);
+
+// Generation of cache contents (changes on every invalidation), take it before resolving a document for meta_cache_insert(...)
+unsigned long meta_cache_generation();
+
+// Add resolved metadata of doc_path to the cache (results other than success, ENOENT and EACCES are not cached)
+// Result is not added if files changed since generation was taken (it could be stale) or once file changes could go unnoticed
+void meta_cache_insert(const char* doc_path, const doc_meta_t* meta, unsigned long generation);
+
+// Drop cached metadata of doc_path (file turned out to differ from cached stats, change notification did not arrive yet)
+void meta_cache_forget(const char* doc_path);
+
+#endif // META_CACHE_H
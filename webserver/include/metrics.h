@@ -0,0 +1,66 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <common.h>
+#include <http.h>
+
+// Counter shards (power of two), every thread updates its own shard (threads beyond shard count share them)
+#define METRICS_SHARDS 64
+#define METRICS_CACHE_LINE 64
+
+// Request methods and statuses counted separately (other methods and unparsable requests are counted as "other")
+#define METRICS_METHODS { "GET", "HEAD", "other" }
+#define METRICS_METHOD_COUNT 3
+#define METRICS_STATUSES { HTTP_STATUS_OK, HTTP_STATUS_PARTIALCONTENT, HTTP_STATUS_NOTMODIFIED, HTTP_STATUS_BADREQUEST, HTTP_STATUS_FORBIDDEN, \
+    HTTP_STATUS_NOTFOUND, HTTP_STATUS_RANGENOTSATISFIABLE, HTTP_STATUS_INTERNALSERVERERROR, HTTP_STATUS_NOTIMPLEMENTED }
+#define METRICS_STATUS_COUNT 9
+
+// Request handling latency histogram (request received until its response is fully sent), upper bounds in microseconds
+#define METRICS_LATENCY_BOUNDS { 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 }
+#define METRICS_LATENCY_BOUND_COUNT 16
+
+// Size of rendered metrics page buffer
+#define METRICS_RENDER_MAX 16384
+
+// Counters of one shard, aligned to its own cache lines so threads never write into each other's lines
+// Only the owning thread(s) write a shard (relaxed atomic adds, no locks), shards are summed only when metrics are read
+typedef struct {
+    _Alignas(METRICS_CACHE_LINE) atomic_ulong requests[METRICS_METHOD_COUNT][METRICS_STATUS_COUNT];
+    atomic_ulong latency_buckets[METRICS_LATENCY_BOUND_COUNT + 1]; // Last bucket - above every bound (+Inf)
+    atomic_ulong latency_sum_us;
+    atomic_ulong sent_bytes;
+    atomic_ulong connections_total;
+    atomic_long connections_active; // Opened minus closed on this shard (may be negative, only the sum is meaningful)
+    atomic_ulong parse_failures;
+    atomic_ulong connection_timeouts;
+    atomic_ulong connections_rejected;
+} metrics_shard_t;
+
+// Count accepted connection
+void metrics_connection_opened();
+
+// Count closed connection
+void metrics_connection_closed();
+
+// Count request which couldn't be parsed (malformed or too long)
+void metrics_parse_failure();
+
+// Count connection closed because it missed its deadline (slow or stalled client)
+void metrics_connection_timeout();
+
+// Count connection refused because connection limit (conn_memory_limit) was reached
+void metrics_connection_rejected();
+
+// Count bytes written to client socket
+void metrics_sent_bytes(size_t bytes);
+
+// Count fully sent response (method is NULL for unparsable requests) and its handling latency
+void metrics_response(const char* method, http_status_t status, unsigned long latency_us);
+
+// Microseconds of monotonic clock, for measuring request handling latency
+unsigned long metrics_now_us();
+
+// Render sum of all shards in Prometheus text exposition format into buf
+// Returns rendered length (size or more if buf was too small)
+size_t metrics_render(char* buf, size_t size);
+
+#endif // METRICS_H
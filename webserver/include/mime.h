@@ -0,0 +1,26 @@
+#ifndef MIME_H
+#define MIME_H
+#include <common.h>
+
+// Maximum length of file extension and of Content-Type in mime.types file
+#define MIME_EXT_MAX 32
+#define MIME_TYPE_MAX 128
+
+// Extension to Content-Type mapping
+typedef struct {
+    char* ext; // Lowercase, without leading '.'
+    const char* type;
+} mime_entry_t;
+
+// Build extension lookup table from built-in types and mime.types-style file ("<type> <ext> <ext> ..." lines, '#' comments)
+// Extensions of the file override built-in ones, empty filename - built-in types only
+// Table is compiled into perfect hash (every extension has its own slot), so lookup is constant time however many types are registered
+// Run this BEFORE chroot(...) and before any request is handled
+// Returns 0 if successful, 1 if file couldn't be read or table couldn't be built
+int mime_load(const char* filename);
+
+// Get Content-Type of extension (ext_len bytes without leading '.', matched case-insensitively)
+// Returns NULL for unknown extensions
+const char* mime_lookup(const char* ext, size_t ext_len);
+
+#endif // MIME_H
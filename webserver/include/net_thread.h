@@ -1,20 +1,35 @@
 #ifndef NET_THREAD_H
 #define NET_THREAD_H
 #include <config.h>
+#include <conn.h>
 
 // Interesting note: errno is thread-local, therefore thread-safe
 // Source: https://stackoverflow.com/a/1694170 (http://linux.die.net/man/3/errno)
 
-// Thread data structure
-typedef struct {
-    int socket_id;
-    const config_t* conf; // Must not be modified by threads (otherwise its a race condition)
-} thread_data_t;
+// Create, bind and start listening on IPv4 server socket for conf->port, or take over listening socket inherited for it (handoff)
+// Socket is non-blocking and is remembered for handing it over to new instance
+// reuse_port: 1 - allow other SO_REUSEPORT sockets on the same port (connections are spread between them by kernel)
+// Returns listening socket, -1 on failure
+int open_listen_socket(const config_t* conf, int reuse_port);
+
+// Stack size of connection serving threads (conf->thread_stack_size, or system default if it is 0)
+size_t thread_stack_bytes(const config_t* conf);
+
+// Setup attributes of connection serving threads (per-connection threads and worker pool threads), stack size is conf->thread_stack_size
+void init_thread_attr(pthread_attr_t* thread_attr, const config_t* conf);
 
 // Starts thread-based web listening, requests get split off in their own separate threads
+// Returns 0 after draining, 1 on failure
 int thread_listen(config_t* conf);
 
-// Request processing function for POSIX thread
-void* thread_handle_request(void* thread_data);
+// Starts worker pool based web listening, accepted sockets are pushed to a fixed-size work-stealing pool
+// Returns 0 after draining, 1 on failure
+int pool_listen(config_t* conf);
+
+// Serve client connection on blocking socket until connection is finished (destroys connection, closing the socket)
+void serve_conn(conn_t* conn);
+
+// Request processing function for POSIX thread, takes over connection object
+void* thread_handle_request(void* conn);
 
 #endif // NET_THREAD_H
\ No newline at end of file
@@ -0,0 +1,17 @@
+#ifndef SIGNALS_H
+#define SIGNALS_H
+#include <common.h>
+
+// Signals handled by signal thread:
+// SIGHUP : reload config file (runtime-tunable settings, see conf_reload(...)) and error pages from /_errors/
+// SIGUSR2 : start new server instance with listening sockets of this one (zero-downtime restart/upgrade, see handoff_exec(...)),
+//           this instance drains once new one is listening
+// SIGQUIT, SIGTERM : drain (stop accepting, finish open connections within drain_timeout) and exit
+
+// Block handled signals (in calling thread and threads created by it afterwards) and start signal handling thread,
+// which waits for them with sigwait(...), so handling code is not limited to async-signal-safe functions
+// Run this BEFORE creating any other threads
+// Returns 0 on success, 1 on failure
+int start_signal_thread();
+
+#endif // SIGNALS_H
@@ -0,0 +1,47 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <common.h>
+
+// Tick length (deadline resolution) and wheel geometry: TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots,
+// level N slot spans TIMER_WHEEL_SLOTS^N ticks, so the wheel covers 2^24 ticks (~19 days) ahead
+#define TIMER_WHEEL_TICK_MS 100
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+// Timer linked into wheel slot (embedded into the object it times out, data points back to it)
+typedef struct wheel_timer {
+    unsigned long expires; // Tick at which timer fires
+    struct wheel_timer* next;
+    struct wheel_timer** pprev; // Link pointing to this timer (NULL if timer is not scheduled)
+    void* data;
+} wheel_timer_t;
+
+// Hierarchical timing wheel: scheduling and cancelling are O(1), every tick fires one level 0 slot
+// and, once per lap of lower level, cascades one slot of the level above down (not thread-safe, one per event loop)
+typedef struct {
+    unsigned long now; // Current tick, timers expiring at or before it have fired
+    wheel_timer_t* slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    int count; // Scheduled timers
+} timer_wheel_t;
+
+// Milliseconds of monotonic clock (timer deadlines are expressed in it)
+unsigned long timer_now_ms();
+
+// Setup empty wheel starting at now_ms
+void timer_wheel_init(timer_wheel_t* wheel, unsigned long now_ms);
+
+// Setup timer which is not scheduled yet, data is returned with it once it fires
+void wheel_timer_init(wheel_timer_t* timer, void* data);
+
+// (Re)schedule timer to fire at deadline_ms (rounded up to tick, deadlines in the past fire on next tick)
+void timer_wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, unsigned long deadline_ms);
+
+// Cancel timer (nothing happens if it is not scheduled)
+void timer_wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer);
+
+// Advance wheel to now_ms
+// Returns list of fired timers linked through their next pointers (they are not scheduled anymore), NULL if none fired
+wheel_timer_t* timer_wheel_advance(timer_wheel_t* wheel, unsigned long now_ms);
+
+#endif // TIMER_WHEEL_H
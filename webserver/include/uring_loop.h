@@ -0,0 +1,68 @@
+#ifndef URING_LOOP_H
+#define URING_LOOP_H
+#include <common.h>
+#include <config.h>
+#include <conn.h>
+#include <linux/io_uring.h>
+
+// Submission queue entries (completion queue gets URING_CQ_ENTRIES, so completions of many connections fit)
+#define URING_SQ_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+
+// Special completion tags (connection operations carry their uring_conn_t pointer instead)
+#define URING_TAG_ACCEPT  1
+#define URING_TAG_TIMEOUT 2
+#define URING_TAG_CANCEL  3
+
+// Operation in flight for connection (at most one at a time)
+typedef enum {
+    URING_OP_RECV,       // Receive request bytes into request_buf
+    URING_OP_SENDMSG,    // Gathered write of queued responses' in-memory segments
+    URING_OP_SPLICE_IN,  // Move document file bytes into response pipe
+    URING_OP_SPLICE_OUT, // Move response pipe bytes to socket
+} uring_op_t;
+
+// Connection served through io_uring, owns buffers which must stay valid until its operation completes
+// Kept in connection object itself (conn->backend, reserved by connection pool in uring mode)
+typedef struct uring_conn {
+    conn_t* conn;
+    uring_op_t op;
+    struct msghdr msg;
+    struct iovec batch[HTTP_SEND_BATCH_IOV_MAX];
+    int timed_out; // 1 - connection missed its deadline and was shut down, it is destroyed once its operation completes
+
+    // List of open connections
+    struct uring_conn* prev;
+    struct uring_conn* next;
+} uring_conn_t;
+
+// Memory-mapped io_uring instance (set up with raw syscalls, no liburing)
+typedef struct {
+    int ring_fd;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    unsigned to_submit; // Queued entries not yet passed to kernel
+} uring_t;
+
+// Starts io_uring based web listening: single thread, accept/recv/sendmsg/splice are submitted as batches
+// and their completions drive connection state machines (one io_uring_enter(...) call per loop iteration)
+// Falls back to epoll_listen(...) when kernel lacks io_uring (or needed operations)
+// Returns 0 after draining, 1 on failure
+int uring_listen(config_t* conf);
+
+#endif // URING_LOOP_H
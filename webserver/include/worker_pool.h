@@ -0,0 +1,70 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+#include <common.h>
+#include <config.h>
+#include <conn.h>
+
+// Work item: accepted client socket (conn is NULL, connection object is taken once worker serves it)
+// or parked connection resumed by poller once its socket is ready
+typedef struct {
+    int socket_id;
+    conn_t* conn;
+} worker_item_t;
+
+// Bounded double-ended queue of work items, one per worker
+// Owner worker takes the oldest item (front, fair FIFO order), idle workers steal the newest one (back)
+typedef struct {
+    pthread_mutex_t lock;
+    worker_item_t* items; // Ring buffer of capacity entries
+    int capacity;
+    int front; // Index of oldest item
+    int count;
+} worker_deque_t;
+
+typedef struct worker_pool worker_pool_t;
+
+// Worker thread with its own deque
+typedef struct {
+    worker_pool_t* pool;
+    int index;
+    pthread_t thread_id;
+    worker_deque_t deque;
+} worker_t;
+
+// Fixed-size pool of request handling threads with work-stealing between their deques
+// Client sockets are non-blocking, connection which has to wait for its client is parked in poller instead of blocking
+// its worker (idle keep-alive and slow clients don't hold workers), poller pushes it back once its socket is ready
+struct worker_pool {
+    const config_t* conf; // Must not be modified by workers (otherwise its a race condition)
+    int size; // Number of worker threads (and deques)
+    worker_t* workers;
+    int next_push; // Round-robin push position (only used by the accepting thread)
+
+    // Sleeping/wakeup of idle workers and of the accepting thread when all deques are full
+    pthread_mutex_t wait_lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t space_cond;
+    int queued; // Total amount of items in all deques (protected by wait_lock)
+    int busy; // Items pushed and not finished yet, queued or being served (protected by wait_lock)
+    int stopping; // Workers and poller exit instead of waiting for work (protected by wait_lock)
+
+    // Poller of parked connections (registers them, enforces their deadlines with its own timer wheel)
+    pthread_t poller_id;
+    int poll_fd; // epoll instance, parked connections are registered with their conn_t object, wake_fd with NULL
+    int wake_fd; // eventfd waking poller up when connections are parked
+    pthread_mutex_t park_lock;
+    conn_t* parking; // Connections parked by workers and not registered by poller yet, linked through next (protected by park_lock)
+};
+
+// Create worker pool with given amount of workers, each with deque of queue_depth sockets, and start its threads
+// Returns NULL on failure
+worker_pool_t* worker_pool_create(const config_t* conf, int size, int queue_depth);
+
+// Push accepted client socket to the pool (blocks while all deques are full)
+void worker_pool_push(worker_pool_t* pool, int socket_id);
+
+// Amount of pushed sockets and resumed connections which are still queued or being served
+// (queued sockets have no connection object yet, parked connections aren't counted)
+int worker_pool_busy(worker_pool_t* pool);
+
+#endif // WORKER_POOL_H
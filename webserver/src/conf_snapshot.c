@@ -0,0 +1,221 @@
+#include <conf_snapshot.h>
+#include <log.h>
+
+// Setting which needs restart (listening sockets, threads, caches and log files are set up from it at startup)
+typedef struct {
+    const char* key;
+    size_t offset;
+    size_t size;
+    int is_string;
+} conf_restart_key_t;
+
+#define CONF_RESTART_KEY(field, is_string) { #field, offsetof(config_t, field), sizeof(((config_t*)0)->field), is_string }
+
+static const conf_restart_key_t restart_keys[] = {
+    CONF_RESTART_KEY(port, 0),
+    CONF_RESTART_KEY(doc_root_dir, 1),
+    CONF_RESTART_KEY(as_daemon, 0),
+    CONF_RESTART_KEY(server_mode, 0),
+    CONF_RESTART_KEY(pool_size, 0),
+    CONF_RESTART_KEY(pool_queue_depth, 0),
+    CONF_RESTART_KEY(reuseport_size, 0),
+    CONF_RESTART_KEY(conn_memory_limit, 0),
+    CONF_RESTART_KEY(thread_stack_size, 0),
+    CONF_RESTART_KEY(request_buffer_size, 0),
+    CONF_RESTART_KEY(listen_backlog, 0),
+    CONF_RESTART_KEY(file_cache_size, 0),
+    CONF_RESTART_KEY(file_cache_max_file, 0),
+    CONF_RESTART_KEY(mmap_cache_size, 0),
+    CONF_RESTART_KEY(mmap_max_file, 0),
+    CONF_RESTART_KEY(meta_cache_entries, 0),
+    CONF_RESTART_KEY(meta_cache_negative_ttl, 0),
+    CONF_RESTART_KEY(mime_types, 1),
+    CONF_RESTART_KEY(error_log, 1),
+    CONF_RESTART_KEY(access_log, 1),
+    CONF_RESTART_KEY(access_log_format, 0),
+    CONF_RESTART_KEY(log_rotate_size, 0),
+    CONF_RESTART_KEY(log_rotate_interval, 0),
+    CONF_RESTART_KEY(pid_file, 1),
+};
+
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER; // Publishing snapshots and switching threads to them
+static conf_snapshot_t* current = NULL; // Protected by snapshot lock
+static atomic_ulong current_generation = 0; // Generation of current snapshot, checked by threads without lock
+static pthread_once_t snapshot_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t snapshot_key;
+static __thread conf_snapshot_t* thread_snapshot = NULL;
+static int conf_dir_fd = -1; // Directory of config file (kept open, so it is reachable after chroot)
+static char conf_file_name[PATH_MAX];
+static config_t file_conf; // Values of config file as last read (before argument overrides and validation)
+
+// Helper function - open config file in remembered directory as stream
+// Returns NULL on failure (check errno)
+FILE* conf_open_file()
+{
+    FILE* filePtr;
+    int fd;
+
+    if ((fd = openat(conf_dir_fd, conf_file_name, O_RDONLY | O_CLOEXEC)) < 0) {
+        return NULL;
+    }
+    if ((filePtr = fdopen(fd, "r")) == NULL) {
+        close(fd);
+    }
+
+    return filePtr;
+}
+
+// Remember config file for reloads
+int conf_reload_init(const char* filename)
+{
+    const char* slash = strrchr(filename, '/');
+    char dir_path[PATH_MAX];
+    FILE* filePtr;
+
+    if (slash == NULL) {
+        strcpy(dir_path, ".");
+        snprintf(conf_file_name, PATH_MAX, "%s", filename);
+    } else {
+        snprintf(dir_path, PATH_MAX, "%.*s", (slash == filename) ? 1 : (int)(slash - filename), filename);
+        snprintf(conf_file_name, PATH_MAX, "%s", slash + 1);
+    }
+
+    if ((conf_dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        printf("[ERROR] [conf_reload_init] Failed to open config file directory \"%s\", error: %s\n", dir_path, strerror(errno));
+        return 1;
+    }
+
+    if ((filePtr = conf_open_file()) == NULL) {
+        printf("[ERROR] [conf_reload_init] Failed to open config file \"%s\", error: %s\n", filename, strerror(errno));
+        return 1;
+    }
+    return read_conf_stream(&file_conf, filePtr);
+}
+
+// Publish initial config snapshot
+int conf_publish(const config_t* conf)
+{
+    conf_snapshot_t* snapshot = (conf_snapshot_t*)malloc(sizeof(conf_snapshot_t));
+
+    if (snapshot == NULL) {
+        return 1;
+    }
+
+    snapshot->conf = *conf;
+    snapshot->refs = 1;
+    snapshot->generation = 1;
+
+    pthread_mutex_lock(&snapshot_lock);
+    current = snapshot;
+    atomic_store_explicit(&current_generation, snapshot->generation, memory_order_relaxed);
+    pthread_mutex_unlock(&snapshot_lock);
+
+    return 0;
+}
+
+// Helper function - drop reference to snapshot (snapshot lock must be held), last one frees it
+void conf_snapshot_put(conf_snapshot_t* snapshot)
+{
+    if (--snapshot->refs == 0) {
+        free(snapshot);
+    }
+}
+
+// Helper function - thread exit, drop reference of snapshot thread held
+void conf_snapshot_release(void* snapshot)
+{
+    pthread_mutex_lock(&snapshot_lock);
+    conf_snapshot_put((conf_snapshot_t*)snapshot);
+    pthread_mutex_unlock(&snapshot_lock);
+}
+
+// Helper function - create thread key whose destructor drops snapshot reference of exiting thread
+void conf_snapshot_key_create()
+{
+    if (pthread_key_create(&snapshot_key, conf_snapshot_release) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[conf_snapshot_key_create] Failed to create config snapshot thread key, exiting threads will keep snapshots alive");
+    }
+}
+
+// Config snapshot held by calling thread
+const config_t* conf_current()
+{
+    conf_snapshot_t* old = thread_snapshot;
+
+    if (old != NULL && old->generation == atomic_load_explicit(&current_generation, memory_order_relaxed)) {
+        return &old->conf;
+    }
+
+    // First use by this thread or reload published new snapshot (lock makes sure it isn't freed before it is referenced)
+    pthread_once(&snapshot_key_once, conf_snapshot_key_create);
+    pthread_mutex_lock(&snapshot_lock);
+    thread_snapshot = current;
+    thread_snapshot->refs++;
+    if (old != NULL) {
+        conf_snapshot_put(old);
+    }
+    pthread_mutex_unlock(&snapshot_lock);
+    pthread_setspecific(snapshot_key, thread_snapshot);
+
+    return &thread_snapshot->conf;
+}
+
+// Reread config file and publish it as new current snapshot
+int conf_reload()
+{
+    conf_snapshot_t* snapshot;
+    conf_snapshot_t* old;
+    const conf_restart_key_t* key;
+    FILE* filePtr;
+    int changed;
+    int i;
+
+    if (conf_dir_fd < 0 || (snapshot = (conf_snapshot_t*)calloc(1, sizeof(conf_snapshot_t))) == NULL) {
+        return 1;
+    }
+
+    if ((filePtr = conf_open_file()) == NULL) {
+        log_msg(LOG_LEVEL_ERROR, "[conf_reload] Failed to open config file \"%s\", keeping current config, error: %s", conf_file_name, strerror(errno));
+        free(snapshot);
+        return 1;
+    }
+    if (read_conf_stream(&snapshot->conf, filePtr) != 0) { // Parse error itself is printed to stdout
+        log_msg(LOG_LEVEL_ERROR, "[conf_reload] Failed to parse config file \"%s\", keeping current config", conf_file_name);
+        free(snapshot);
+        return 1;
+    }
+
+    // Settings which need restart keep running values, their changes are reported once (compared with file values
+    // of previous read, not with running values, which were adjusted by argument overrides and validation)
+    for (i = 0; i < (int)(sizeof(restart_keys) / sizeof(restart_keys[0])); i++) {
+        key = &restart_keys[i];
+        if (key->is_string) {
+            changed = strcmp((char*)&snapshot->conf + key->offset, (char*)&file_conf + key->offset) != 0;
+        } else {
+            changed = memcmp((char*)&snapshot->conf + key->offset, (char*)&file_conf + key->offset, key->size) != 0;
+        }
+        if (changed) {
+            log_msg(LOG_LEVEL_WARN, "[conf_reload] Setting \"%s\" was changed, it takes effect only after restart", key->key);
+        }
+    }
+    file_conf = snapshot->conf;
+    snapshot->refs = 1;
+
+    // Publish new snapshot, threads switch to it on their next conf_current() and old one is freed once last of them did
+    pthread_mutex_lock(&snapshot_lock);
+    old = current;
+    for (i = 0; i < (int)(sizeof(restart_keys) / sizeof(restart_keys[0])); i++) {
+        key = &restart_keys[i];
+        memcpy((char*)&snapshot->conf + key->offset, (char*)&old->conf + key->offset, key->size);
+    }
+    snapshot->generation = old->generation + 1;
+    current = snapshot;
+    atomic_store_explicit(&current_generation, snapshot->generation, memory_order_relaxed);
+    conf_snapshot_put(old);
+    pthread_mutex_unlock(&snapshot_lock);
+
+    log_set_level(snapshot->conf.log_level);
+    log_msg(LOG_LEVEL_INFO, "[conf_reload] Config file \"%s\" reloaded (generation %lu)", conf_file_name, snapshot->generation);
+
+    return 0;
+}
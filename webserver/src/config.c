@@ -1,5 +1,79 @@
 #include <config.h>
 
+// Server mode enum to config string
+const char* server_mode_str(server_mode_t mode)
+{
+    switch (mode) {
+        case SERVER_MODE_THREAD:
+            return "thread";
+        case SERVER_MODE_EPOLL:
+            return "epoll";
+        case SERVER_MODE_POOL:
+            return "pool";
+        case SERVER_MODE_REUSEPORT:
+            return "reuseport";
+        case SERVER_MODE_URING:
+            return "uring";
+        default:
+            return "unknown";
+    }
+}
+
+// Log level enum to config string
+const char* log_level_str(log_level_t level)
+{
+    switch (level) {
+        case LOG_LEVEL_INFO:
+            return "info";
+        case LOG_LEVEL_WARN:
+            return "warn";
+        case LOG_LEVEL_ERROR:
+            return "error";
+        case LOG_LEVEL_OFF:
+            return "off";
+        default:
+            return "unknown";
+    }
+}
+
+// Access log format enum to config string
+const char* access_log_format_str(access_log_format_t format)
+{
+    switch (format) {
+        case ACCESS_LOG_COMMON:
+            return "common";
+        case ACCESS_LOG_COMBINED:
+            return "combined";
+        default:
+            return "unknown";
+    }
+}
+
+// Helper function - parse byte size with optional K/M/G suffix (e.g. "64M")
+// Returns 0 on success, 1 on parse errors
+int confparse_size(const char* val, size_t* size)
+{
+    char* end;
+    unsigned long long parsed = strtoull(val, &end, 10);
+
+    if (end == val || val[0] == '-') {
+        return 1;
+    }
+
+    switch (*end) {
+        case 'K': case 'k': parsed <<= 10; end++; break;
+        case 'M': case 'm': parsed <<= 20; end++; break;
+        case 'G': case 'g': parsed <<= 30; end++; break;
+        default: break;
+    }
+    if (*end != '\0') {
+        return 1;
+    }
+
+    *size = (size_t)parsed;
+    return 0;
+}
+
 // Helper "switch" like function to correctly map values based on keys to config_t object
 // Skip unknown key-value pairs
 // Returns 0 on successful translation, 1 on type errors
@@ -23,6 +97,207 @@ int confparse_key_value(config_t* config, const char* key, const char* val)
         }
     } else if (strcmp(key, "doc_root_dir") == 0) {
         strncpy(config->doc_root_dir, val, PATH_MAX);
+    } else if (strcmp(key, "server_mode") == 0) {
+        if (strcmp(val, "thread") == 0) {
+            config->server_mode = SERVER_MODE_THREAD;
+        } else if (strcmp(val, "epoll") == 0) {
+            config->server_mode = SERVER_MODE_EPOLL;
+        } else if (strcmp(val, "pool") == 0) {
+            config->server_mode = SERVER_MODE_POOL;
+        } else if (strcmp(val, "reuseport") == 0) {
+            config->server_mode = SERVER_MODE_REUSEPORT;
+        } else if (strcmp(val, "uring") == 0) {
+            config->server_mode = SERVER_MODE_URING;
+        } else {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"server_mode\" key to valid mode (allowed values: thread, epoll, pool, reuseport, uring)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "pool_size") == 0) {
+        config->pool_size = atoi(val);
+
+        if (config->pool_size < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"pool_size\" key to valid worker count (0 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "reuseport_size") == 0) {
+        config->reuseport_size = atoi(val);
+
+        if (config->reuseport_size < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"reuseport_size\" key to valid listener count (0 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "keepalive_timeout") == 0) {
+        config->keepalive_timeout = atoi(val);
+
+        if (config->keepalive_timeout <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"keepalive_timeout\" key to valid timeout (1 or more seconds)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "header_timeout") == 0) {
+        config->header_timeout = atoi(val);
+
+        if (config->header_timeout <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"header_timeout\" key to valid timeout (1 or more seconds)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "send_timeout") == 0) {
+        config->send_timeout = atoi(val);
+
+        if (config->send_timeout <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"send_timeout\" key to valid timeout (1 or more seconds)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "keepalive_max_requests") == 0) {
+        config->keepalive_max_requests = atoi(val);
+
+        if (config->keepalive_max_requests <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"keepalive_max_requests\" key to valid request count (1 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "conn_memory_limit") == 0) {
+        if (confparse_size(val, &config->conn_memory_limit) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"conn_memory_limit\" key to valid byte size (e.g. 0, 256M, 1G)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "thread_stack_size") == 0) {
+        if (confparse_size(val, &config->thread_stack_size) != 0 || (config->thread_stack_size > 0 && config->thread_stack_size < PTHREAD_STACK_MIN)) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"thread_stack_size\" key to valid byte size (0 or at least %d, e.g. 256K, 1M)\n", (int)PTHREAD_STACK_MIN);
+            return 1;
+        }
+    } else if (strcmp(key, "request_buffer_size") == 0) {
+        if (confparse_size(val, &config->request_buffer_size) != 0 || config->request_buffer_size < 1024 || config->request_buffer_size > (1 << 20)) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"request_buffer_size\" key to valid byte size (1K to 1M, e.g. 8K, 16K)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "listen_backlog") == 0) {
+        config->listen_backlog = atoi(val);
+
+        if (config->listen_backlog <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"listen_backlog\" key to valid queue length (1 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "tcp_nodelay") == 0) {
+        if (strcmp(val, "true") == 0 || strcmp(val, "1") == 0) {
+            config->tcp_nodelay = 1;
+        } else if (strcmp(val, "false") == 0 || strcmp(val, "0") == 0) {
+            config->tcp_nodelay = 0;
+        } else {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"tcp_nodelay\" key to valid flag (allowed values: true, false, 1, 0)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "socket_send_buffer") == 0) {
+        if (confparse_size(val, &config->socket_send_buffer) != 0 || config->socket_send_buffer > INT_MAX) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"socket_send_buffer\" key to valid byte size (e.g. 0, 64K, 1M)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "socket_receive_buffer") == 0) {
+        if (confparse_size(val, &config->socket_receive_buffer) != 0 || config->socket_receive_buffer > INT_MAX) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"socket_receive_buffer\" key to valid byte size (e.g. 0, 64K, 1M)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "file_cache_size") == 0) {
+        if (confparse_size(val, &config->file_cache_size) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"file_cache_size\" key to valid byte size (e.g. 0, 65536, 64K, 32M)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "file_cache_max_file") == 0) {
+        if (confparse_size(val, &config->file_cache_max_file) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"file_cache_max_file\" key to valid byte size (e.g. 65536, 64K, 1M)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "mmap_cache_size") == 0) {
+        if (confparse_size(val, &config->mmap_cache_size) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"mmap_cache_size\" key to valid byte size (e.g. 0, 256M, 1G)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "mmap_max_file") == 0) {
+        if (confparse_size(val, &config->mmap_max_file) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"mmap_max_file\" key to valid byte size (e.g. 16M, 64M)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "meta_cache_entries") == 0) {
+        config->meta_cache_entries = atoi(val);
+
+        if (config->meta_cache_entries < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"meta_cache_entries\" key to valid entry count (0 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "meta_cache_negative_ttl") == 0) {
+        config->meta_cache_negative_ttl = atoi(val);
+
+        if (config->meta_cache_negative_ttl < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"meta_cache_negative_ttl\" key to valid lifetime (0 or more seconds)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "gzip_level") == 0) {
+        config->gzip_level = atoi(val);
+
+        if (config->gzip_level < 0 || config->gzip_level > 9) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"gzip_level\" key to valid compression level (0 - disabled, 1-9)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "pool_queue_depth") == 0) {
+        config->pool_queue_depth = atoi(val);
+
+        if (config->pool_queue_depth <= 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"pool_queue_depth\" key to valid queue depth (1 or more)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "mime_types") == 0) {
+        strncpy(config->mime_types, val, PATH_MAX);
+    } else if (strcmp(key, "metrics_path") == 0) {
+        if (val[0] != '/' || strcmp(val, "/") == 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"metrics_path\" key to valid URL path (starts with '/', e.g. /_metrics)\n");
+            return 1;
+        }
+        strncpy(config->metrics_path, val, PATH_MAX);
+    } else if (strcmp(key, "error_log") == 0) {
+        strncpy(config->error_log, val, PATH_MAX);
+    } else if (strcmp(key, "access_log") == 0) {
+        strncpy(config->access_log, val, PATH_MAX);
+    } else if (strcmp(key, "access_log_format") == 0) {
+        if (strcmp(val, "common") == 0) {
+            config->access_log_format = ACCESS_LOG_COMMON;
+        } else if (strcmp(val, "combined") == 0) {
+            config->access_log_format = ACCESS_LOG_COMBINED;
+        } else {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"access_log_format\" key to valid format (allowed values: common, combined)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "log_level") == 0) {
+        if (strcmp(val, "info") == 0) {
+            config->log_level = LOG_LEVEL_INFO;
+        } else if (strcmp(val, "warn") == 0) {
+            config->log_level = LOG_LEVEL_WARN;
+        } else if (strcmp(val, "error") == 0) {
+            config->log_level = LOG_LEVEL_ERROR;
+        } else if (strcmp(val, "off") == 0) {
+            config->log_level = LOG_LEVEL_OFF;
+        } else {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"log_level\" key to valid level (allowed values: info, warn, error, off)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "log_rotate_size") == 0) {
+        if (confparse_size(val, &config->log_rotate_size) != 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"log_rotate_size\" key to valid byte size (e.g. 0, 10M, 1G)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "log_rotate_interval") == 0) {
+        config->log_rotate_interval = atoi(val);
+
+        if (config->log_rotate_interval < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"log_rotate_interval\" key to valid interval (0 or more seconds)\n");
+            return 1;
+        }
+    } else if (strcmp(key, "pid_file") == 0) {
+        strncpy(config->pid_file, val, PATH_MAX);
+    } else if (strcmp(key, "drain_timeout") == 0) {
+        config->drain_timeout = atoi(val);
+
+        if (config->drain_timeout < 0) {
+            printf("[ERROR] [confparse_key_value] Config-parsing couldn't parse \"drain_timeout\" key to valid timeout (0 or more seconds)\n");
+            return 1;
+        }
     }
 
     return 0;
@@ -33,9 +308,22 @@ int confparse_key_value(config_t* config, const char* key, const char* val)
 // Run this BEFORE override_conf(...)
 // Returns 0 on successful read, 1 on read failure
 int read_conf_file(config_t* config, const char* filename)
+{
+    FILE* filePtr = fopen(filename, "r");
+
+    if (filePtr == NULL) {
+        printf("[ERROR] Couldn't open config file \"%s\", error: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    return read_conf_stream(config, filePtr);
+}
+
+// Parse configuration from already opened config file, file is closed afterwards
+// Returns 0 on successful read, 1 on read failure
+int read_conf_stream(config_t* config, FILE* filePtr)
 {
     // Declaration
-    FILE* filePtr;
     char config_line [CONFIG_LINE_MAX];
     char key[100];
     char value[PATH_MAX];
@@ -46,39 +334,65 @@ int read_conf_file(config_t* config, const char* filename)
     // Usually should be "%99[^= ] = %4095s"
     // Notes: simple format such as "%s = %s" can't work, because key-values could be squished together as "port=80" (no spaces),
     //        so there is need to separate key and value by '=' in scan_fmt, hence "%[^= ]" format
-    sprintf(scan_fmt, "%%%d[^= ] = %%%ds", 99, PATH_MAX);
+    sprintf(scan_fmt, "%%%d[^= ] = %%%ds", 99, PATH_MAX - 1);
 
     // Config default values
     config->port = 80;
     strcpy(config->doc_root_dir, "../../www");
     config->as_daemon = 0;
+    config->server_mode = SERVER_MODE_THREAD;
+    config->pool_size = 0;
+    config->pool_queue_depth = 64;
+    config->reuseport_size = 0;
+    config->keepalive_timeout = 5;
+    config->keepalive_max_requests = 100;
+    config->header_timeout = 10;
+    config->send_timeout = 30;
+    config->conn_memory_limit = (size_t)256 << 20;
+    config->thread_stack_size = 256 << 10;
+    config->request_buffer_size = CONF_REQ_BUFSIZE;
+    config->listen_backlog = SOMAXCONN;
+    config->tcp_nodelay = 0;
+    config->socket_send_buffer = 0;
+    config->socket_receive_buffer = 0;
+    config->file_cache_size = 32 << 20;
+    config->file_cache_max_file = 1 << 20;
+    config->mmap_cache_size = (size_t)256 << 20;
+    config->mmap_max_file = 64 << 20;
+    config->meta_cache_entries = 4096;
+    config->meta_cache_negative_ttl = 2;
+    config->gzip_level = 6;
+    config->mime_types[0] = '\0';
+    config->metrics_path[0] = '\0';
+    config->error_log[0] = '\0';
+    config->access_log[0] = '\0';
+    config->access_log_format = ACCESS_LOG_COMMON;
+    config->log_level = LOG_LEVEL_INFO;
+    config->log_rotate_size = 0;
+    config->log_rotate_interval = 0;
+    config->pid_file[0] = '\0';
+    config->drain_timeout = 30;
 
     // Begin parsing from config file
-    filePtr = fopen(filename, "r");
-    if (filePtr != NULL)
+    while(fgets(config_line, CONFIG_LINE_MAX, filePtr) != NULL)
     {
-        while(fgets(config_line, CONFIG_LINE_MAX, filePtr) != NULL)
-        {
-            // Skip past blank lines as well as "comments"
-            c_ptr = config_line; // Reset to start of line
-            while (*c_ptr == ' ' || *c_ptr == '\r' || *c_ptr == '\n' || *c_ptr == '\t' || *c_ptr == '\f' || *c_ptr == '\v') { c_ptr++; }
-            if (*c_ptr == '\0' || *c_ptr == '#') { continue; }
-
-            // Implementing config line parsing logic here ...
-            if (sscanf(config_line, scan_fmt, key, value) < 2) {
-                printf("[ERROR] [read_conf_file] Couldn't scan-parse following line: \"%s\"\n", config_line);
-                return 1;
-            }
+        // Skip past blank lines as well as "comments"
+        c_ptr = config_line; // Reset to start of line
+        while (*c_ptr == ' ' || *c_ptr == '\r' || *c_ptr == '\n' || *c_ptr == '\t' || *c_ptr == '\f' || *c_ptr == '\v') { c_ptr++; }
+        if (*c_ptr == '\0' || *c_ptr == '#') { continue; }
 
-            if (confparse_key_value(config, key, value) != 0) { return 1; }
+        // Implementing config line parsing logic here ...
+        if (sscanf(config_line, scan_fmt, key, value) < 2) {
+            printf("[ERROR] [read_conf_file] Couldn't scan-parse following line: \"%s\"\n", config_line);
+            fclose(filePtr);
+            return 1;
         }
 
-        fclose (filePtr);
-    } else {
-        printf("[ERROR] Couldn't open config file \"%s\", error: %s\n", filename, strerror(errno));
-        return 1;
+        if (confparse_key_value(config, key, value) != 0) { fclose(filePtr); return 1; }
     }
 
+    fclose (filePtr);
+
     return 0;
 }
 
@@ -120,6 +434,38 @@ void print_conf(config_t* config) {
     printf("\tport: %d\n", config->port);
     printf("\tdoc_root_dir: %s\n", config->doc_root_dir);
     printf("\tas_daemon: %d\n", config->as_daemon);
+    printf("\tserver_mode: %s\n", server_mode_str(config->server_mode));
+    printf("\tpool_size: %d\n", config->pool_size);
+    printf("\tpool_queue_depth: %d\n", config->pool_queue_depth);
+    printf("\treuseport_size: %d\n", config->reuseport_size);
+    printf("\tkeepalive_timeout: %d\n", config->keepalive_timeout);
+    printf("\tkeepalive_max_requests: %d\n", config->keepalive_max_requests);
+    printf("\theader_timeout: %d\n", config->header_timeout);
+    printf("\tsend_timeout: %d\n", config->send_timeout);
+    printf("\tconn_memory_limit: %zu\n", config->conn_memory_limit);
+    printf("\tthread_stack_size: %zu\n", config->thread_stack_size);
+    printf("\trequest_buffer_size: %zu\n", config->request_buffer_size);
+    printf("\tlisten_backlog: %d\n", config->listen_backlog);
+    printf("\ttcp_nodelay: %d\n", config->tcp_nodelay);
+    printf("\tsocket_send_buffer: %zu\n", config->socket_send_buffer);
+    printf("\tsocket_receive_buffer: %zu\n", config->socket_receive_buffer);
+    printf("\tfile_cache_size: %zu\n", config->file_cache_size);
+    printf("\tfile_cache_max_file: %zu\n", config->file_cache_max_file);
+    printf("\tmmap_cache_size: %zu\n", config->mmap_cache_size);
+    printf("\tmmap_max_file: %zu\n", config->mmap_max_file);
+    printf("\tmeta_cache_entries: %d\n", config->meta_cache_entries);
+    printf("\tmeta_cache_negative_ttl: %d\n", config->meta_cache_negative_ttl);
+    printf("\tgzip_level: %d\n", config->gzip_level);
+    printf("\tmime_types: %s\n", config->mime_types[0] ? config->mime_types : "(built-in)");
+    printf("\tmetrics_path: %s\n", config->metrics_path[0] ? config->metrics_path : "(disabled)");
+    printf("\terror_log: %s\n", config->error_log[0] ? config->error_log : "(stdout)");
+    printf("\taccess_log: %s\n", config->access_log[0] ? config->access_log : "(disabled)");
+    printf("\taccess_log_format: %s\n", access_log_format_str(config->access_log_format));
+    printf("\tlog_level: %s\n", log_level_str(config->log_level));
+    printf("\tlog_rotate_size: %zu\n", config->log_rotate_size);
+    printf("\tlog_rotate_interval: %d\n", config->log_rotate_interval);
+    printf("\tpid_file: %s\n", config->pid_file[0] ? config->pid_file : "(disabled)");
+    printf("\tdrain_timeout: %d\n", config->drain_timeout);
 }
 
 // Check configuration values and if they are correct
@@ -129,6 +475,20 @@ int validate_conf(config_t* config)
     int access_result;
     char resolved_path[PATH_MAX];
     const char* doc_root = config->doc_root_dir;
+    cpu_set_t cpus;
+
+    // Worker pool defaults to one worker per online CPU
+    if (config->pool_size == 0) {
+        config->pool_size = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (config->pool_size <= 0) {
+            config->pool_size = 1;
+        }
+    }
+
+    // Reuseport listeners default to one per CPU in process affinity mask (e.g. restricted with taskset)
+    if (config->reuseport_size == 0) {
+        config->reuseport_size = (sched_getaffinity(0, sizeof(cpus), &cpus) == 0) ? CPU_COUNT(&cpus) : 1;
+    }
 
     // Transform doc_root_dir to realpath
     if (realpath(doc_root, resolved_path) == NULL) {
@@ -0,0 +1,496 @@
+#include <conn.h>
+#include <conn_pool.h>
+#include <conf_snapshot.h>
+#include <drain.h>
+#include <log.h>
+#include <metrics.h>
+
+// Helper function - start deadline for what connection waits for now
+void conn_set_timeout(conn_t* conn, conn_timeout_t timeout)
+{
+    int seconds = conn->conf->keepalive_timeout;
+
+    if (timeout == CONN_TIMEOUT_HEADER) {
+        seconds = conn->conf->header_timeout;
+    } else if (timeout == CONN_TIMEOUT_SEND) {
+        seconds = conn->conf->send_timeout;
+    }
+
+    conn->timeout = timeout;
+    conn->deadline_ms = timer_now_ms() + (unsigned long)seconds * 1000;
+}
+
+// Deadline name for log messages
+const char* conn_timeout_str(conn_timeout_t timeout)
+{
+    switch (timeout) {
+        case CONN_TIMEOUT_IDLE:
+            return "idle";
+        case CONN_TIMEOUT_HEADER:
+            return "request header";
+        case CONN_TIMEOUT_SEND:
+            return "response send";
+        default:
+            return "unknown";
+    }
+}
+
+// Report connection which missed its deadline
+void conn_timed_out(conn_t* conn)
+{
+    // Idle keep-alive connections expiring is normal, only slow or stalled clients are worth a warning
+    if (conn->timeout == CONN_TIMEOUT_IDLE) {
+        log_msg(LOG_LEVEL_INFO, "[socket: %d] Closing idle connection", conn->socket_id);
+        return;
+    }
+    log_msg(LOG_LEVEL_WARN, "[socket: %d] Closing connection of client %s, %s timeout expired", conn->socket_id, conn->client_addr, conn_timeout_str(conn->timeout));
+    metrics_connection_timeout();
+}
+
+// Helper function - apply configured socket options to accepted client socket
+void conn_set_socket_options(conn_t* conn)
+{
+    int value;
+
+    // Responses are sent whole with one gathered send (header held back with MSG_MORE until body follows),
+    // so disabling Nagle only makes small responses of pipelined requests go out without waiting for ACK
+    value = 1;
+    if (conn->conf->tcp_nodelay && setsockopt(conn->socket_id, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value)) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Failed to set TCP_NODELAY, error: %s", conn->socket_id, strerror(errno));
+    }
+
+    // Fixed buffer sizes turn off kernel autotuning of that buffer for the socket
+    value = (int)conn->conf->socket_send_buffer;
+    if (value > 0 && setsockopt(conn->socket_id, SOL_SOCKET, SO_SNDBUF, &value, sizeof(value)) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Failed to set send buffer size, error: %s", conn->socket_id, strerror(errno));
+    }
+    value = (int)conn->conf->socket_receive_buffer;
+    if (value > 0 && setsockopt(conn->socket_id, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value)) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Failed to set receive buffer size, error: %s", conn->socket_id, strerror(errno));
+    }
+}
+
+// Format IP address of IPv4/IPv6 socket address
+int conn_addr_str(const struct sockaddr_storage* addr, char* buf, size_t size)
+{
+    if (addr->ss_family == AF_INET && inet_ntop(AF_INET, &((const struct sockaddr_in*)addr)->sin_addr, buf, size) != NULL) {
+        return ntohs(((const struct sockaddr_in*)addr)->sin_port);
+    }
+    if (addr->ss_family == AF_INET6 && inet_ntop(AF_INET6, &((const struct sockaddr_in6*)addr)->sin6_addr, buf, size) != NULL) {
+        return ntohs(((const struct sockaddr_in6*)addr)->sin6_port);
+    }
+    snprintf(buf, size, "-");
+    return 0;
+}
+
+// Take connection object for accepted client socket from connection pool
+// Returns NULL if connection limit is reached or allocation failed
+conn_t* conn_create(int socket_id)
+{
+    conn_t* conn = conn_pool_get();
+    struct sockaddr_storage client;
+    socklen_t socklen = sizeof(client);
+    int i;
+
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    conn->socket_id = socket_id;
+    strcpy(conn->client_addr, "-");
+    if (log_access_enabled() && getpeername(socket_id, (struct sockaddr*)&client, &socklen) == 0) {
+        conn_addr_str(&client, conn->client_addr, sizeof(conn->client_addr));
+    }
+    conn->conf = conf_current();
+    conn_set_socket_options(conn);
+    conn->state = CONN_STATE_READ;
+    conn->request_len = 0;
+    conn->parse_pos = 0;
+    conn->scan_pos = 0;
+    conn->requests_served = 0;
+    conn->blocking = 0;
+    conn_set_timeout(conn, CONN_TIMEOUT_HEADER); // First request has to arrive in full within header timeout of accept
+    conn->response_count = 0;
+    conn->response_sent = 0;
+    conn->prev = NULL;
+    conn->next = NULL;
+    wheel_timer_init(&conn->timer, conn);
+    for (i = 0; i < CONN_PIPELINE_MAX; i++) {
+        conn->responses[i].body_fd = -1;
+        conn->responses[i].body_pipe[0] = -1;
+        conn->responses[i].body_cache = NULL;
+        conn->responses[i].body_map = NULL;
+        conn->responses[i].multipart = NULL;
+        conn->responses[i].body_buffer = NULL;
+        conn->responses[i].error_pages = NULL;
+    }
+    metrics_connection_opened();
+
+    return conn;
+}
+
+// Report accepted client socket whose connection couldn't be created (by conn_create(...) errno), caller then closes it
+void conn_create_failed(int socket_id)
+{
+    if (errno == ENOBUFS) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Connection limit of %d connections reached, dropping connection", socket_id, conn_pool_limit());
+        return;
+    }
+    log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to allocate connection object", socket_id);
+}
+
+// Close connection socket and return connection object to connection pool
+void conn_destroy(conn_t* conn)
+{
+    int i;
+
+    for (i = 0; i < conn->response_count; i++) {
+        release_http_response(&conn->responses[i]);
+    }
+    close(conn->socket_id); // Close the socket/connection
+    conn_pool_put(conn);
+    metrics_connection_closed();
+}
+
+// Helper function - search for termination signal of first unparsed request in newly received bytes
+// Continues from conn->scan_pos, so every byte is looked at only once
+// Returns length of request (including termination signal), 0 if not terminated yet
+size_t conn_request_end(conn_t* conn)
+{
+    size_t request_end = http_request_end(conn->request_buf + conn->parse_pos, conn->scan_pos - conn->parse_pos, conn->request_len - conn->parse_pos);
+
+    if (request_end == 0) {
+        conn->scan_pos = conn->request_len;
+    }
+    return request_end;
+}
+
+// Helper function - check if connection comes from loopback address (for localhost-only metrics page)
+int conn_local_client(conn_t* conn)
+{
+    struct sockaddr_storage client;
+    socklen_t socklen = sizeof(client);
+
+    if (getpeername(conn->socket_id, (struct sockaddr*)&client, &socklen) != 0) {
+        return 0;
+    }
+    if (client.ss_family == AF_INET) {
+        return (ntohl(((struct sockaddr_in*)&client)->sin_addr.s_addr) >> 24) == 127;
+    }
+    if (client.ss_family == AF_INET6) {
+        return IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6*)&client)->sin6_addr);
+    }
+    return 0;
+}
+
+// Helper function - parse complete request (request_len bytes at conn->parse_pos) and queue its response
+// Returns 0 if response was queued, 1 if nothing could be prepared (connection should be closed)
+int conn_queue_request(conn_t* conn, size_t request_len)
+{
+    char* request = conn->request_buf + conn->parse_pos;
+    http_response_t* response = &conn->responses[conn->response_count];
+    conn_request_log_t* request_log = &conn->request_logs[conn->response_count];
+    char request_end_byte = request[request_len];
+    int prepare_ec;
+
+    // Temporarily terminate request string (first byte of next pipelined request is restored afterwards,
+    // parsed request line tokens stay terminated on their own)
+    request[request_len] = '\0';
+    log_msg(LOG_LEVEL_INFO, "[socket: %d] Received %ld content-length request payload", conn->socket_id, (long)request_len);
+
+    // Request parsing works on C strings, so NUL bytes would silently cut request short - reject them instead
+    request_log->method = NULL;
+    request_log->referer = NULL;
+    request_log->user_agent = NULL;
+    request_log->received_us = metrics_now_us();
+    if (memchr(request, '\0', request_len) == NULL && parse_http_request(request, &conn->request) == 0) {
+        request_log->method = conn->request.method;
+        request_log->uri = conn->request.uri;
+        request_log->version = conn->request.version;
+        if (log_access_enabled()) {
+            request_log->referer = http_header_value(&conn->request, "Referer", &request_log->referer_len);
+            request_log->user_agent = http_header_value(&conn->request, "User-Agent", &request_log->user_agent_len);
+        }
+        if (conn->requests_served + conn->response_count + 1 >= conn->conf->keepalive_max_requests) { // Last allowed request on this connection
+            conn->request.keep_alive = 0;
+        }
+        if (draining()) { // Client reconnects to instance which still accepts (or gets refused once server is gone)
+            conn->request.keep_alive = 0;
+        }
+        if (is_http_metrics_request(conn->conf, &conn->request)) { // Reserved path, never looked up in document root
+            prepare_ec = prepare_http_metrics_response(conn->conf, &conn->request, conn_local_client(conn), response);
+        } else {
+            prepare_ec = prepare_http_response(conn->conf, &conn->request, response);
+        }
+    } else {
+        metrics_parse_failure();
+        prepare_ec = prepare_http_error_response(conn->conf, NULL, HTTP_STATUS_BADREQUEST, response);
+    }
+
+    request[request_len] = request_end_byte;
+    conn->parse_pos += request_len;
+    conn->scan_pos = conn->parse_pos;
+
+    if (prepare_ec != 0) {
+        return 1;
+    }
+    conn->response_count++;
+    return 0;
+}
+
+// Helper function - queue responses for all complete requests in request buffer
+// Updates conn->state, returns 1 if connection left CONN_STATE_READ (responses are queued or connection is closed), 0 if more bytes are needed
+int conn_queue_requests(conn_t* conn)
+{
+    size_t request_end;
+
+    // Example request from client:
+    /*
+        GET /index.html HTTP/1.0\r\n
+        Host: www.example.com\r\n
+        \r\n
+    */
+    // Bytes left over from previous requests on persistent connection, or single receive, can hold several complete requests
+    // Nothing is parsed after request whose response closes connection
+    while (conn->response_count < CONN_PIPELINE_MAX &&
+        (conn->response_count == 0 || conn->responses[conn->response_count - 1].keep_alive) &&
+        (request_end = conn_request_end(conn)) > 0) {
+        if (conn_queue_request(conn, request_end) != 0) {
+            if (conn->response_count == 0) {
+                conn->state = CONN_STATE_CLOSE;
+                return 1;
+            }
+            conn->responses[conn->response_count - 1].keep_alive = 0; // Send what is queued, then close
+            break;
+        }
+    }
+    if (conn->response_count > 0) {
+        conn->state = CONN_STATE_WRITE;
+        conn_set_timeout(conn, CONN_TIMEOUT_SEND);
+        return 1;
+    }
+
+    // If request was too long (no termination detected), return 400 - Bad Request
+    if (conn->request_len >= conn->conf->request_buffer_size) {
+        conn->request_logs[0].method = NULL;
+        conn->request_logs[0].referer = NULL;
+        conn->request_logs[0].user_agent = NULL;
+        conn->request_logs[0].received_us = metrics_now_us();
+        metrics_parse_failure();
+        if (prepare_http_error_response(conn->conf, NULL, HTTP_STATUS_BADREQUEST, &conn->responses[0]) != 0) {
+            conn->state = CONN_STATE_CLOSE;
+            return 1;
+        }
+        conn->response_count = 1;
+        conn->state = CONN_STATE_WRITE;
+        conn_set_timeout(conn, CONN_TIMEOUT_SEND);
+        return 1;
+    }
+
+    return 0;
+}
+
+// Helper function - account request bytes received into request_buf
+void conn_add_request_bytes(conn_t* conn, size_t bytes)
+{
+    // First bytes of next request end idle wait, from now on whole request has to arrive within header timeout
+    if (conn->timeout == CONN_TIMEOUT_IDLE) {
+        conn_set_timeout(conn, CONN_TIMEOUT_HEADER);
+    }
+    conn->request_len += bytes;
+}
+
+// Helper function - limit blocking receive to time left until connection deadline (set before every receive,
+// so client trickling request bytes can't extend header timeout)
+// Returns 0 on success, 1 if deadline already passed
+int conn_set_receive_timeout(conn_t* conn)
+{
+    struct timeval receive_timeout;
+    unsigned long now_ms = timer_now_ms();
+    unsigned long left_ms;
+
+    if (now_ms >= conn->deadline_ms) {
+        return 1;
+    }
+    left_ms = conn->deadline_ms - now_ms;
+    receive_timeout.tv_sec = left_ms / 1000;
+    receive_timeout.tv_usec = (left_ms % 1000) * 1000;
+    if (setsockopt(conn->socket_id, SOL_SOCKET, SO_RCVTIMEO, &receive_timeout, sizeof(receive_timeout)) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Failed to set receive timeout, error: %s", conn->socket_id, strerror(errno));
+    }
+    return 0;
+}
+
+// Helper function - queue responses for all complete requests in request buffer, receive more bytes if there are none
+// Updates conn->state, returns 1 if socket would block (or blocking socket reached its deadline), 0 otherwise
+int conn_read_request(conn_t* conn)
+{
+    ssize_t read_bytes;
+
+    if (conn_queue_requests(conn)) {
+        return 0;
+    }
+    if (conn->blocking && conn_set_receive_timeout(conn) != 0) {
+        return 1;
+    }
+
+    read_bytes = recv(conn->socket_id, conn->request_buf + conn->request_len, conn->conf->request_buffer_size - conn->request_len, 0);
+    if (read_bytes < 0) {
+        if (errno == EINTR) {
+            return 0;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) { // Nothing to read yet (or receive timeout for blocking sockets)
+            return 1;
+        }
+        log_msg(LOG_LEVEL_ERROR, "[socket: %d] Connection issue, error: %s", conn->socket_id, strerror(errno));
+        conn->state = CONN_STATE_CLOSE;
+        return 0;
+    }
+    if (read_bytes == 0) { // Client closed connection
+        conn->state = CONN_STATE_CLOSE;
+        return 0;
+    }
+    conn_add_request_bytes(conn, read_bytes);
+    return 0;
+}
+
+// Helper function - drop requests of sent response queue from request buffer, keeping bytes received after them for next requests
+void conn_next_requests(conn_t* conn)
+{
+    conn->request_len -= conn->parse_pos;
+    conn->scan_pos -= conn->parse_pos;
+    memmove(conn->request_buf, conn->request_buf + conn->parse_pos, conn->request_len);
+    conn->parse_pos = 0;
+
+    conn->requests_served += conn->response_count;
+    conn->response_count = 0;
+    conn->response_sent = 0;
+}
+
+// Helper function - log sent response
+void conn_log_response(conn_t* conn, int index)
+{
+    conn_request_log_t* request_log = &conn->request_logs[index];
+    http_response_t* response = &conn->responses[index];
+
+    log_access(conn->client_addr, request_log->method, request_log->uri, request_log->version, response->status, response->body_len,
+        request_log->referer, request_log->referer_len, request_log->user_agent, request_log->user_agent_len);
+    metrics_response(request_log->method, response->status, metrics_now_us() - request_log->received_us);
+
+    if (request_log->method != NULL) {
+        log_msg(LOG_LEVEL_INFO, "[socket: %d] Client: \"%s %s %s\" => Server: \"%s %d %s\"",
+            conn->socket_id,
+            request_log->method, request_log->uri, request_log->version,
+            response->version, response->status, http_status_str(response->status));
+    } else {
+        log_msg(LOG_LEVEL_INFO, "[socket: %d] Client: \" ... \" => Server: \"%s %d %s\"",
+            conn->socket_id,
+            response->version, response->status, http_status_str(response->status));
+    }
+}
+
+// Helper function - finish sending of queued responses (send_ec is HTTP_SEND_DONE or HTTP_SEND_ERROR)
+// Updates conn->state
+void conn_finish_responses(conn_t* conn, int send_ec)
+{
+    int keep_alive = conn->responses[conn->response_count - 1].keep_alive;
+    int i;
+
+    if (send_ec == HTTP_SEND_ERROR) {
+        log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to send HTTP response, error: %s", conn->socket_id, strerror(errno));
+    }
+
+    for (i = 0; i < conn->response_count; i++) {
+        release_http_response(&conn->responses[i]);
+    }
+
+    // Persistent connection continues with next requests, otherwise we close connection when responses are fully sent
+    if (send_ec == HTTP_SEND_DONE && keep_alive) {
+        conn_next_requests(conn);
+        conn->state = CONN_STATE_READ;
+        conn_set_timeout(conn, (conn->request_len > 0) ? CONN_TIMEOUT_HEADER : CONN_TIMEOUT_IDLE);
+    } else {
+        conn->state = CONN_STATE_CLOSE;
+    }
+}
+
+// Helper function - send queued responses (in-memory parts of consecutive responses are batched into single writes)
+// Updates conn->state, returns 1 if socket would block, 0 otherwise
+int conn_write_response(conn_t* conn)
+{
+    int first_unsent = conn->response_sent;
+    int send_ec;
+    int i;
+
+    // Socket is writable again (client took more bytes), so send deadline starts over
+    // (blocking sockets have send timeout set on socket, which gives up only when client takes nothing for that long)
+    conn_set_timeout(conn, CONN_TIMEOUT_SEND);
+    send_ec = send_http_responses(conn->socket_id, conn->responses, conn->response_count, &conn->response_sent);
+
+    for (i = first_unsent; i < conn->response_sent; i++) {
+        conn_log_response(conn, i);
+    }
+
+    if (send_ec == HTTP_SEND_AGAIN) {
+        return 1;
+    }
+
+    conn_finish_responses(conn, send_ec);
+    return 0;
+}
+
+// Account bytes received by caller (completion-based I/O)
+conn_state_t conn_received(conn_t* conn, size_t bytes)
+{
+    conn->conf = conf_current();
+    conn_add_request_bytes(conn, bytes);
+    conn_queue_requests(conn);
+
+    return conn->state;
+}
+
+// Account progress of queued responses sent by caller (completion-based I/O)
+conn_state_t conn_sent(conn_t* conn, int send_ec)
+{
+    int first_unsent = conn->response_sent;
+    int i;
+
+    conn->conf = conf_current();
+    if (send_ec == HTTP_SEND_DONE) { // Progress was made, send deadline starts over
+        conn_set_timeout(conn, CONN_TIMEOUT_SEND);
+    }
+    while (conn->response_sent < conn->response_count && http_response_sent(&conn->responses[conn->response_sent])) {
+        conn->response_sent++;
+    }
+    for (i = first_unsent; i < conn->response_sent; i++) {
+        conn_log_response(conn, i);
+    }
+
+    if (send_ec == HTTP_SEND_ERROR || conn->response_sent == conn->response_count) {
+        conn_finish_responses(conn, send_ec);
+        if (conn->state == CONN_STATE_READ) { // Next requests may already be buffered
+            conn_queue_requests(conn);
+        }
+    }
+
+    return conn->state;
+}
+
+// Advance connection state machine as far as socket allows
+conn_state_t conn_process(conn_t* conn)
+{
+    int would_block = 0;
+
+    conn->conf = conf_current(); // Snapshot held by this thread, previous one may be gone after reload
+
+    // Loop until connection is finished or socket would block (non-blocking mode, wait for next readiness event)
+    while (conn->state != CONN_STATE_CLOSE && !would_block) {
+        if (conn->state == CONN_STATE_READ) {
+            would_block = conn_read_request(conn);
+        } else {
+            would_block = conn_write_response(conn);
+        }
+    }
+
+    return conn->state;
+}
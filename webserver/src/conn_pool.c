@@ -0,0 +1,287 @@
+#include <conn_pool.h>
+#include <net_thread.h>
+#include <uring_loop.h>
+#include <log.h>
+#include <metrics.h>
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER; // Shared free list, slabs and cache registry
+static conn_t* free_conns = NULL; // Recycled objects not cached by any thread, linked through their next pointers
+static int max_conns = 0; // 0 - unlimited
+static int allocated_conns = 0; // Objects carved from slabs so far (never more than max_conns)
+static atomic_int used_conns = 0; // Taken objects, reserved before object is looked for (limit needs no lock)
+static conn_cache_t* caches = NULL;
+static conn_cache_t* released_caches = NULL;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static int cache_key_created = 0;
+static __thread conn_cache_t* thread_cache = NULL;
+static size_t object_size = 0; // Connection object with its request buffer and backend state, rounded up to keep objects of slab aligned
+static size_t backend_offset = 0; // Where backend state starts in object
+static size_t backend_size = 0; // State server mode keeps per connection (0 - none)
+
+// Helper function - round size up to alignment of any object
+size_t conn_pool_align(size_t size)
+{
+    return (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+}
+
+// Helper function - size of connection object with request buffer of request_buffer_size bytes (and its terminator)
+size_t conn_pool_object_size(size_t request_buffer_size)
+{
+    return conn_pool_align(sizeof(conn_t) + request_buffer_size + 1);
+}
+
+// Setup process-wide pool of connection objects
+void conn_pool_init(const config_t* conf)
+{
+    size_t conn_bytes;
+
+    // io_uring connections keep their operation state (with buffers kernel reads while operation is in flight) in the object
+    backend_size = 0;
+    if (conf->server_mode == SERVER_MODE_URING) {
+        backend_size = sizeof(uring_conn_t);
+    }
+    backend_offset = conn_pool_object_size(conf->request_buffer_size);
+    object_size = backend_offset + conn_pool_align(backend_size);
+    conn_bytes = object_size;
+
+    // Every connection of thread mode owns a whole thread, whose stack is reserved for as long as connection lives
+    if (conf->server_mode == SERVER_MODE_THREAD) {
+        conn_bytes += thread_stack_bytes(conf);
+    }
+
+    max_conns = 0;
+    if (conf->conn_memory_limit > 0) {
+        max_conns = (conf->conn_memory_limit / conn_bytes > INT_MAX) ? INT_MAX : (int)(conf->conn_memory_limit / conn_bytes);
+        if (max_conns == 0) {
+            log_msg(LOG_LEVEL_WARN, "[conn_pool_init] conn_memory_limit %zu is below cost of single connection (%zu bytes), allowing 1 connection", conf->conn_memory_limit, conn_bytes);
+            max_conns = 1;
+        }
+        log_msg(LOG_LEVEL_INFO, "[conn_pool_init] Connection costs %zu bytes, limited to %d open connections", conn_bytes, max_conns);
+    }
+}
+
+// Maximum amount of open connections
+int conn_pool_limit()
+{
+    return max_conns;
+}
+
+// Amount of open connections
+int conn_pool_used()
+{
+    return atomic_load_explicit(&used_conns, memory_order_relaxed);
+}
+
+// Helper function - allocate next slab and put its objects to shared free list (pool lock must be held)
+// Slabs grow with demand (never past the connection limit), so idle server doesn't hold memory for connections it never had
+// Returns 0 on success, 1 if allocation failed
+int conn_pool_grow()
+{
+    int count = CONN_POOL_SLAB;
+    char* slab;
+    conn_t* conn;
+    int i;
+
+    if (max_conns > 0 && count > max_conns - allocated_conns) {
+        count = max_conns - allocated_conns;
+    }
+    if (object_size == 0) { // Pool wasn't setup (e.g. benchmarks), default request buffer size
+        object_size = backend_offset = conn_pool_object_size(CONF_REQ_BUFSIZE);
+    }
+    if ((slab = (char*)malloc(count * object_size)) == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < count; i++) {
+        conn = (conn_t*)(slab + i * object_size);
+        conn->backend = (backend_size > 0) ? (char*)conn + backend_offset : NULL;
+        conn->next = free_conns;
+        free_conns = conn;
+    }
+    allocated_conns += count;
+
+    return 0;
+}
+
+// Helper function - move up to count objects from one free list to another, returns amount of moved objects
+int conn_pool_move(conn_t** from, conn_t** to, int count)
+{
+    conn_t* conn;
+    int moved;
+
+    for (moved = 0; moved < count && *from != NULL; moved++) {
+        conn = *from;
+        *from = conn->next;
+        conn->next = *to;
+        *to = conn;
+    }
+    return moved;
+}
+
+// Helper function - thread exit, give cached objects back to shared free list and let next thread reuse the cache
+void conn_pool_cache_release(void* cache_data)
+{
+    conn_cache_t* cache = (conn_cache_t*)cache_data;
+
+    pthread_mutex_lock(&pool_lock);
+    pthread_mutex_lock(&cache->lock);
+    conn_pool_move(&cache->free_conns, &free_conns, cache->count);
+    cache->count = 0;
+    pthread_mutex_unlock(&cache->lock);
+    cache->next_released = released_caches;
+    released_caches = cache;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+// Helper function - create thread key whose destructor releases cache of exiting thread
+void conn_pool_key_create()
+{
+    if (pthread_key_create(&cache_key, conn_pool_cache_release) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[conn_pool_key_create] Failed to create connection cache thread key, threads will share free list");
+        return;
+    }
+    cache_key_created = 1;
+}
+
+// Helper function - get (or register) connection cache of calling thread
+// Returns NULL if thread has to use shared free list (cache couldn't be allocated)
+conn_cache_t* conn_pool_thread_cache()
+{
+    conn_cache_t* cache;
+
+    if (thread_cache != NULL) {
+        return thread_cache;
+    }
+    pthread_once(&cache_key_once, conn_pool_key_create);
+    if (!cache_key_created) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool_lock);
+    if ((cache = released_caches) != NULL) {
+        released_caches = cache->next_released;
+    } else if ((cache = (conn_cache_t*)calloc(1, sizeof(conn_cache_t))) != NULL) {
+        pthread_mutex_init(&cache->lock, NULL);
+        cache->next = caches;
+        caches = cache;
+    }
+    pthread_mutex_unlock(&pool_lock);
+
+    if (cache != NULL) {
+        pthread_setspecific(cache_key, cache);
+        thread_cache = cache;
+    }
+    return cache;
+}
+
+// Helper function - take object from shared free list (pool lock must be held), grow it or collect objects other threads
+// cache once whole budget is allocated (connection was reserved, so some object is free)
+// Returns NULL if none could be found (errno ENOBUFS) or allocation failed (errno ENOMEM)
+conn_t* conn_pool_take_shared(conn_cache_t* own_cache)
+{
+    conn_cache_t* cache;
+    conn_t* conn;
+    int pass;
+
+    if (free_conns == NULL && (max_conns == 0 || allocated_conns < max_conns) && conn_pool_grow() != 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    // Objects move between caches only through shared free list, but owners keep taking and returning their cached ones
+    // while caches are walked, so object returned to already visited cache can be missed by single pass
+    for (pass = 0; free_conns == NULL && pass < CONN_POOL_COLLECT_PASSES; pass++) {
+        for (cache = caches; cache != NULL; cache = cache->next) {
+            if (cache != own_cache) {
+                pthread_mutex_lock(&cache->lock);
+                cache->count -= conn_pool_move(&cache->free_conns, &free_conns, cache->count);
+                pthread_mutex_unlock(&cache->lock);
+            }
+        }
+    }
+    if ((conn = free_conns) == NULL) {
+        errno = ENOBUFS;
+        return NULL;
+    }
+    free_conns = conn->next;
+
+    return conn;
+}
+
+// Take connection object from the pool
+conn_t* conn_pool_get()
+{
+    conn_cache_t* cache = conn_pool_thread_cache();
+    conn_t* conn = NULL;
+
+    // Reserve connection first, so limit is kept without lock
+    if (atomic_fetch_add_explicit(&used_conns, 1, memory_order_acq_rel) >= max_conns && max_conns > 0) {
+        atomic_fetch_sub_explicit(&used_conns, 1, memory_order_relaxed);
+        errno = ENOBUFS;
+        metrics_connection_rejected();
+        return NULL;
+    }
+
+    if (cache != NULL) {
+        pthread_mutex_lock(&cache->lock);
+        if ((conn = cache->free_conns) != NULL) {
+            cache->free_conns = conn->next;
+            cache->count--;
+        }
+        pthread_mutex_unlock(&cache->lock);
+    }
+
+    // Own cache is empty, take object and refill cache with slab worth of objects from shared free list
+    if (conn == NULL) {
+        pthread_mutex_lock(&pool_lock);
+        if ((conn = conn_pool_take_shared(cache)) != NULL && cache != NULL) {
+            pthread_mutex_lock(&cache->lock);
+            cache->count += conn_pool_move(&free_conns, &cache->free_conns, CONN_POOL_SLAB - 1);
+            pthread_mutex_unlock(&cache->lock);
+        }
+        pthread_mutex_unlock(&pool_lock);
+
+        if (conn == NULL) {
+            atomic_fetch_sub_explicit(&used_conns, 1, memory_order_relaxed);
+            if (errno == ENOBUFS) {
+                metrics_connection_rejected();
+            }
+        }
+    }
+
+    return conn;
+}
+
+// Return connection object to the pool
+void conn_pool_put(conn_t* conn)
+{
+    conn_cache_t* cache = conn_pool_thread_cache();
+    int overflow;
+
+    if (cache == NULL) {
+        pthread_mutex_lock(&pool_lock);
+        conn->next = free_conns;
+        free_conns = conn;
+        pthread_mutex_unlock(&pool_lock);
+        atomic_fetch_sub_explicit(&used_conns, 1, memory_order_release);
+        return;
+    }
+
+    // Object is cached before connection is released, so thread which reserves it next is sure to find it
+    pthread_mutex_lock(&cache->lock);
+    conn->next = cache->free_conns;
+    cache->free_conns = conn;
+    overflow = (++cache->count > CONN_POOL_CACHE);
+    pthread_mutex_unlock(&cache->lock);
+    atomic_fetch_sub_explicit(&used_conns, 1, memory_order_release);
+
+    // Thread which closes more connections than it opens (e.g. connection threads of thread mode) gives its surplus back
+    if (overflow) {
+        pthread_mutex_lock(&pool_lock);
+        pthread_mutex_lock(&cache->lock);
+        cache->count -= conn_pool_move(&cache->free_conns, &free_conns, CONN_POOL_SLAB);
+        pthread_mutex_unlock(&cache->lock);
+        pthread_mutex_unlock(&pool_lock);
+    }
+}
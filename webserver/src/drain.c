@@ -0,0 +1,74 @@
+#include <drain.h>
+#include <conf_snapshot.h>
+#include <conn_pool.h>
+#include <timer_wheel.h>
+#include <log.h>
+
+static int event_fd = -1;
+static atomic_int started = 0;
+static atomic_ulong deadline_ms = 0;
+
+// Setup drain notification
+int drain_init()
+{
+    if ((event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[drain_init] Failed to create drain eventfd, error: %s", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Start draining
+void drain_start()
+{
+    uint64_t one = 1;
+    int timeout;
+
+    if (atomic_exchange(&started, 1) != 0) {
+        return;
+    }
+
+    timeout = conf_current()->drain_timeout;
+    atomic_store(&deadline_ms, timer_now_ms() + (unsigned long)timeout * 1000);
+
+    // Counter is never read back, so eventfd stays readable and wakes up every listener (level-triggered)
+    if (write(event_fd, &one, sizeof(one)) != sizeof(one)) {
+        log_msg(LOG_LEVEL_ERROR, "[drain_start] Failed to notify listeners, error: %s", strerror(errno));
+    }
+    log_msg(LOG_LEVEL_INFO, "[drain_start] Stopped accepting connections, draining %d open connections (drain timeout %d s)", conn_pool_used(), timeout);
+}
+
+// Check if server is draining
+int draining()
+{
+    return atomic_load_explicit(&started, memory_order_relaxed);
+}
+
+// File descriptor which becomes readable once draining starts
+int drain_event_fd()
+{
+    return event_fd;
+}
+
+// Check if drain timeout passed
+int drain_expired()
+{
+    return draining() && timer_now_ms() >= atomic_load(&deadline_ms);
+}
+
+// Wait until all connections are finished or drain timeout passes
+void drain_finish()
+{
+    struct timespec interval = { 0, DRAIN_POLL_MS * 1000000L };
+    int open_conns;
+
+    while ((open_conns = conn_pool_used()) > 0 && !drain_expired()) {
+        nanosleep(&interval, NULL);
+    }
+
+    if (open_conns > 0) {
+        log_msg(LOG_LEVEL_WARN, "[drain_finish] Drain timeout expired, closing %d open connections", open_conns);
+    } else {
+        log_msg(LOG_LEVEL_INFO, "[drain_finish] All connections are finished");
+    }
+}
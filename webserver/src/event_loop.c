@@ -0,0 +1,312 @@
+#include <event_loop.h>
+#include <common.h>
+#include <net_thread.h>
+#include <conn.h>
+#include <timer_wheel.h>
+#include <handoff.h>
+#include <drain.h>
+#include <log.h>
+
+static int drain_tag; // Its address is epoll data pointer of drain notification
+static atomic_int reuseport_failed = 0; // Set once event loop of reuseport mode fails, server then drains and exits with failure
+
+// Helper function - (re)register connection socket in epoll for readiness event matching its state
+// Returns 0 on success, 1 on failure
+int epoll_watch_conn(int epoll_fd, conn_t* conn, int op)
+{
+    struct epoll_event ev;
+
+    ev.events = (conn->state == CONN_STATE_WRITE) ? EPOLLOUT : EPOLLIN;
+    ev.data.ptr = conn;
+
+    return (epoll_ctl(epoll_fd, op, conn->socket_id, &ev) == 0) ? 0 : 1;
+}
+
+// Helper function - add connection to the front of open connection list
+void conn_list_add(conn_t** conns, conn_t* conn)
+{
+    conn->prev = NULL;
+    conn->next = *conns;
+    if (*conns != NULL) {
+        (*conns)->prev = conn;
+    }
+    *conns = conn;
+}
+
+// Helper function - remove connection from open connection list, cancel its deadline and destroy it
+void conn_list_destroy(conn_t** conns, timer_wheel_t* wheel, conn_t* conn)
+{
+    if (conn->prev != NULL) {
+        conn->prev->next = conn->next;
+    } else {
+        *conns = conn->next;
+    }
+    if (conn->next != NULL) {
+        conn->next->prev = conn->prev;
+    }
+    timer_wheel_cancel(wheel, &conn->timer);
+    conn_destroy(conn); // Closing socket also removes it from epoll
+}
+
+// Helper function - close connections which missed their deadline (idle, slow request header or stalled send)
+// Only fired timers are looked at, so cost doesn't grow with amount of open connections
+void epoll_close_expired(conn_t** conns, timer_wheel_t* wheel)
+{
+    wheel_timer_t* timer = timer_wheel_advance(wheel, timer_now_ms());
+    wheel_timer_t* next;
+    conn_t* conn;
+
+    while (timer != NULL) {
+        next = timer->next;
+        conn = (conn_t*)timer->data;
+        conn_timed_out(conn);
+        conn_list_destroy(conns, wheel, conn);
+        timer = next;
+    }
+}
+
+// Helper function - accept every pending client connection and register them in epoll
+void epoll_accept_clients(int epoll_fd, int listen_sock, conn_t** conns, timer_wheel_t* wheel, const char* caller)
+{
+    int client_sock;
+    socklen_t socklen;
+    struct sockaddr_storage client;
+    char client_ip_str[INET6_ADDRSTRLEN];
+    int client_port;
+    conn_t* conn;
+
+    while (1) {
+        socklen = (socklen_t)sizeof(client);
+        client_sock = accept4(listen_sock, (struct sockaddr*)&client, &socklen, SOCK_NONBLOCK);
+        if (client_sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) { continue; }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                log_msg(LOG_LEVEL_ERROR, "[%s] Failed to accept client connection, error: %s", caller, strerror(errno));
+            }
+            return;
+        }
+
+        // For debug logging (skipped completely when info messages are off)
+        if (log_enabled(LOG_LEVEL_INFO)) {
+            client_port = conn_addr_str(&client, client_ip_str, sizeof(client_ip_str));
+            log_msg(LOG_LEVEL_INFO, "[%s] Accepted connection: [%s:%d]", caller, client_ip_str, client_port);
+        }
+
+        if ((conn = conn_create(client_sock)) == NULL) {
+            conn_create_failed(client_sock);
+            close(client_sock);
+            continue;
+        }
+
+        if (epoll_watch_conn(epoll_fd, conn, EPOLL_CTL_ADD) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to register connection in epoll, error: %s", client_sock, strerror(errno));
+            conn_destroy(conn);
+            continue;
+        }
+        conn_list_add(conns, conn);
+        timer_wheel_schedule(wheel, &conn->timer, conn->deadline_ms);
+    }
+}
+
+// Helper function - run event loop for listening socket (accepted connections are served by this loop only)
+// Listening socket is non-blocking (open_listen_socket(...)), so accept loop stops when there are no more pending connections
+// When server starts draining, listening socket is closed and loop runs until its connections are finished or drain timeout passes
+// Returns exit-error
+int epoll_run(int listen_sock, const char* caller)
+{
+    int epoll_fd;
+    int event_count, i;
+    int accepting = 1;
+    struct epoll_event ev;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    conn_t* conn;
+    conn_t* conns = NULL; // Open connections
+    conn_state_t prev_state;
+    timer_wheel_t wheel; // Deadlines of open connections
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[%s] Failed to create epoll instance, error: %s", caller, strerror(errno));
+        return 1;
+    }
+
+    // Listening socket is registered with NULL data pointer, drain notification with drain_tag address, connections with their conn_t object
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_sock, &ev) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[%s] Failed to register listening sock in epoll, error: %s", caller, strerror(errno));
+        return 1;
+    }
+    ev.data.ptr = &drain_tag;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, drain_event_fd(), &ev) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[%s] Failed to register drain notification in epoll, error: %s", caller, strerror(errno));
+        return 1;
+    }
+
+    timer_wheel_init(&wheel, timer_now_ms());
+
+    // Event loop (wakes up every wheel tick while there are connections with deadlines)
+    while (1) {
+        event_count = epoll_wait(epoll_fd, events, EPOLL_MAX_EVENTS, (wheel.count > 0) ? TIMER_WHEEL_TICK_MS : -1);
+        if (event_count < 0) {
+            if (errno == EINTR) { continue; }
+            log_msg(LOG_LEVEL_ERROR, "[%s] Failed to wait for epoll events, error: %s", caller, strerror(errno));
+            return 1;
+        }
+
+        for (i = 0; i < event_count; i++) {
+            if (events[i].data.ptr == NULL) {
+                if (accepting) {
+                    epoll_accept_clients(epoll_fd, listen_sock, &conns, &wheel, caller);
+                }
+                continue;
+            }
+            if (events[i].data.ptr == &drain_tag) {
+                // Drain notification stays readable, so it is unregistered together with listening socket
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, drain_event_fd(), NULL);
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, listen_sock, NULL);
+                close(listen_sock);
+                accepting = 0;
+                continue;
+            }
+
+            // Advance connection until it would block, then wait for the event its new state needs (until its new deadline)
+            conn = (conn_t*)events[i].data.ptr;
+            prev_state = conn->state;
+            if (conn_process(conn) == CONN_STATE_CLOSE) {
+                conn_list_destroy(&conns, &wheel, conn);
+            } else if (conn->state != prev_state && epoll_watch_conn(epoll_fd, conn, EPOLL_CTL_MOD) != 0) {
+                log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to update connection in epoll, error: %s", conn->socket_id, strerror(errno));
+                conn_list_destroy(&conns, &wheel, conn);
+            } else {
+                timer_wheel_schedule(&wheel, &conn->timer, conn->deadline_ms);
+            }
+        }
+
+        epoll_close_expired(&conns, &wheel);
+
+        if (!accepting && (conns == NULL || drain_expired())) {
+            break;
+        }
+    }
+
+    close(epoll_fd);
+    return 0;
+}
+
+// Starts epoll-based web listening
+// Returns exit-error
+int epoll_listen(config_t* conf)
+{
+    int listen_sock;
+
+    if ((listen_sock = open_listen_socket(conf, 0)) < 0) {
+        return 1;
+    }
+    handoff_ready();
+
+    if (epoll_run(listen_sock, "epoll_listen") != 0) {
+        return 1;
+    }
+    drain_finish();
+    return 0;
+}
+
+// Helper function - pin calling thread to index-th CPU of process affinity mask (wraps around)
+void reuseport_pin_cpu(int index)
+{
+    cpu_set_t allowed;
+    cpu_set_t pinned;
+    int cpu;
+    int seen = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    index %= CPU_COUNT(&allowed);
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && seen++ == index) {
+            CPU_ZERO(&pinned);
+            CPU_SET(cpu, &pinned);
+            if (pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned) != 0) {
+                log_msg(LOG_LEVEL_WARN, "[reuseport_listen] Failed to pin event loop %d to CPU %d", index, cpu);
+            }
+            return;
+        }
+    }
+}
+
+// Reuseport event loop thread function - pin to own CPU and serve own listening socket
+// Failed loop is fatal: its socket would keep getting its share of new connections without anyone accepting them,
+// so it is closed and whole server drains and exits with failure
+void* reuseport_loop_run(void* loop_data)
+{
+    reuseport_loop_t* loop = (reuseport_loop_t*)loop_data;
+
+    reuseport_pin_cpu(loop->index);
+    if (epoll_run(loop->listen_sock, "reuseport_listen") != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[reuseport_listen] Event loop %d failed, shutting server down", loop->index);
+        close(loop->listen_sock);
+        atomic_store(&reuseport_failed, 1);
+        drain_start();
+    }
+
+    return NULL;
+}
+
+// Helper function - close listening sockets of event loops from first to last-1 (loops which don't run yet)
+void reuseport_close_loops(reuseport_loop_t* loops, int first, int last)
+{
+    int i;
+
+    for (i = first; i < last; i++) {
+        close(loops[i].listen_sock);
+    }
+}
+
+// Starts SO_REUSEPORT sharded web listening
+// Returns exit-error
+int reuseport_listen(config_t* conf)
+{
+    reuseport_loop_t* loops;
+    pthread_t thread_id;
+    int i;
+
+    if ((loops = (reuseport_loop_t*)calloc(conf->reuseport_size, sizeof(reuseport_loop_t))) == NULL) {
+        log_msg(LOG_LEVEL_ERROR, "[reuseport_listen] Failed to allocate event loops");
+        return 1;
+    }
+
+    // All listening sockets are opened up-front, so server either listens with all of them or fails to start
+    for (i = 0; i < conf->reuseport_size; i++) {
+        loops[i].index = i;
+        if ((loops[i].listen_sock = open_listen_socket(conf, 1)) < 0) {
+            reuseport_close_loops(loops, 0, i);
+            free(loops);
+            return 1;
+        }
+    }
+
+    // Loop 0 runs on this thread
+    // If starting loop fails, sockets of loops which don't run yet are closed (started loops keep theirs
+    // until process exits, so loop data isn't freed either)
+    for (i = 1; i < conf->reuseport_size; i++) {
+        if (pthread_create(&thread_id, NULL, reuseport_loop_run, &loops[i]) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[reuseport_listen] Failed to pthread_create event loop %d", i);
+            reuseport_close_loops(loops, i, conf->reuseport_size);
+            close(loops[0].listen_sock);
+            return 1;
+        }
+        pthread_detach(thread_id);
+    }
+    log_msg(LOG_LEVEL_INFO, "[reuseport_listen] Started %d SO_REUSEPORT event loops", conf->reuseport_size);
+    handoff_ready();
+
+    // Other loops finish draining on their own, their connections are waited for by drain_finish(...)
+    reuseport_pin_cpu(0);
+    if (epoll_run(loops[0].listen_sock, "reuseport_listen") != 0) {
+        return 1;
+    }
+    drain_finish();
+    return atomic_load(&reuseport_failed) ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+#include <file_cache.h>
+#include <fs_watch.h>
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static file_cache_entry_t* buckets[FILE_CACHE_BUCKETS];
+static file_cache_entry_t* lru_head = NULL;
+static file_cache_entry_t* lru_tail = NULL;
+static size_t used_bytes = 0;
+static size_t budget_bytes = 0; // 0 - cache disabled
+static size_t max_file_bytes = 0;
+static unsigned long generation = 0;
+
+// Helper function - FNV-1a hash of doc_path, reduced to bucket index
+unsigned int file_cache_bucket(const char* doc_path)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*doc_path) {
+        hash ^= (unsigned char)*doc_path++;
+        hash *= 16777619u;
+    }
+
+    return hash & (FILE_CACHE_BUCKETS - 1);
+}
+
+// Helper function - drop one reference, free entry when nobody uses it anymore (cache lock must be held)
+void file_cache_unref(file_cache_entry_t* entry)
+{
+    if (--entry->refs > 0) {
+        return;
+    }
+
+    free(entry->doc_path);
+    free(entry->resolved_path);
+    free(entry->data);
+    free(entry->gzip_data);
+    free(entry);
+}
+
+// Helper function - unlink entry from LRU list (cache lock must be held)
+void file_cache_lru_unlink(file_cache_entry_t* entry)
+{
+    if (entry->lru_prev != NULL) { entry->lru_prev->lru_next = entry->lru_next; } else { lru_head = entry->lru_next; }
+    if (entry->lru_next != NULL) { entry->lru_next->lru_prev = entry->lru_prev; } else { lru_tail = entry->lru_prev; }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+// Helper function - put entry to the front of LRU list (cache lock must be held)
+void file_cache_lru_push(file_cache_entry_t* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) { lru_head->lru_prev = entry; } else { lru_tail = entry; }
+    lru_head = entry;
+}
+
+// Helper function - remove entry from the cache, dropping cache's reference (cache lock must be held)
+void file_cache_remove(file_cache_entry_t* entry)
+{
+    file_cache_entry_t** link = &buckets[file_cache_bucket(entry->doc_path)];
+
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    file_cache_lru_unlink(entry);
+    used_bytes -= entry->stats.st_size + entry->gzip_len;
+    file_cache_unref(entry);
+}
+
+// Helper function - find entry by doc_path (cache lock must be held)
+file_cache_entry_t* file_cache_find(const char* doc_path)
+{
+    file_cache_entry_t* entry = buckets[file_cache_bucket(doc_path)];
+
+    while (entry != NULL && strcmp(entry->doc_path, doc_path) != 0) {
+        entry = entry->hash_next;
+    }
+
+    return entry;
+}
+
+// Change callback - drop entries of changed file, or of every file below changed directory
+void file_cache_invalidate(const char* path)
+{
+    file_cache_entry_t* entry;
+    file_cache_entry_t* next;
+    size_t path_len = (path != NULL) ? strlen(path) : 0;
+    int i;
+
+    pthread_mutex_lock(&cache_lock);
+    generation++;
+    for (i = 0; i < FILE_CACHE_BUCKETS; i++) {
+        for (entry = buckets[i]; entry != NULL; entry = next) {
+            next = entry->hash_next;
+            if (path == NULL || (strncmp(entry->resolved_path, path, path_len) == 0 &&
+                (entry->resolved_path[path_len] == '\0' || entry->resolved_path[path_len] == '/'))) {
+                file_cache_remove(entry);
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Setup process-wide document cache
+void file_cache_init(const config_t* conf)
+{
+    budget_bytes = conf->file_cache_size;
+    max_file_bytes = conf->file_cache_max_file;
+
+    if (budget_bytes > 0) {
+        fs_watch_subscribe(file_cache_invalidate);
+    }
+}
+
+// Check if document of given size is allowed to be cached (nothing is, once file changes could go unnoticed)
+int file_cache_accepts(off_t size)
+{
+    return budget_bytes > 0 && !fs_watch_lost() && (size_t)size <= max_file_bytes && (size_t)size <= budget_bytes;
+}
+
+// Get cached document by doc_path
+file_cache_entry_t* file_cache_lookup(const char* doc_path)
+{
+    file_cache_entry_t* entry;
+
+    if (budget_bytes == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if ((entry = file_cache_find(doc_path)) != NULL) {
+        file_cache_lru_unlink(entry);
+        file_cache_lru_push(entry);
+        entry->refs++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    return entry;
+}
+
+// Generation of cache contents (changes on every invalidation)
+unsigned long file_cache_generation()
+{
+    unsigned long current;
+
+    pthread_mutex_lock(&cache_lock);
+    current = generation;
+    pthread_mutex_unlock(&cache_lock);
+
+    return current;
+}
+
+// Read document file and add it to the cache
+file_cache_entry_t* file_cache_insert(const char* doc_path, const char* resolved_path, int fd, const struct stat* stats,
+    const char* content_type, unsigned long read_generation)
+{
+    file_cache_entry_t* entry;
+    file_cache_entry_t* existing;
+    size_t size = stats->st_size;
+    size_t read_total = 0;
+    ssize_t read_bytes;
+
+    if (!S_ISREG(stats->st_mode) || !file_cache_accepts(stats->st_size)) {
+        return NULL;
+    }
+
+    // Read whole file without touching fd offset (caller may still stream the file if caching fails)
+    if ((entry = (file_cache_entry_t*)calloc(1, sizeof(file_cache_entry_t))) == NULL) {
+        return NULL;
+    }
+    entry->data = (char*)malloc(size > 0 ? size : 1);
+    entry->doc_path = strdup(doc_path);
+    entry->resolved_path = strdup(resolved_path);
+    while (entry->data != NULL && read_total < size) {
+        read_bytes = pread(fd, entry->data + read_total, size - read_total, read_total);
+        if (read_bytes < 0 && errno == EINTR) { continue; }
+        if (read_bytes <= 0) { break; }
+        read_total += read_bytes;
+    }
+    if (entry->data == NULL || entry->doc_path == NULL || entry->resolved_path == NULL || read_total != size) {
+        entry->refs = 1;
+        file_cache_unref(entry);
+        return NULL;
+    }
+    entry->stats = *stats;
+    entry->content_type = content_type;
+    format_http_date(stats->st_mtime, entry->last_modified);
+    format_http_etag(stats, entry->etag);
+    entry->refs = 2; // Cache's own reference and caller's reference
+
+    pthread_mutex_lock(&cache_lock);
+
+    // Files changed while document was read, data might be stale
+    if (read_generation != generation) {
+        pthread_mutex_unlock(&cache_lock);
+        entry->refs = 1;
+        file_cache_unref(entry);
+        return NULL;
+    }
+
+    // Another request could have cached the same document meanwhile
+    if ((existing = file_cache_find(doc_path)) != NULL) {
+        file_cache_remove(existing);
+    }
+
+    // Evict least recently used documents until new one fits into budget
+    while (lru_tail != NULL && used_bytes + size > budget_bytes) {
+        file_cache_remove(lru_tail);
+    }
+
+    entry->hash_next = buckets[file_cache_bucket(doc_path)];
+    buckets[file_cache_bucket(doc_path)] = entry;
+    file_cache_lru_push(entry);
+    used_bytes += size;
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return entry;
+}
+
+// Helper function - gzip compress data with zlib level
+// Returns newly allocated compressed data (sets compressed_len), NULL if compression failed or didn't make data smaller
+char* file_cache_deflate(const char* data, size_t len, int level, size_t* compressed_len)
+{
+    z_stream stream;
+    char* compressed;
+    size_t bound;
+
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) { // 15 + 16: gzip wrapper, 32K window
+        return NULL;
+    }
+    bound = deflateBound(&stream, len);
+    if ((compressed = (char*)malloc(bound)) == NULL) {
+        deflateEnd(&stream);
+        return NULL;
+    }
+
+    stream.next_in = (Bytef*)data;
+    stream.avail_in = len;
+    stream.next_out = (Bytef*)compressed;
+    stream.avail_out = bound;
+    if (deflate(&stream, Z_FINISH) != Z_STREAM_END || stream.total_out >= len) {
+        deflateEnd(&stream);
+        free(compressed);
+        return NULL;
+    }
+    *compressed_len = stream.total_out;
+    deflateEnd(&stream);
+
+    return compressed;
+}
+
+// Get gzip compressed variant of cached document
+int file_cache_gzip(file_cache_entry_t* entry, int level)
+{
+    char* compressed;
+    size_t compressed_len = 0;
+    int state;
+
+    pthread_mutex_lock(&cache_lock);
+    state = entry->gzip_state;
+    pthread_mutex_unlock(&cache_lock);
+    if (state != FILE_CACHE_GZIP_NONE) {
+        return (state == FILE_CACHE_GZIP_READY) ? 0 : 1;
+    }
+
+    // Cached data never changes, so it is compressed without holding the lock
+    // (concurrent requests for the same new version may compress it twice, only first result is kept)
+    compressed = file_cache_deflate(entry->data, entry->stats.st_size, level, &compressed_len);
+
+    pthread_mutex_lock(&cache_lock);
+    if (entry->gzip_state == FILE_CACHE_GZIP_NONE) {
+        entry->gzip_state = (compressed != NULL) ? FILE_CACHE_GZIP_READY : FILE_CACHE_GZIP_USELESS;
+        entry->gzip_data = compressed;
+        entry->gzip_len = compressed_len;
+        compressed = NULL;
+
+        // Entry still in cache: compressed bytes count towards budget (evicting least recently used other documents)
+        if (entry->lru_prev != NULL || lru_head == entry) {
+            used_bytes += entry->gzip_len;
+            while (lru_tail != NULL && lru_tail != entry && used_bytes > budget_bytes) {
+                file_cache_remove(lru_tail);
+            }
+        }
+    }
+    state = entry->gzip_state;
+    pthread_mutex_unlock(&cache_lock);
+    free(compressed);
+
+    return (state == FILE_CACHE_GZIP_READY) ? 0 : 1;
+}
+
+// Release reference to cache entry
+void file_cache_release(file_cache_entry_t* entry)
+{
+    pthread_mutex_lock(&cache_lock);
+    file_cache_unref(entry);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,198 @@
+#include <fs_watch.h>
+#include <log.h>
+
+// Watched events: content/metadata changes, files and directories appearing or disappearing
+#define FS_WATCH_MASK (IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+
+// Size of inotify event read buffer
+#define FS_WATCH_BUFSIZE 16384
+
+static int watch_fd = -1;
+static char** watch_paths = NULL; // Watched directory paths, indexed by watch descriptor (only touched by watcher thread after start)
+static int watch_paths_len = 0;
+static fs_watch_cb_t subscribers[FS_WATCH_MAX_SUBSCRIBERS];
+static int subscriber_count = 0;
+static atomic_int watch_lost = 0; // 1 - some directory of the tree is not watched, its changes would go unnoticed
+
+// Register change callback, run this BEFORE fs_watch_start(...)
+// Returns 0 on success, 1 if there are too many subscribers
+int fs_watch_subscribe(fs_watch_cb_t callback)
+{
+    if (subscriber_count >= FS_WATCH_MAX_SUBSCRIBERS) {
+        return 1;
+    }
+
+    subscribers[subscriber_count++] = callback;
+    return 0;
+}
+
+// Helper function - notify every subscriber about changed path
+void fs_watch_notify(const char* path)
+{
+    int i;
+
+    for (i = 0; i < subscriber_count; i++) {
+        subscribers[i](path);
+    }
+}
+
+// Helper function - join directory path and entry name ("/" root doesn't get doubled slash)
+void fs_watch_join(char* out, const char* dir, const char* name)
+{
+    snprintf(out, PATH_MAX, "%s/%s", (strcmp(dir, "/") == 0) ? "" : dir, name);
+}
+
+// Helper function - add inotify watch for directory and (recursively) all of its subdirectories
+// Returns 0 on success, 1 if some directory of the tree could not be watched
+int fs_watch_add_tree(const char* dir_path)
+{
+    int wd;
+    int new_len;
+    char** new_paths;
+    char child_path[PATH_MAX];
+    struct stat child_stats;
+    struct dirent* dir_entry;
+    DIR* dir;
+    int ec = 0;
+
+    // Directory which vanished meanwhile has nothing left to watch
+    wd = inotify_add_watch(watch_fd, dir_path, FS_WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0 && (errno == ENOENT || errno == ENOTDIR)) {
+        return 0;
+    }
+    if (wd < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[fs_watch_add_tree] Failed to watch directory \"%s\", error: %s", dir_path, strerror(errno));
+        return 1;
+    }
+
+    // Grow watch path table so it can be indexed by the new watch descriptor
+    if (wd >= watch_paths_len) {
+        new_len = (wd + 1) * 2;
+        if ((new_paths = (char**)realloc(watch_paths, new_len * sizeof(char*))) == NULL) {
+            return 1;
+        }
+        memset(new_paths + watch_paths_len, 0, (new_len - watch_paths_len) * sizeof(char*));
+        watch_paths = new_paths;
+        watch_paths_len = new_len;
+    }
+    free(watch_paths[wd]);
+    if ((watch_paths[wd] = strdup(dir_path)) == NULL) {
+        return 1;
+    }
+
+    // Directory which can't be listed may hide subdirectories which would stay unwatched
+    if ((dir = opendir(dir_path)) == NULL && errno != ENOENT) {
+        log_msg(LOG_LEVEL_ERROR, "[fs_watch_add_tree] Failed to open directory \"%s\", error: %s", dir_path, strerror(errno));
+        return 1;
+    }
+    if (dir == NULL) {
+        return 0;
+    }
+    while ((dir_entry = readdir(dir)) != NULL) {
+        if (strcmp(dir_entry->d_name, ".") == 0 || strcmp(dir_entry->d_name, "..") == 0) {
+            continue;
+        }
+
+        fs_watch_join(child_path, dir_path, dir_entry->d_name);
+        if (dir_entry->d_type == DT_DIR || (dir_entry->d_type == DT_UNKNOWN && lstat(child_path, &child_stats) == 0 && S_ISDIR(child_stats.st_mode))) {
+            ec |= fs_watch_add_tree(child_path);
+        }
+    }
+    closedir(dir);
+
+    return ec;
+}
+
+// Check if some directory of the watched tree went unwatched after start (e.g. inotify watch limit reached),
+// changes below it are not noticed, so caches must not take new entries anymore
+int fs_watch_lost()
+{
+    return atomic_load(&watch_lost);
+}
+
+// Watcher thread function - translate inotify events to changed paths for subscribers
+void* fs_watch_run(void* unused)
+{
+    char buf[FS_WATCH_BUFSIZE] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    char path[PATH_MAX];
+    const struct inotify_event* event;
+    ssize_t read_bytes;
+    char* ptr;
+
+    while (1) {
+        read_bytes = read(watch_fd, buf, FS_WATCH_BUFSIZE);
+        if (read_bytes < 0) {
+            if (errno == EINTR) { continue; }
+            log_msg(LOG_LEVEL_ERROR, "[fs_watch_run] Failed to read inotify events, error: %s", strerror(errno));
+            return NULL;
+        }
+
+        for (ptr = buf; ptr < buf + read_bytes; ptr += sizeof(struct inotify_event) + event->len) {
+            event = (const struct inotify_event*) ptr;
+
+            // Events were lost, every cached path is suspicious
+            if (event->mask & IN_Q_OVERFLOW) {
+                fs_watch_notify(NULL);
+                continue;
+            }
+            if (event->wd < 0 || event->wd >= watch_paths_len || watch_paths[event->wd] == NULL) {
+                continue;
+            }
+
+            // Event about watched directory itself (removed/moved) or about entry inside it
+            if (event->len > 0) {
+                fs_watch_join(path, watch_paths[event->wd], event->name);
+            } else {
+                strncpy(path, watch_paths[event->wd], PATH_MAX - 1);
+                path[PATH_MAX - 1] = '\0';
+            }
+
+            // New subdirectories have to be watched as well, if that fails cached entries can't be trusted anymore
+            if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO)) && fs_watch_add_tree(path) != 0 &&
+                !atomic_exchange(&watch_lost, 1)) {
+                log_msg(LOG_LEVEL_ERROR, "[fs_watch_run] Directory tree is not fully watched anymore, caches stop taking new entries");
+                fs_watch_notify(NULL);
+            }
+
+            if (event->mask & FS_WATCH_MASK) {
+                fs_watch_notify(path);
+            }
+
+            // Watch was removed by kernel (directory deleted)
+            if (event->mask & IN_IGNORED) {
+                free(watch_paths[event->wd]);
+                watch_paths[event->wd] = NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Recursively watch directory tree at root with inotify and start watcher thread which notifies subscribers
+// Returns 0 on success, 1 on failure (also when some directory of the tree can't be watched)
+int fs_watch_start(const char* root)
+{
+    pthread_t thread_id;
+
+    if ((watch_fd = inotify_init1(IN_CLOEXEC)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[fs_watch_start] Failed to initialize inotify, error: %s", strerror(errno));
+        return 1;
+    }
+
+    // Caches are only safe if every change is noticed, partially watched tree is a failure
+    if (fs_watch_add_tree(root) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[fs_watch_start] Failed to watch whole directory tree \"%s\"", root);
+        close(watch_fd);
+        watch_fd = -1;
+        return 1;
+    }
+
+    if (pthread_create(&thread_id, NULL, fs_watch_run, NULL) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[fs_watch_start] Failed to pthread_create watcher thread");
+        return 1;
+    }
+    pthread_detach(thread_id);
+
+    return 0;
+}
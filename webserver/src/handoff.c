@@ -0,0 +1,379 @@
+#include <handoff.h>
+#include <drain.h>
+#include <log.h>
+
+// First passed socket (after stdin, stdout and stderr)
+#define HANDOFF_FIRST_FD 3
+
+static int inherited_fds[HANDOFF_MAX_FDS]; // Passed listening sockets not taken over yet
+static int inherited_count = 0;
+static int listen_fds[HANDOFF_MAX_FDS]; // Listening sockets of this instance
+static int listen_count = 0;
+static atomic_int ready = 0;
+static pid_t previous_pid = 0; // Instance which handed its listening sockets over, 0 - none
+static int helper_sock = -1; // Connection to exec helper
+static char exe_path[PATH_MAX]; // Server binary, as it was resolved at startup
+static int pid_dir_fd = -1; // Directory of pid file, -1 if pid file is not written
+static char pid_file_name[NAME_MAX+1];
+
+// Helper function - parse non-negative integer environment variable and remove it from environment
+// Returns value, 0 if variable is not set or is not a number
+long handoff_take_env(const char* name)
+{
+    const char* value = getenv(name);
+    char* end;
+    long number = 0;
+
+    if (value != NULL) {
+        number = strtol(value, &end, 10);
+        if (end == value || *end != '\0' || number < 0) {
+            number = 0;
+        }
+    }
+    unsetenv(name);
+
+    return number;
+}
+
+// Take over listening sockets passed in LISTEN_FDS
+int handoff_inherit()
+{
+    long listen_pid = handoff_take_env("LISTEN_PID");
+    long count = handoff_take_env("LISTEN_FDS");
+    long handoff_pid = handoff_take_env(HANDOFF_PID_ENV);
+    socklen_t len;
+    int accepting;
+    int fd;
+
+    unsetenv("LISTEN_FDNAMES");
+
+    // Variables could be inherited from unrelated parent, they are meant only for process they name
+    if (count == 0 || listen_pid != (long)getpid()) {
+        return 0;
+    }
+    if (count > HANDOFF_MAX_FDS) {
+        printf("[ERROR] [handoff_inherit] Too many passed sockets (%ld, maximum is %d)\n", count, HANDOFF_MAX_FDS);
+        return 1;
+    }
+
+    for (fd = HANDOFF_FIRST_FD; fd < HANDOFF_FIRST_FD + count; fd++) {
+        len = (socklen_t)sizeof(accepting);
+        if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &accepting, &len) != 0 || !accepting) {
+            printf("[WARN] [handoff_inherit] Passed fd %d is not a listening socket, closing it\n", fd);
+            close(fd);
+            continue;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        inherited_fds[inherited_count++] = fd;
+    }
+    previous_pid = (pid_t)handoff_pid;
+
+    printf("[INFO] [handoff_inherit] Inherited %d listening sockets\n", inherited_count);
+    return 0;
+}
+
+// Take inherited listening socket bound to given port
+int handoff_take_listen_socket(uint16_t port)
+{
+    struct sockaddr_storage addr;
+    socklen_t len;
+    int bound_port;
+    int listen_sock;
+    int i;
+
+    for (i = 0; i < inherited_count; i++) {
+        len = (socklen_t)sizeof(addr);
+        if (getsockname(inherited_fds[i], (struct sockaddr*)&addr, &len) != 0) {
+            continue;
+        }
+
+        if (addr.ss_family == AF_INET) {
+            bound_port = ntohs(((struct sockaddr_in*)&addr)->sin_port);
+        } else if (addr.ss_family == AF_INET6) {
+            bound_port = ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+        } else {
+            continue;
+        }
+
+        if (bound_port == port) {
+            listen_sock = inherited_fds[i];
+            inherited_fds[i] = inherited_fds[--inherited_count];
+            return listen_sock;
+        }
+    }
+
+    return -1;
+}
+
+// Remember listening socket
+void handoff_add_listen_socket(int listen_sock)
+{
+    if (listen_count < HANDOFF_MAX_FDS) {
+        listen_fds[listen_count++] = listen_sock;
+    } else {
+        log_msg(LOG_LEVEL_WARN, "[handoff_add_listen_socket] Too many listening sockets, socket %d won't be handed over", listen_sock);
+    }
+}
+
+// Helper function - (in forked child of exec helper) execute server binary with passed listening sockets
+// Returns only if execution failed
+void handoff_exec_instance(const int* fds, int count, pid_t server_pid, char* const argv[])
+{
+    int moved[HANDOFF_MAX_FDS];
+    char value[32];
+    int i;
+
+    // Ignored signals stay ignored across exec, but server waits for them
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGHUP, SIG_DFL);
+
+    // Sockets must end up as fds 3, 4, ..., so they are first moved above that range (no dup2(...) overwrites another passed socket)
+    for (i = 0; i < count; i++) {
+        if ((moved[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, HANDOFF_FIRST_FD + count)) < 0) {
+            printf("[ERROR] [handoff_exec_instance] Failed to move passed socket, error: %s\n", strerror(errno));
+            fflush(stdout);
+            return;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        dup2(moved[i], HANDOFF_FIRST_FD + i); // Duplicate has no close-on-exec flag, so it survives exec
+    }
+
+    snprintf(value, sizeof(value), "%d", count);
+    setenv("LISTEN_FDS", value, 1);
+    snprintf(value, sizeof(value), "%d", (int)getpid());
+    setenv("LISTEN_PID", value, 1);
+    snprintf(value, sizeof(value), "%d", (int)server_pid);
+    setenv(HANDOFF_PID_ENV, value, 1);
+
+    execv(exe_path, argv);
+    printf("[ERROR] [handoff_exec_instance] Failed to execute \"%s\", error: %s\n", exe_path, strerror(errno));
+    fflush(stdout);
+}
+
+// Helper function - exec helper process: receive listening sockets (and PID of sending server) and start new instance with them,
+// replying with its PID (-1 if fork failed), exits once server closes its end of the connection
+void handoff_helper_run(int sock, char* const argv[])
+{
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    int fds[HANDOFF_MAX_FDS];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    pid_t server_pid, child;
+    ssize_t received;
+    int count, i;
+
+    // New instances outlive helper and are never waited for, and helper must survive hangup of terminal it was started from
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGHUP, SIG_IGN);
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base = &server_pid;
+        iov.iov_len = sizeof(server_pid);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        received = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received != (ssize_t)sizeof(server_pid)) { // Server exited
+            _exit(0);
+        }
+
+        count = 0;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+                count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+                memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+            }
+        }
+
+        if ((child = fork()) == 0) {
+            close(sock);
+            handoff_exec_instance(fds, count, server_pid, argv);
+            _exit(127);
+        }
+
+        for (i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        send(sock, &child, sizeof(child), MSG_NOSIGNAL);
+    }
+}
+
+// Start exec helper process
+int handoff_start_helper(char const* argv[])
+{
+    int socks[2];
+    ssize_t len;
+    pid_t pid;
+    int i;
+
+    if ((len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1)) < 0) {
+        printf("[ERROR] [handoff_start_helper] Failed to resolve server binary path, error: %s\n", strerror(errno));
+        return 1;
+    }
+    exe_path[len] = '\0';
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, socks) != 0) {
+        printf("[ERROR] [handoff_start_helper] Failed to create exec helper connection, error: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if ((pid = fork()) < 0) {
+        printf("[ERROR] [handoff_start_helper] Failed to fork exec helper, error: %s\n", strerror(errno));
+        close(socks[0]);
+        close(socks[1]);
+        return 1;
+    }
+    if (pid == 0) {
+        // Helper must not hold listening sockets, they are passed to it on handoff
+        for (i = 0; i < inherited_count; i++) {
+            close(inherited_fds[i]);
+        }
+        close(socks[0]);
+        handoff_helper_run(socks[1], (char* const*)argv);
+    }
+
+    close(socks[1]);
+    helper_sock = socks[0];
+
+    return 0;
+}
+
+// Hand listening sockets over to new server instance
+int handoff_exec()
+{
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    pid_t server_pid = getpid();
+    pid_t child = -1;
+
+    if (helper_sock < 0 || !atomic_load(&ready) || listen_count == 0) {
+        log_msg(LOG_LEVEL_ERROR, "[handoff_exec] Server is not listening yet, nothing to hand over");
+        return 1;
+    }
+    if (draining()) {
+        log_msg(LOG_LEVEL_WARN, "[handoff_exec] Server is draining, its listening sockets are handed over or closed already");
+        return 1;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = &server_pid;
+    iov.iov_len = sizeof(server_pid);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * listen_count);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * listen_count);
+    memcpy(CMSG_DATA(cmsg), listen_fds, sizeof(int) * listen_count);
+
+    if (sendmsg(helper_sock, &msg, MSG_NOSIGNAL) < 0 || recv(helper_sock, &child, sizeof(child), 0) != (ssize_t)sizeof(child) || child < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[handoff_exec] Failed to start new server instance (exec helper is gone or fork failed)");
+        return 1;
+    }
+
+    log_msg(LOG_LEVEL_INFO, "[handoff_exec] Started new server instance (pid %d) with %d listening sockets, serving until it is listening", (int)child, listen_count);
+    return 0;
+}
+
+// Remember pid file
+int handoff_set_pid_file(const char* path)
+{
+    const char* slash = strrchr(path, '/');
+    char dir_path[PATH_MAX];
+
+    if (slash == NULL) {
+        strcpy(dir_path, ".");
+        snprintf(pid_file_name, sizeof(pid_file_name), "%s", path);
+    } else {
+        snprintf(dir_path, PATH_MAX, "%.*s", (slash == path) ? 1 : (int)(slash - path), path);
+        snprintf(pid_file_name, sizeof(pid_file_name), "%s", slash + 1);
+    }
+
+    if ((pid_dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        printf("[ERROR] [handoff_set_pid_file] Failed to open pid file directory \"%s\", error: %s\n", dir_path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+// Helper function - write PID of this process to pid file (temporary file is renamed over it, so readers never see partial content)
+void handoff_write_pid_file()
+{
+    char tmp_name[NAME_MAX+8];
+    char pid_str[32];
+    int len;
+    int fd;
+
+    snprintf(tmp_name, sizeof(tmp_name), ".%s.tmp", pid_file_name);
+    len = snprintf(pid_str, sizeof(pid_str), "%d\n", (int)getpid());
+
+    if ((fd = openat(pid_dir_fd, tmp_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[handoff_write_pid_file] Failed to create pid file \"%s\", error: %s", pid_file_name, strerror(errno));
+        return;
+    }
+    if (write(fd, pid_str, len) != len || renameat(pid_dir_fd, tmp_name, pid_dir_fd, pid_file_name) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[handoff_write_pid_file] Failed to write pid file \"%s\", error: %s", pid_file_name, strerror(errno));
+        unlinkat(pid_dir_fd, tmp_name, 0);
+    }
+    close(fd);
+}
+
+// Remove pid file, unless it names another process already
+void handoff_remove_pid_file()
+{
+    char pid_str[32];
+    ssize_t len;
+    int fd;
+
+    if (pid_dir_fd < 0 || (fd = openat(pid_dir_fd, pid_file_name, O_RDONLY | O_CLOEXEC)) < 0) {
+        return;
+    }
+    len = read(fd, pid_str, sizeof(pid_str) - 1);
+    close(fd);
+
+    if (len > 0) {
+        pid_str[len] = '\0';
+        if (atoi(pid_str) == (int)getpid()) {
+            unlinkat(pid_dir_fd, pid_file_name, 0);
+        }
+    }
+}
+
+// Report that listening sockets are set up
+void handoff_ready()
+{
+    int i;
+
+    // Inherited sockets of no longer configured ports would queue connections nobody accepts
+    for (i = 0; i < inherited_count; i++) {
+        log_msg(LOG_LEVEL_WARN, "[handoff_ready] Closing inherited listening socket %d, no listener took it over", inherited_fds[i]);
+        close(inherited_fds[i]);
+    }
+    inherited_count = 0;
+    atomic_store(&ready, 1);
+
+    if (pid_dir_fd >= 0) {
+        handoff_write_pid_file();
+    }
+
+    if (previous_pid > 0) {
+        log_msg(LOG_LEVEL_INFO, "[handoff_ready] Listening, telling previous instance (pid %d) to drain", (int)previous_pid);
+        if (kill(previous_pid, SIGQUIT) != 0) {
+            log_msg(LOG_LEVEL_WARN, "[handoff_ready] Failed to signal previous instance (pid %d), error: %s", (int)previous_pid, strerror(errno));
+        }
+        previous_pid = 0;
+    }
+}
@@ -1,4 +1,8 @@
 #include <http.h>
+#include <meta_cache.h>
+#include <mime.h>
+#include <metrics.h>
+#include <log.h>
 
 // Status code enum to string
 const char* http_status_str(http_status_t status)
@@ -6,12 +10,18 @@ const char* http_status_str(http_status_t status)
     switch (status) {
         case HTTP_STATUS_OK:
             return "OK";
+        case HTTP_STATUS_PARTIALCONTENT:
+            return "Partial Content";
+        case HTTP_STATUS_NOTMODIFIED:
+            return "Not Modified";
         case HTTP_STATUS_BADREQUEST:
             return "Bad Request";
         case HTTP_STATUS_FORBIDDEN:
             return "Forbidden";
         case HTTP_STATUS_NOTFOUND:
             return "Not Found";
+        case HTTP_STATUS_RANGENOTSATISFIABLE:
+            return "Range Not Satisfiable";
         case HTTP_STATUS_INTERNALSERVERERROR:
             return "Internal Server Error";
         case HTTP_STATUS_NOTIMPLEMENTED:
@@ -26,25 +36,16 @@ const char* doc_content_type(const char* docpath)
 {
     const char* lslash = strrchr(docpath, '/');
     const char* ext = strrchr(docpath, '.');
+    const char* content_type;
 
     // Default to TEXT/HTML for broken paths or missing extensions
     if (ext == NULL || (lslash != NULL && ext < lslash)) { 
         return CONTENT_TEXT_HTML;
     }
 
-    if      (!strcmp(ext, ".txt" )) { return CONTENT_TEXT_PLAIN; }
-    else if (!strcmp(ext, ".htm" )) { return CONTENT_TEXT_HTML; }
-    else if (!strcmp(ext, ".html")) { return CONTENT_TEXT_HTML; }
-    else if (!strcmp(ext, ".css" )) { return CONTENT_TEXT_CSS; }
-    else if (!strcmp(ext, ".ico" )) { return CONTENT_IMG_ICO; }
-    else if (!strcmp(ext, ".jpeg")) { return CONTENT_IMG_JPEG; }
-    else if (!strcmp(ext, ".jpg" )) { return CONTENT_IMG_JPEG; }
-    else if (!strcmp(ext, ".png" )) { return CONTENT_IMG_PNG; }
-    else if (!strcmp(ext, ".gif" )) { return CONTENT_IMG_GIF; }
-    else if (!strcmp(ext, ".js"  )) { return CONTENT_APP_JS; }
-    else if (!strcmp(ext, ".xml" )) { return CONTENT_APP_XML; }
-    else if (!strcmp(ext, ".bin" )) { return CONTENT_APP_OCTET_STREAM; }
-    else                            { return CONTENT_DEFAULT; }
+    // Constant time lookup in table compiled from built-in types and mime.types file
+    content_type = mime_lookup(ext + 1, strlen(ext + 1));
+    return (content_type != NULL) ? content_type : CONTENT_DEFAULT;
 }
 
 // Helper function to determine if x is a hex character
@@ -161,6 +162,25 @@ int parse_request_line(char* message_buf, http_request_t* http_request)
     return 0;
 }
 
+// Search for request termination signal in buf, continuing from scan_from
+// Only line feeds are candidates, so memchr(...) (vectorized by libc) skips everything between them
+size_t http_request_end(const char* buf, size_t scan_from, size_t len)
+{
+    const char* lf = buf + scan_from;
+    const char* end = buf + len;
+    size_t i;
+
+    while (lf < end && (lf = (const char*)memchr(lf, '\n', end - lf)) != NULL) {
+        i = lf - buf;
+        if ((i >= 1 && buf[i-1] == '\n') || (i >= 3 && buf[i-3] == '\r' && buf[i-2] == '\n' && buf[i-1] == '\r')) {
+            return i + 1;
+        }
+        lf++;
+    }
+
+    return 0;
+}
+
 // Parse and potentially fix doc_path from URI
 // Returns 0 if parsing was successful, 1 if not (parsed doc_path was too long for PATH_MAX)
 int parse_doc_path_uri(char* doc_path, const char* uri, int len)
@@ -213,6 +233,398 @@ int parse_doc_path_uri(char* doc_path, const char* uri, int len)
     return 0;
 }
 
+// Find header field value by (case-insensitive) field name
+// Returns pointer to value (surrounding whitespace skipped) and sets value_len, NULL if field is not present
+const char* http_header_value(const http_request_t* http_request, const char* name, size_t* value_len)
+{
+    const char* line = http_request->header_fields;
+    const char* line_end;
+    const char* value;
+    const char* value_end;
+    size_t name_len = strlen(name);
+
+    // Header fields end with empty line (or end of message buffer)
+    while (line != NULL && *line != '\0' && *line != '\r' && *line != '\n') {
+        line_end = strchr(line, '\n');
+        if (line_end == NULL) {
+            line_end = line + strlen(line);
+        }
+
+        if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+            value = line + name_len + 1;
+            value_end = line_end;
+            while (value < value_end && (*value == ' ' || *value == '\t')) { value++; }
+            while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == ' ' || value_end[-1] == '\t')) { value_end--; }
+
+            *value_len = value_end - value;
+            return value;
+        }
+
+        line = (*line_end == '\n') ? line_end + 1 : line_end;
+    }
+
+    return NULL;
+}
+
+// Helper function - check if comma-separated header value contains token (case-insensitive), e.g. "keep-alive, Upgrade"
+int http_value_has_token(const char* value, size_t value_len, const char* token)
+{
+    size_t token_len = strlen(token);
+    const char* end = value + value_len;
+    const char* item_end;
+
+    while (value < end) {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) { value++; }
+        item_end = value;
+        while (item_end < end && *item_end != ',') { item_end++; }
+
+        // Trim trailing whitespace of the item
+        while (item_end > value && (item_end[-1] == ' ' || item_end[-1] == '\t')) { item_end--; }
+        if ((size_t)(item_end - value) == token_len && strncasecmp(value, token, token_len) == 0) {
+            return 1;
+        }
+
+        while (value < end && *value != ',') { value++; }
+    }
+
+    return 0;
+}
+
+// Helper function - determine persistent connection from version and "Connection" header
+// HTTP/1.1 connections are persistent unless "Connection: close", HTTP/1.0 ones only with "Connection: keep-alive"
+int http_request_keep_alive(const http_request_t* http_request)
+{
+    size_t value_len;
+    const char* value = http_header_value(http_request, "Connection", &value_len);
+
+    if (strcmp(HTTP_VERSION_1_0, http_request->version) == 0) {
+        return (value != NULL && http_value_has_token(value, value_len, "keep-alive"));
+    }
+
+    return !(value != NULL && http_value_has_token(value, value_len, "close"));
+}
+
+// Helper function - check if "If-None-Match" list of entity tags contains etag (or is "*")
+// Uses weak comparison: W/ prefixes are ignored on both sides, opaque tags must match exactly
+int http_etag_matches(const char* value, size_t value_len, const char* etag)
+{
+    const char* end = value + value_len;
+    const char* item_end;
+
+    if (strncmp(etag, "W/", 2) == 0) { etag += 2; }
+
+    while (value < end) {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) { value++; }
+        if (value < end && *value == '*') {
+            return 1;
+        }
+        if (end - value >= 2 && strncmp(value, "W/", 2) == 0) { value += 2; }
+
+        // Opaque tag is quoted and may contain commas, so it ends with its closing quote
+        if (value >= end || *value != '"' || (item_end = memchr(value + 1, '"', end - value - 1)) == NULL) {
+            return 0;
+        }
+        item_end++;
+        if (strlen(etag) == (size_t)(item_end - value) && strncmp(value, etag, item_end - value) == 0) {
+            return 1;
+        }
+        value = item_end;
+    }
+
+    return 0;
+}
+
+// Helper function - evaluate conditional request headers against document validators
+// "If-None-Match" takes precedence, "If-Modified-Since" is only looked at when it is absent
+// Returns 1 if client's copy is still valid (respond with 304), 0 otherwise
+int http_request_not_modified(const http_request_t* http_request, const char* etag, time_t last_modified)
+{
+    size_t value_len;
+    const char* value;
+    time_t since;
+
+    if ((value = http_header_value(http_request, "If-None-Match", &value_len)) != NULL) {
+        return http_etag_matches(value, value_len, etag);
+    }
+
+    // Dates in the future are invalid (client clock is off), such header is ignored
+    if ((value = http_header_value(http_request, "If-Modified-Since", &value_len)) != NULL &&
+        parse_http_date(value, value_len, &since) == 0 && since <= time(0)) {
+        return last_modified <= since;
+    }
+
+    return 0;
+}
+
+// Helper function - parse decimal byte position at *p (advancing it past digits)
+// Returns 0 on success, 1 if there are no digits or there are too many of them for off_t
+int parse_range_position(const char** p, const char* end, off_t* position)
+{
+    const char* start = *p;
+
+    *position = 0;
+    while (*p < end && **p >= '0' && **p <= '9') {
+        if (*p - start >= 18) { // 18 digits always fit in off_t
+            return 1;
+        }
+        *position = *position * 10 + (**p - '0');
+        (*p)++;
+    }
+
+    return (*p == start) ? 1 : 0;
+}
+
+// Helper function - parse "Range" header value (e.g. "bytes=0-499, -500") against document size into ranges
+// Unsatisfiable ranges are dropped, open and oversized ones are clamped to the end of document
+// Returns amount of satisfiable ranges (0 if there are none), -1 if header must be ignored (other unit, bad syntax, too many ranges)
+int parse_http_ranges(const char* value, size_t value_len, off_t size, http_byte_range_t* ranges)
+{
+    const char* p = value + 6;
+    const char* end = value + value_len;
+    int specs = 0;
+    int count = 0;
+    off_t first, last;
+
+    if (value_len < 6 || strncasecmp(value, "bytes=", 6) != 0) {
+        return -1;
+    }
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) { p++; }
+        if (p >= end) {
+            break;
+        }
+        if (++specs > HTTP_RANGES_MAX) {
+            return -1;
+        }
+
+        if (*p == '-') { // Suffix range "-N" - last N bytes of document
+            p++;
+            if (parse_range_position(&p, end, &last) != 0) {
+                return -1;
+            }
+            if (last > 0 && size > 0) {
+                ranges[count].first = (last >= size) ? 0 : size - last;
+                ranges[count].last = size - 1;
+                count++;
+            }
+        } else { // "first-last" or open "first-"
+            if (parse_range_position(&p, end, &first) != 0 || p >= end || *p != '-') {
+                return -1;
+            }
+            p++;
+            last = size - 1;
+            if (p < end && *p >= '0' && *p <= '9') {
+                if (parse_range_position(&p, end, &last) != 0 || last < first) {
+                    return -1;
+                }
+                if (last >= size) {
+                    last = size - 1;
+                }
+            }
+            if (first < size) {
+                ranges[count].first = first;
+                ranges[count].last = last;
+                count++;
+            }
+        }
+
+        while (p < end && (*p == ' ' || *p == '\t')) { p++; }
+        if (p < end && *p != ',') {
+            return -1;
+        }
+    }
+
+    return (specs == 0) ? -1 : count;
+}
+
+// Helper function - evaluate "If-Range" header against document validators
+// Entity tag must match strongly (weak tags never do), date must be exact Last-Modified time
+// Returns 1 if Range header applies (no If-Range, or document is unchanged), 0 if whole document must be sent
+int http_if_range_matches(const http_request_t* http_request, const char* etag, time_t last_modified)
+{
+    size_t value_len;
+    const char* value = http_header_value(http_request, "If-Range", &value_len);
+    time_t since;
+
+    if (value == NULL) {
+        return 1;
+    }
+    if (value[0] == '"' || (value_len >= 2 && strncmp(value, "W/", 2) == 0)) {
+        return strncmp(etag, "W/", 2) != 0 && strlen(etag) == value_len && strncmp(value, etag, value_len) == 0;
+    }
+
+    return parse_http_date(value, value_len, &since) == 0 && since == last_modified;
+}
+
+// Precompressed sidecar files (<document><suffix>) in order of preference
+static const struct {
+    const char* coding; // Content coding (Content-Encoding and Accept-Encoding token)
+    const char* suffix;
+} http_sidecars[] = { { "br", ".br" }, { "gzip", ".gz" } };
+
+// Helper function - check if documents of content type are worth compressing (text formats, including XML/JSON based ones such as SVG)
+int http_content_compressible(const char* content_type)
+{
+    size_t len = strlen(content_type);
+
+    return strncmp(content_type, "text/", 5) == 0 || strcmp(content_type, CONTENT_APP_JS) == 0 || strcmp(content_type, CONTENT_APP_XML) == 0 ||
+        strcmp(content_type, "application/json") == 0 || strcmp(content_type, "application/wasm") == 0 ||
+        (len > 4 && (strcmp(content_type + len - 4, "+xml") == 0 || strcmp(content_type + len - 5, "+json") == 0));
+}
+
+// Helper function - check if parameters of "Accept-Encoding" item (e.g. ";q=0.000") set zero q-value
+int http_qvalue_zero(const char* params, const char* end)
+{
+    const char* p;
+
+    for (p = params; p + 1 < end; p++) {
+        if ((*p == 'q' || *p == 'Q') && p[1] == '=') {
+            for (p += 2; p < end && (*p == '0' || *p == '.'); p++) {}
+            return (p == end || *p == ' ' || *p == '\t' || *p == ';');
+        }
+    }
+
+    return 0;
+}
+
+// Helper function - check if content coding is acceptable according to "Accept-Encoding" value (e.g. "gzip;q=0.8, br")
+// Coding must be listed (or covered by "*") without zero q-value, its own entry takes precedence over "*"
+int http_accepts_encoding(const char* value, size_t value_len, const char* coding)
+{
+    size_t coding_len = strlen(coding);
+    const char* end = value + value_len;
+    const char* item_end;
+    const char* token_end;
+    int acceptable;
+    int wildcard = 0;
+
+    while (value < end) {
+        while (value < end && (*value == ' ' || *value == '\t' || *value == ',')) { value++; }
+        if (value >= end) {
+            break;
+        }
+        if ((item_end = (const char*)memchr(value, ',', end - value)) == NULL) {
+            item_end = end;
+        }
+        token_end = value;
+        while (token_end < item_end && *token_end != ';' && *token_end != ' ' && *token_end != '\t') { token_end++; }
+
+        acceptable = !http_qvalue_zero(token_end, item_end);
+        if ((size_t)(token_end - value) == coding_len && strncasecmp(value, coding, coding_len) == 0) {
+            return acceptable;
+        }
+        if (token_end - value == 1 && *value == '*') {
+            wildcard = acceptable;
+        }
+        value = item_end;
+    }
+
+    return wildcard;
+}
+
+// Helper function - resolve doc_path to real path, stats and content type
+// Hot documents and recently missing/forbidden ones come from metadata cache without any filesystem access
+// Returns HTTP_STATUS_OK if document exists (meta is filled), error status for the failure otherwise
+http_status_t resolve_http_document(const char* doc_path, doc_meta_t* meta)
+{
+    unsigned long generation;
+
+    if (meta_cache_lookup(doc_path, meta) == 0) {
+        return (meta->error == 0) ? HTTP_STATUS_OK : (meta->error == EACCES) ? HTTP_STATUS_FORBIDDEN : HTTP_STATUS_NOTFOUND;
+    }
+    generation = meta_cache_generation(); // Taken before resolving, so changes meanwhile keep result out of cache
+
+    // Get realpath of doc_path
+    if (realpath(doc_path, meta->resolved_path) == NULL) {
+        meta->error = errno;
+        meta_cache_insert(doc_path, meta, generation);
+        if (meta->error == ENOENT) {
+            return HTTP_STATUS_NOTFOUND;
+        } else if (meta->error == EACCES) {
+            return HTTP_STATUS_FORBIDDEN;
+        } else {
+            return HTTP_STATUS_BADREQUEST;
+        }
+    }
+
+    // Try to stat the file
+    if (stat(meta->resolved_path, &meta->stats) != 0) {
+        meta->error = errno;
+        meta_cache_insert(doc_path, meta, generation);
+        if (meta->error == ENOENT) { // File not found
+            return HTTP_STATUS_NOTFOUND;
+        } else if (meta->error == EACCES) { // We don't have permission to it (not even to stat it)
+            return HTTP_STATUS_FORBIDDEN;
+        } else if (meta->error == ENAMETOOLONG) { // Pathname too long, not sure if to return 400 or 403
+            return HTTP_STATUS_BADREQUEST;
+        } else { // If we get something else for whatever reason
+            return HTTP_STATUS_INTERNALSERVERERROR;
+        }
+    }
+
+    meta->error = 0;
+    meta->content_type = doc_content_type(doc_path);
+    meta_cache_insert(doc_path, meta, generation);
+    return HTTP_STATUS_OK;
+}
+
+// Helper function - switch document to its precompressed sidecar (doc_path + suffix) if one exists and is not older than document
+// On success, previous cache entry is released and doc_meta, cached_doc and generation describe sidecar (sidecar_path is its doc_path)
+// Returns 1 if document was switched to sidecar, 0 otherwise (document is left untouched)
+int use_http_sidecar(const char* doc_path, const char* suffix, char* sidecar_path, doc_meta_t* doc_meta,
+    file_cache_entry_t** cached_doc, unsigned long* generation)
+{
+    doc_meta_t sidecar_meta;
+    file_cache_entry_t* cached_sidecar;
+    unsigned long sidecar_generation = 0;
+
+    if (snprintf(sidecar_path, PATH_MAX, "%s%s", doc_path, suffix) >= PATH_MAX) {
+        return 0;
+    }
+
+    if ((cached_sidecar = file_cache_lookup(sidecar_path)) != NULL) {
+        sidecar_meta.stats = cached_sidecar->stats;
+    } else {
+        sidecar_generation = file_cache_generation();
+        if (resolve_http_document(sidecar_path, &sidecar_meta) != HTTP_STATUS_OK ||
+            strncmp("/_errors/", sidecar_meta.resolved_path, strlen("/_errors/")) == 0) {
+            return 0;
+        }
+    }
+
+    // Sidecar older than document is stale (document changed, sidecar was not regenerated yet)
+    if (!S_ISREG(sidecar_meta.stats.st_mode) || sidecar_meta.stats.st_mtime < doc_meta->stats.st_mtime) {
+        if (cached_sidecar != NULL) {
+            file_cache_release(cached_sidecar);
+        }
+        return 0;
+    }
+
+    if (*cached_doc != NULL) {
+        file_cache_release(*cached_doc);
+    }
+    *cached_doc = cached_sidecar;
+    *generation = sidecar_generation;
+    if (cached_sidecar == NULL) {
+        *doc_meta = sidecar_meta;
+    } else {
+        doc_meta->stats = sidecar_meta.stats;
+    }
+
+    return 1;
+}
+
+// Helper function - turn entity tag into tag of document's encoded variant (coding goes inside quotes, e.g. "2a-3f-5b.0-gzip")
+void http_etag_variant(char* etag, const char* coding)
+{
+    size_t len = strlen(etag);
+
+    if (len >= 2 && etag[len - 1] == '"' && len + strlen(coding) + 1 < HTTP_ETAG_MAX) {
+        snprintf(etag + len - 1, HTTP_ETAG_MAX - len + 1, "-%s\"", coding);
+    }
+}
+
 // Parse raw received bytes into http request struct
 // Returns 0 if parsing was successful, 1 if not then its a "400 Bad Request" because of malformed client message
 // Example request below:
@@ -238,11 +650,219 @@ int parse_http_request(char* message_buf, http_request_t* http_request)
     // Get doc_path from request uri
     parse_doc_path_uri(http_request->doc_path, http_request->uri, PATH_MAX);
 
+    // Persistent connection handling
+    http_request->keep_alive = http_request_keep_alive(http_request);
+
     return 0;
 }
 
-// Send HTTP response based on http_request through socket_id socket
-// Return 0 if sending was successful, 1 if nothing succeeded (in which case you want to close connection)
+// Helper function - reset response object to an empty state (no header, no body)
+// Response version and persistence follow the request (HTTP/1.0 and unparsed requests get HTTP/1.0 and closed connection)
+void init_http_response(http_response_t* http_response, const http_request_t* http_request, http_status_t status)
+{
+    http_response->status = status;
+    if (http_request == NULL || strcmp(HTTP_VERSION_1_0, http_request->version) == 0) {
+        http_response->version = HTTP_VERSION;
+    } else {
+        http_response->version = HTTP_VERSION_1_1;
+    }
+    http_response->keep_alive = (http_request != NULL && http_request->keep_alive && status != HTTP_STATUS_BADREQUEST);
+    http_response->body_len = 0;
+    http_response->iov_count = 0;
+    http_response->iov_index = 0;
+    http_response->body_cache = NULL;
+    http_response->body_map = NULL;
+    http_response->body_data = NULL;
+    http_response->body_fd = -1;
+    http_response->body_offset = 0;
+    http_response->body_remaining = 0;
+    http_response->body_pipe[0] = -1;
+    http_response->body_pipe[1] = -1;
+    http_response->body_piped = 0;
+    http_response->multipart = NULL;
+    http_response->body_buffer = NULL;
+    http_response->error_pages = NULL;
+}
+
+// Helper function - append in-memory segment to response
+void add_http_response_iov(http_response_t* http_response, const char* data, size_t len)
+{
+    http_response->iov[http_response->iov_count].iov_base = (void*)data;
+    http_response->iov[http_response->iov_count].iov_len = len;
+    http_response->iov_count++;
+}
+
+// Helper function - prepare "304 Not Modified" response (header only, carries validators of unchanged document)
+// vary is "Vary" header line (or empty string) of full response
+// Returns 0 if response was prepared, 1 if header didn't fit
+int prepare_http_not_modified_response(http_response_t* http_response, const char* last_modified, const char* etag, const char* vary)
+{
+    char str_date[HTTP_DATE_MAX];
+    size_t header_len;
+
+    http_response->status = HTTP_STATUS_NOTMODIFIED;
+    http_date_now(str_date);
+
+    header_len = snprintf(http_response->header, HTTP_RESPONSE_HEADER_MAX,
+        "%s %d %s\r\n"
+        "Date: %s\r\n"
+        "Last-Modified: %s\r\n"
+        "ETag: %s\r\n"
+        "%s"
+        "Server: %s\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        http_response->version, HTTP_STATUS_NOTMODIFIED, http_status_str(HTTP_STATUS_NOTMODIFIED),
+        str_date,
+        last_modified,
+        etag,
+        vary,
+        HTTP_HEADER_SERVER,
+        http_response->keep_alive ? "keep-alive" : "close");
+
+    if (header_len >= HTTP_RESPONSE_HEADER_MAX) {
+        return 1;
+    }
+
+    add_http_response_iov(http_response, http_response->header, header_len);
+    return 0;
+}
+
+// Helper function - prepare "416 Range Not Satisfiable" response (header only, tells client actual document size)
+// Returns 0 if response was prepared, 1 if header didn't fit
+int prepare_http_range_not_satisfiable_response(http_response_t* http_response, off_t size)
+{
+    char str_date[HTTP_DATE_MAX];
+    size_t header_len;
+
+    http_response->status = HTTP_STATUS_RANGENOTSATISFIABLE;
+    http_date_now(str_date);
+
+    header_len = snprintf(http_response->header, HTTP_RESPONSE_HEADER_MAX,
+        "%s %d %s\r\n"
+        "Date: %s\r\n"
+        "Content-Range: bytes */%ld\r\n"
+        "Content-Length: 0\r\n"
+        "Server: %s\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        http_response->version, HTTP_STATUS_RANGENOTSATISFIABLE, http_status_str(HTTP_STATUS_RANGENOTSATISFIABLE),
+        str_date,
+        size,
+        HTTP_HEADER_SERVER,
+        http_response->keep_alive ? "keep-alive" : "close");
+
+    if (header_len >= HTTP_RESPONSE_HEADER_MAX) {
+        return 1;
+    }
+
+    add_http_response_iov(http_response, http_response->header, header_len);
+    return 0;
+}
+
+// Boundaries of multipart/byteranges bodies are unique per response
+static atomic_ulong multipart_counter = 0;
+
+// Helper function - format header of index-th multipart/byteranges part (index == count - closing boundary) into out
+// Returns formatted length
+size_t format_http_range_part(const http_multipart_t* multipart, int index, char* out)
+{
+    if (index == multipart->count) {
+        return snprintf(out, HTTP_PART_HEADER_MAX, "\r\n--%s--\r\n", multipart->boundary);
+    }
+
+    return snprintf(out, HTTP_PART_HEADER_MAX, "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+        (index == 0) ? "" : "\r\n", multipart->boundary, multipart->content_type,
+        multipart->ranges[index].first, multipart->ranges[index].last, multipart->size);
+}
+
+// Helper function - create multipart/byteranges state for ranges of document
+// Returns multipart state (sets body_len to whole multipart body length), NULL on allocation failure
+http_multipart_t* create_http_multipart(const http_byte_range_t* ranges, int count, const char* content_type, off_t size, off_t* body_len)
+{
+    http_multipart_t* multipart;
+    int i;
+
+    if ((multipart = (http_multipart_t*)malloc(sizeof(http_multipart_t))) == NULL) {
+        return NULL;
+    }
+    snprintf(multipart->boundary, sizeof(multipart->boundary), "bth-byteranges-%lx-%lx",
+        (unsigned long)time(0), atomic_fetch_add(&multipart_counter, 1));
+    multipart->content_type = content_type;
+    multipart->size = size;
+    memcpy(multipart->ranges, ranges, count * sizeof(http_byte_range_t));
+    multipart->count = count;
+    multipart->index = 0;
+
+    *body_len = 0;
+    for (i = 0; i <= count; i++) {
+        *body_len += format_http_range_part(multipart, i, multipart->part_header);
+        if (i < count) {
+            *body_len += ranges[i].last - ranges[i].first + 1;
+        }
+    }
+
+    return multipart;
+}
+
+// Helper function - append next multipart/byteranges part to response: part header plus cached document slice or file range
+void load_http_range_part(http_response_t* http_response)
+{
+    http_multipart_t* multipart = http_response->multipart;
+    int index = multipart->index++;
+    const http_byte_range_t* range = &multipart->ranges[index];
+
+    add_http_response_iov(http_response, multipart->part_header, format_http_range_part(multipart, index, multipart->part_header));
+    if (index == multipart->count) {
+        return;
+    }
+
+    if (http_response->body_data != NULL) {
+        add_http_response_iov(http_response, http_response->body_data + range->first, range->last - range->first + 1);
+    } else {
+        http_response->body_offset = range->first;
+        http_response->body_remaining = range->last - range->first + 1;
+    }
+}
+
+// Load next multipart/byteranges part into response once its current part is fully sent
+int next_http_response_part(http_response_t* http_response)
+{
+    http_multipart_t* multipart = http_response->multipart;
+
+    if (multipart == NULL || multipart->index > multipart->count || http_response->iov_index < http_response->iov_count ||
+        http_response->body_remaining > 0 || http_response->body_piped > 0) {
+        return 0;
+    }
+
+    http_response->iov_count = 0;
+    http_response->iov_index = 0;
+    load_http_range_part(http_response);
+    return 1;
+}
+
+// Helper function - open document file and make sure it is the file version stats describe (they could come from stale metadata)
+// Returns file descriptor, -1 if file can't be opened (errno is ESTALE if file changed since stats were taken)
+int open_http_document(const char* resolved_path, const struct stat* stats)
+{
+    struct stat fd_stats;
+    int fd;
+
+    if ((fd = open(resolved_path, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if (fstat(fd, &fd_stats) != 0 || !map_cache_same_file(&fd_stats, stats)) {
+        close(fd);
+        errno = ESTALE;
+        return -1;
+    }
+
+    return fd;
+}
+
+// Helper function - prepare HTTP response based on http_request, document whose file differs from its (cached) metadata
+// is resolved again up to retries times
+// Return 0 if response was prepared, 1 if nothing succeeded (in which case you want to close connection)
 // Example response below:
 /*
 HTTP/1.0 200 OK\r\n                            <--- <HTTP version> <SP> <Status code> <SP> <Status name/description> <CRLF>
@@ -250,250 +870,792 @@ Date: Wed, 10 Oct 2018 18:39:41 GMT
 Content-Type: text/html
 Content-Length: 1087
 Last-Modified: Wed, 10 Oct 2018 15:26:09 GMT
+ETag: "2a1c3f-43f-5bbe1a41.1d0c4b8"
+Accept-Ranges: bytes
 Server: BTH students
+Connection: close                              <--- "keep-alive" if client wants persistent connection (HTTP/1.1 default)
 \r\n                                           <--- Header/Body divider
 <html>                                         <--- Body content start
   <body>
     ...
   </body>
-</html>                                        <--- We close connection when body is fully sent (body being contents of some document/resource)
+</html>                                        <--- We close connection when body is fully sent, unless it is persistent
 */
-int send_http_response(int socket_id, const config_t* conf, const http_request_t* http_request)
+int prepare_http_document_response(const config_t* conf, const http_request_t* http_request, http_response_t* http_response, int retries)
 {
     int request_get = 0; // 0 - HEAD, 1 - GET
     http_status_t status = HTTP_STATUS_OK;
-    time_t time_now;
-    char str_date[100];
-    char str_last_modified[100];
-    char response_msg[CONF_REQ_BUFSIZE];
-    char socket_buf[CONF_SOCK_BUFSIZE];
-    char resolved_path[PATH_MAX];
-    struct stat doc_stats;
-    struct tm tm_date;
-    struct tm tm_last_modified;
-    int read_bytes, write_bytes; // For write/read return values
-    int fd; // For converting FILE* pointer to int fd
-    FILE* doc_file;
+    char str_date[HTTP_DATE_MAX];
+    char str_last_modified[HTTP_DATE_MAX];
+    char str_etag[HTTP_ETAG_MAX];
+    char str_content_range[HTTP_PART_HEADER_MAX] = "";
+    char str_content_encoding[64] = "";
+    const char* str_vary = "";
+    char str_multipart_type[HTTP_PART_HEADER_MAX];
+    doc_meta_t doc_meta; // Resolved document (filled only when document is not served from document cache)
+    char sidecar_path[PATH_MAX];
+    const char* doc_path = http_request->doc_path; // Document (or its sidecar) file which is served
+    struct stat* doc_stats = &doc_meta.stats;
+    int fd = -1;
+    const char* content_type;
+    const char* accept_value;
+    size_t accept_len;
+    const char* encoding = NULL; // Content coding of served document (NULL - identity)
+    int gzip_variant = 0; // 1 - serving on-the-fly gzip variant of cached document
+    const char* body_data = NULL;
+    off_t body_size; // Length of served representation
+    int i;
+    const char* range_value;
+    size_t range_len;
+    http_byte_range_t ranges[HTTP_RANGES_MAX];
+    int range_count = 0;
+    off_t content_length;
+    file_cache_entry_t* cached_doc;
+    unsigned long cache_generation = 0;
+    size_t header_len;
+
+    init_http_response(http_response, http_request, status);
 
     // Check if version is correct (allowing: 1.0, 1.1 and 2.0), if not - send 400 - Bad Request
     if (strcmp(HTTP_VERSION_1_0, http_request->version) != 0 && 
         strcmp(HTTP_VERSION_1_1, http_request->version) != 0 &&
         strcmp(HTTP_VERSION_2_0, http_request->version) != 0) {
-        return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_BADREQUEST);
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_BADREQUEST, http_response);
     }
 
     // Check if request type is implemented and determine whether its a get request
     if (strcmp(HTTP_METHOD_GET, http_request->method) == 0) {
         request_get = 1;
     } else if (strcmp(HTTP_METHOD_HEAD, http_request->method) != 0) {
-        return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_NOTIMPLEMENTED);
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_NOTIMPLEMENTED, http_response);
     }
     
-    // Get realpath of doc_path_full
-    if (realpath(http_request->doc_path, resolved_path) == NULL) {
-        if (errno == ENOENT) {
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_NOTFOUND);
-        } else if (errno == EACCES) {
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_FORBIDDEN);
-        } else {
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_BADREQUEST);
+    // Cached documents are served without touching the filesystem
+    if ((cached_doc = file_cache_lookup(http_request->doc_path)) != NULL) {
+        doc_meta.stats = cached_doc->stats;
+        content_type = cached_doc->content_type;
+    } else {
+        cache_generation = file_cache_generation(); // Taken before stat, so changes during reading keep document out of cache
+
+        // Resolve document (through metadata cache), directly accessing _errors folder is forbidden
+        if ((status = resolve_http_document(http_request->doc_path, &doc_meta)) != HTTP_STATUS_OK) {
+            return prepare_http_error_response(conf, http_request, status, http_response);
+        }
+        if (strncmp("/_errors/", doc_meta.resolved_path, strlen("/_errors/")) == 0) {
+            return prepare_http_error_response(conf, http_request, HTTP_STATUS_FORBIDDEN, http_response);
+        }
+
+        content_type = doc_meta.content_type;
+    }
+
+    // Compressible documents are negotiated with Accept-Encoding: fresh precompressed sidecar file (br preferred over gzip),
+    // otherwise gzip variant of cached document (compressed once per file version)
+    if (http_content_compressible(content_type)) {
+        str_vary = "Vary: Accept-Encoding\r\n";
+        accept_value = http_header_value(http_request, "Accept-Encoding", &accept_len);
+        for (i = 0; accept_value != NULL && encoding == NULL && i < (int)(sizeof(http_sidecars) / sizeof(http_sidecars[0])); i++) {
+            if (http_accepts_encoding(accept_value, accept_len, http_sidecars[i].coding) &&
+                use_http_sidecar(http_request->doc_path, http_sidecars[i].suffix, sidecar_path, &doc_meta, &cached_doc, &cache_generation)) {
+                encoding = http_sidecars[i].coding;
+                doc_path = sidecar_path;
+            }
+        }
+
+        if (encoding == NULL && accept_value != NULL && conf->gzip_level > 0 && file_cache_accepts(doc_stats->st_size) &&
+            http_accepts_encoding(accept_value, accept_len, "gzip")) {
+            // Compressed variant lives in document's cache entry, so document gets cached first
+            if (cached_doc == NULL && (fd = open_http_document(doc_meta.resolved_path, doc_stats)) >= 0) {
+                cached_doc = file_cache_insert(doc_path, doc_meta.resolved_path, fd, doc_stats, content_type, cache_generation);
+                close(fd);
+            }
+            if (cached_doc != NULL && file_cache_gzip(cached_doc, conf->gzip_level) == 0) {
+                encoding = "gzip";
+                gzip_variant = 1;
+                body_data = cached_doc->gzip_data;
+                body_size = cached_doc->gzip_len;
+            }
         }
     }
+    if (body_data == NULL) {
+        body_size = doc_stats->st_size;
+    }
 
-    // Simple Forbidden demonstration (we wont allow users to directly access _errors folder)
-    if (strncmp("/_errors/", resolved_path, strlen("/_errors/")) == 0) {
-        return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_FORBIDDEN);
+    // Validators (formatted once per cached document, encoded variants get their own entity tag)
+    if (cached_doc != NULL) {
+        memcpy(str_last_modified, cached_doc->last_modified, HTTP_DATE_MAX);
+        memcpy(str_etag, cached_doc->etag, HTTP_ETAG_MAX);
+    } else {
+        format_http_date(doc_stats->st_mtime, str_last_modified);
+        format_http_etag(doc_stats, str_etag);
+    }
+    if (gzip_variant) {
+        http_etag_variant(str_etag, "gzip");
     }
 
-    // Try to stat the file
-    if (stat(resolved_path, &doc_stats) != 0) {
-        if (errno == ENOENT) { // File not found
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_NOTFOUND);
-        } else if (errno == EACCES) { // We don't have permission to it (not even to stat it)
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_FORBIDDEN);
-        } else if (errno == ENAMETOOLONG) { // Pathname too long, not sure if to return 400 or 403
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_BADREQUEST);
-        } else { // If we get something else for whatever reason
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_INTERNALSERVERERROR);
+    // Revalidation of unchanged document is answered with header only, document file is never opened
+    if (http_request_not_modified(http_request, str_etag, doc_stats->st_mtime)) {
+        if (cached_doc != NULL) {
+            file_cache_release(cached_doc);
         }
+        return prepare_http_not_modified_response(http_response, str_last_modified, str_etag, str_vary);
     }
-    
-    // Handle dates
-    time_now = time(0);
-    if (gmtime_r(&time_now, &tm_date) == NULL) { // Convert current time (Date header) to GMT timestamp
-        return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_INTERNALSERVERERROR);
+
+    // Byte ranges apply to GET only (and only while If-Range validator still matches, otherwise whole new document is sent)
+    if (request_get && (range_value = http_header_value(http_request, "Range", &range_len)) != NULL &&
+        http_if_range_matches(http_request, str_etag, doc_stats->st_mtime)) {
+        range_count = parse_http_ranges(range_value, range_len, body_size, ranges);
+        if (range_count == 0) {
+            if (cached_doc != NULL) {
+                file_cache_release(cached_doc);
+            }
+            return prepare_http_range_not_satisfiable_response(http_response, body_size);
+        }
+    }
+
+    // If request is GET, then response carries Header AND doc_file contents (from cache if possible)
+    // Else request is HEAD, therefore, response is only Header
+    if (request_get) {
+        // Mid-size documents which are already mapped are sent from shared mapping without even opening the file
+        if (cached_doc == NULL && map_cache_accepts(body_size)) {
+            http_response->body_map = map_cache_lookup(doc_meta.resolved_path, doc_stats);
+        }
+        if (cached_doc == NULL && http_response->body_map == NULL) {
+            if ((fd = open_http_document(doc_meta.resolved_path, doc_stats)) < 0) {
+                // File changed before its change notification dropped cached metadata, response header would describe old version
+                if (errno == ESTALE && retries > 0) {
+                    meta_cache_forget(doc_path);
+                    return prepare_http_document_response(conf, http_request, http_response, retries - 1);
+                }
+                // Since file errors should be cought by stat(...), this is unexpected, therefore 500 error
+                return prepare_http_error_response(conf, http_request, HTTP_STATUS_INTERNALSERVERERROR, http_response);
+            }
+
+            // Small documents are read into cache once, mid-size ones get mapped once and shared by all requests,
+            // big ones (or when caching/mapping fails) are streamed from file
+            // (sidecar is cached under its own name, with its own Content-Type for direct requests of it)
+            if ((cached_doc = file_cache_insert(doc_path, doc_meta.resolved_path, fd, doc_stats, doc_meta.content_type, cache_generation)) != NULL ||
+                (http_response->body_map = map_cache_insert(doc_meta.resolved_path, fd, doc_stats)) != NULL) {
+                close(fd);
+            } else {
+                http_response->body_fd = fd;
+                http_response->body_remaining = body_size;
+            }
+        }
+
+        http_response->body_cache = cached_doc;
+        if (body_data != NULL) {
+            http_response->body_data = body_data;
+        } else if (cached_doc != NULL) {
+            http_response->body_data = cached_doc->data;
+        } else if (http_response->body_map != NULL) {
+            http_response->body_data = http_response->body_map->data;
+        }
+        http_response->body_len = body_size;
+    }
+
+    // Ranges are served from their offsets, skipped document bytes are never read
+    content_length = body_size;
+    if (range_count == 1) {
+        status = HTTP_STATUS_PARTIALCONTENT;
+        content_length = ranges[0].last - ranges[0].first + 1;
+        http_response->body_offset = ranges[0].first;
+        http_response->body_remaining = (http_response->body_fd >= 0) ? content_length : 0;
+        http_response->body_len = content_length;
+        snprintf(str_content_range, HTTP_PART_HEADER_MAX, "Content-Range: bytes %ld-%ld/%ld\r\n", ranges[0].first, ranges[0].last, body_size);
+    } else if (range_count > 1) {
+        status = HTTP_STATUS_PARTIALCONTENT;
+        if ((http_response->multipart = create_http_multipart(ranges, range_count, content_type, body_size, &content_length)) == NULL) {
+            release_http_response(http_response);
+            return prepare_http_error_response(conf, http_request, HTTP_STATUS_INTERNALSERVERERROR, http_response);
+        }
+        http_response->body_remaining = 0; // File ranges are loaded part by part
+        http_response->body_len = content_length;
+        snprintf(str_multipart_type, HTTP_PART_HEADER_MAX, "multipart/byteranges; boundary=%s", http_response->multipart->boundary);
+        content_type = str_multipart_type;
     }
-    if (gmtime_r(&doc_stats.st_ctime, &tm_last_modified) == NULL) { // Convert Last-Modified to GMT timestamp
-        return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_INTERNALSERVERERROR);
+    http_response->status = status;
+    if (encoding != NULL) {
+        snprintf(str_content_encoding, sizeof(str_content_encoding), "Content-Encoding: %s\r\n", encoding);
     }
 
-    // Format dates
-    strftime(str_date, 100, HTTP_DATETIME_FORMAT, &tm_date);
-    strftime(str_last_modified, 100, HTTP_DATETIME_FORMAT, &tm_last_modified);
+    // Date is shared process-wide clock
+    http_date_now(str_date);
+    if (!request_get && cached_doc != NULL) {
+        file_cache_release(cached_doc);
+    }
 
     // Prepare header of response message
-    snprintf(response_msg, CONF_REQ_BUFSIZE, 
+    header_len = snprintf(http_response->header, HTTP_RESPONSE_HEADER_MAX, 
         "%s %d %s\r\n"
         "Date: %s\r\n"
         "Content-Type: %s\r\n"
+        "%s"
         "Content-Length: %ld\r\n"
+        "%s"
         "Last-Modified: %s\r\n"
+        "ETag: %s\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s"
         "Server: %s\r\n"
+        "Connection: %s\r\n"
         "\r\n",
-        HTTP_VERSION, status, http_status_str(status),
+        http_response->version, status, http_status_str(status),
         str_date,
-        doc_content_type(http_request->doc_path),
-        doc_stats.st_size,
+        content_type,
+        str_content_encoding,
+        content_length,
+        str_content_range,
         str_last_modified,
-        HTTP_HEADER_SERVER);
+        str_etag,
+        str_vary,
+        HTTP_HEADER_SERVER,
+        http_response->keep_alive ? "keep-alive" : "close");
 
+    if (header_len >= HTTP_RESPONSE_HEADER_MAX) { // Header got truncated
+        release_http_response(http_response);
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_INTERNALSERVERERROR, http_response);
+    }
 
-    // If request is GET, then transmit Header AND doc_file contents
-    // Else request is HEAD, therefore, transfer only Header
-    if (request_get) {      
-        if ((doc_file = fopen(resolved_path, "r")) == NULL) { // Since file errors should be cought by stat(...), this is unexpected, therefore 500 error
-            return send_http_error_response(socket_id, conf, http_request, HTTP_STATUS_INTERNALSERVERERROR);
-        }
-        fd = fileno(doc_file);
+    // Header and cached or mapped document body (or first multipart/byteranges part) go out together
+    add_http_response_iov(http_response, http_response->header, header_len);
+    if (http_response->multipart != NULL) {
+        load_http_range_part(http_response);
+    } else if (http_response->body_data != NULL) {
+        add_http_response_iov(http_response, http_response->body_data + http_response->body_offset, content_length);
+    }
 
-        // Transmit response header part
-        write_bytes = write(socket_id, response_msg, strlen(response_msg));
-        if (write_bytes < 0) { // Something wrong with socket during header write
-            return 1;
-        }        
+    return 0;
+}
 
-        // Transmit body/file part
-        while((read_bytes = read(fd, socket_buf, CONF_SOCK_BUFSIZE)) > 0) {
-            write_bytes = write(socket_id, socket_buf, read_bytes);
+// Prepare HTTP response based on http_request (falls back to error responses on failures)
+// Return 0 if response was prepared, 1 if nothing succeeded (in which case you want to close connection)
+int prepare_http_response(const config_t* conf, const http_request_t* http_request, http_response_t* http_response)
+{
+    return prepare_http_document_response(conf, http_request, http_response, 1);
+}
 
-            if (write_bytes < 0) { // Something wrong with socket during file streaming
-                return 1;
-            }
-        }        
-    
-        fclose(doc_file);
+// Currently used pre-rendered error pages (replaced as a whole on reload)
+static pthread_mutex_t error_pages_lock = PTHREAD_MUTEX_INITIALIZER;
+static http_error_pages_t* error_pages = NULL; // Protected by error pages lock
 
-        if (read_bytes < 0) { // Something wrong with file during reading
-            return 1;
+// Helper function - read whole error file into newly allocated buffer
+// Returns buffer (sets len), NULL if file can't be read
+char* read_error_file(const char* err_path, size_t* len)
+{
+    struct stat errf_stats;
+    char* buf;
+    size_t read_total = 0;
+    ssize_t read_bytes;
+    int fd;
+
+    if ((fd = open(err_path, O_RDONLY)) < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &errf_stats) != 0 || (buf = (char*)malloc(errf_stats.st_size + 1)) == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    while (read_total < (size_t)errf_stats.st_size) {
+        read_bytes = read(fd, buf + read_total, errf_stats.st_size - read_total);
+        if (read_bytes < 0 && errno == EINTR) { continue; }
+        if (read_bytes <= 0) { break; }
+        read_total += read_bytes;
+    }
+    close(fd);
+
+    *len = read_total;
+    return buf;
+}
+
+// Helper function - allocate formatted string
+// Returns string (sets len), NULL on allocation failure
+char* alloc_printf(size_t* len, const char* format, ...)
+{
+    va_list args;
+    char* str;
+    int str_len;
+
+    va_start(args, format);
+    str_len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (str_len < 0 || (str = (char*)malloc(str_len + 1)) == NULL) {
+        return NULL;
+    }
+
+    va_start(args, format);
+    vsnprintf(str, str_len + 1, format, args);
+    va_end(args);
+
+    *len = str_len;
+    return str;
+}
+
+// Helper function - pre-render error response for status, body from /_errors/<status>.html (or hardcoded format)
+// Return 0 on success, 1 on allocation failure
+int render_http_error_page(http_error_page_t* page, http_status_t status)
+{
+    char err_path[PATH_MAX];
+    char simple_body[512];
+    char* body;
+    size_t body_len;
+    int keep_alive;
+
+    page->status = status;
+
+    // Get correct error file path
+    snprintf(err_path, PATH_MAX, "/_errors/%d.html", status);
+    if ((body = read_error_file(err_path, &body_len)) == NULL) {
+        log_msg(LOG_LEVEL_WARN, "[load_http_error_pages] Status file path \"%s\" error: %s, using hardcoded ...", err_path, strerror(errno));
+        snprintf(simple_body, sizeof(simple_body), HTTP_STATUS_HTML_SIMPLE, status, http_status_str(status), status, http_status_str(status));
+        body = strdup(simple_body);
+        body_len = strlen(simple_body);
+    }
+    if (body == NULL) {
+        return 1;
+    }
+
+    // Example pre-rendered parts (Date value goes between them):
+    /*
+    HTTP/1.1 404 Not Found\r\n          <--- head (per response version)
+    Date: 
+    Thu, 1 Jan 1970 00:00:00 GMT        <--- per response
+    \r\n                                <--- tail (per connection persistence)
+    Content-Type: text/html\r\n
+    Content-Length: 269\r\n
+    Server: BTH students\r\n
+    Connection: close\r\n
+    \r\n
+    <html>...                           <--- error file contents
+    */
+    page->head[0] = alloc_printf(&page->head_len[0], "%s %d %s\r\nDate: ", HTTP_VERSION_1_0, status, http_status_str(status));
+    page->head[1] = alloc_printf(&page->head_len[1], "%s %d %s\r\nDate: ", HTTP_VERSION_1_1, status, http_status_str(status));
+    for (keep_alive = 0; keep_alive <= 1; keep_alive++) {
+        page->tail[keep_alive] = alloc_printf(&page->tail_len[keep_alive],
+            "\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %ld\r\n"
+            "Server: %s\r\n"
+            "Connection: %s\r\n"
+            "\r\n"
+            "%.*s",
+            CONTENT_TEXT_HTML,
+            (long)body_len,
+            HTTP_HEADER_SERVER,
+            keep_alive ? "keep-alive" : "close",
+            (int)body_len, body);
+    }
+    free(body);
+    page->body_len = body_len;
+
+    return (page->head[0] && page->head[1] && page->tail[0] && page->tail[1]) ? 0 : 1;
+}
+
+// Helper function - free error page set with all its rendered parts (parts not rendered yet are NULL)
+void free_http_error_pages(http_error_pages_t* pages)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < HTTP_ERROR_STATUS_COUNT; i++) {
+        for (j = 0; j < 2; j++) {
+            free(pages->pages[i].head[j]);
+            free(pages->pages[i].tail[j]);
         }
-    } else {
-        write_bytes = write(socket_id, response_msg, strlen(response_msg));
-        if (write_bytes < 0) { // Something wrong with socket during header write
+    }
+    free(pages);
+}
+
+// Helper function - drop reference to error page set (error pages lock must be held), last one frees it
+void put_http_error_pages(http_error_pages_t* pages)
+{
+    if (--pages->refs == 0) {
+        free_http_error_pages(pages);
+    }
+}
+
+// Load and pre-render error responses for all HTTP_ERROR_STATUSES
+int load_http_error_pages()
+{
+    const http_status_t statuses[HTTP_ERROR_STATUS_COUNT] = HTTP_ERROR_STATUSES;
+    http_error_pages_t* pages;
+    http_error_pages_t* old;
+    int i;
+
+    if ((pages = (http_error_pages_t*)calloc(1, sizeof(http_error_pages_t))) == NULL) {
+        return 1;
+    }
+
+    for (i = 0; i < HTTP_ERROR_STATUS_COUNT; i++) {
+        if (render_http_error_page(&pages->pages[i], statuses[i]) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[load_http_error_pages] Failed to pre-render %d error response", statuses[i]);
+            free_http_error_pages(pages);
             return 1;
         }
     }
+    pages->refs = 1;
 
-    printf("[INFO] [socket: %d] Client: \"%s %s %s\" => Server: \"%s %d %s\"\n", 
-        socket_id, 
-        http_request->method, http_request->uri, http_request->version,
-        HTTP_VERSION, status, http_status_str(status));
+    // Publish new page set, requests pick it up with their next error response,
+    // previous one is freed now or once last response pointing into it is released
+    pthread_mutex_lock(&error_pages_lock);
+    old = error_pages;
+    error_pages = pages;
+    if (old != NULL) {
+        put_http_error_pages(old);
+    }
+    pthread_mutex_unlock(&error_pages_lock);
+
+    log_msg(LOG_LEVEL_INFO, "[load_http_error_pages] Loaded %d error responses", HTTP_ERROR_STATUS_COUNT);
     return 0;
 }
 
-// Send formatted status error response based on status code
-int send_http_error_response(int socket_id, const config_t* conf, const http_request_t* http_request, http_status_t status)
+// Prepare pre-rendered status error response based on status code
+int prepare_http_error_response(const config_t* conf, const http_request_t* http_request, http_status_t status, http_response_t* http_response)
 {
-    int use_hardcoded = 0; // 0 - Use .html file for error, 1 - Use hardcoded format
-    time_t time_now;
-    char str_date[100];
-    char response_msg[CONF_REQ_BUFSIZE];
-    char socket_buf[CONF_SOCK_BUFSIZE];
-    char err_path[PATH_MAX];
-    struct stat errf_stats;
-    struct tm tm_date;
-    long int content_length;
-    int read_bytes, write_bytes; // For write/read return values
-    int fd; // For converting FILE* pointer to int fd
-    FILE* err_file;
-    
-    // Get correct error file path
-    snprintf(err_path, PATH_MAX, "/_errors/%d.html", status);
+    http_error_pages_t* pages;
+    http_error_page_t* page = NULL;
+    size_t date_len;
+    int version_1_1;
+    int i;
 
-    // Handle & format dates
-    time_now = time(0);
-    if (gmtime_r(&time_now, &tm_date) == NULL) { // Convert current time (Date header) to GMT timestamp
+    // Response keeps page set it points into alive until it is released
+    pthread_mutex_lock(&error_pages_lock);
+    pages = error_pages;
+    for (i = 0; pages != NULL && i < HTTP_ERROR_STATUS_COUNT; i++) {
+        if (pages->pages[i].status == status) {
+            page = &pages->pages[i];
+            pages->refs++;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&error_pages_lock);
+    if (page == NULL) { // Error pages not loaded or status without error page
         return 1;
     }
-    strftime(str_date, 100, HTTP_DATETIME_FORMAT, &tm_date);    
 
-    // Try to stat the error file
-    if (stat(err_path, &errf_stats) != 0) {
-        printf("[WARN] [socket: %d] [send_http_error_response] Status file path \"%s\" error: %s, using hardcoded ...\n", socket_id, err_path, strerror(errno));
+    init_http_response(http_response, http_request, status);
+    http_response->error_pages = pages;
+    http_response->body_len = page->body_len;
 
-        use_hardcoded = 1;
-        snprintf(socket_buf, CONF_SOCK_BUFSIZE, HTTP_STATUS_HTML_SIMPLE, status, http_status_str(status), status, http_status_str(status));
-        content_length = strlen(socket_buf);
-    } else {
-        content_length = errf_stats.st_size;
+    // Date comes from shared once-per-second clock
+    date_len = http_date_now(http_response->date);
+
+    // Whole response goes out in a single gathered write
+    version_1_1 = (strcmp(HTTP_VERSION_1_1, http_response->version) == 0);
+    add_http_response_iov(http_response, page->head[version_1_1], page->head_len[version_1_1]);
+    add_http_response_iov(http_response, http_response->date, date_len);
+    add_http_response_iov(http_response, page->tail[http_response->keep_alive], page->tail_len[http_response->keep_alive]);
+
+    return 0;
+}
+
+// Check if request asks for metrics page
+int is_http_metrics_request(const config_t* conf, const http_request_t* http_request)
+{
+    return conf->metrics_path[0] != '\0' && strcmp(conf->metrics_path, http_request->doc_path) == 0;
+}
+
+// Prepare response with current metrics in Prometheus text format
+int prepare_http_metrics_response(const config_t* conf, const http_request_t* http_request, int local_client, http_response_t* http_response)
+{
+    char str_date[HTTP_DATE_MAX];
+    size_t header_len;
+    size_t body_len;
+
+    if (!local_client) { // Metrics reveal server internals, so reserved path is forbidden for everyone else
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_FORBIDDEN, http_response);
+    }
+    if (strcmp(HTTP_METHOD_GET, http_request->method) != 0 && strcmp(HTTP_METHOD_HEAD, http_request->method) != 0) {
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_NOTIMPLEMENTED, http_response);
     }
 
-    // Prepare header of response message
-    snprintf(response_msg, CONF_REQ_BUFSIZE, 
+    init_http_response(http_response, http_request, HTTP_STATUS_OK);
+    if ((http_response->body_buffer = (char*)malloc(METRICS_RENDER_MAX)) == NULL ||
+        (body_len = metrics_render(http_response->body_buffer, METRICS_RENDER_MAX)) >= METRICS_RENDER_MAX) {
+        release_http_response(http_response);
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_INTERNALSERVERERROR, http_response);
+    }
+    http_date_now(str_date);
+
+    header_len = snprintf(http_response->header, HTTP_RESPONSE_HEADER_MAX,
         "%s %d %s\r\n"
         "Date: %s\r\n"
-        "Content-Type: %s\r\n"
-        "Content-Length: %ld\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\n"
+        "Cache-Control: no-store\r\n"
         "Server: %s\r\n"
+        "Connection: %s\r\n"
         "\r\n",
-        HTTP_VERSION, status, http_status_str(status),
+        http_response->version, HTTP_STATUS_OK, http_status_str(HTTP_STATUS_OK),
         str_date,
-        CONTENT_TEXT_HTML,
-        content_length,
-        HTTP_HEADER_SERVER);
+        body_len,
+        HTTP_HEADER_SERVER,
+        http_response->keep_alive ? "keep-alive" : "close");
 
-    // If we don't use hardcoded error status response, send header AND error status file contents
-    // Else use formatted, hardcoded HTML string for error status content sending
-    if (!use_hardcoded) {
-        // Since file errors should be cought by stat(...), this is unexpected, therefore no other options than to close connection
-        if ((err_file = fopen(err_path, "r")) == NULL) { 
-            return 1;
+    if (header_len >= HTTP_RESPONSE_HEADER_MAX) {
+        release_http_response(http_response);
+        return prepare_http_error_response(conf, http_request, HTTP_STATUS_INTERNALSERVERERROR, http_response);
+    }
+
+    add_http_response_iov(http_response, http_response->header, header_len);
+    if (strcmp(HTTP_METHOD_GET, http_request->method) == 0) {
+        http_response->body_len = body_len;
+        add_http_response_iov(http_response, http_response->body_buffer, body_len);
+    }
+
+    return 0;
+}
+
+// Gather unsent in-memory segments of responses (starting with first one) into batch
+int gather_http_responses(const http_response_t* http_responses, int count, struct iovec* batch, int batch_max)
+{
+    const http_response_t* http_response;
+    int batch_len = 0;
+    int i, j;
+
+    for (i = 0; i < count && batch_len + HTTP_RESPONSE_IOV_MAX <= batch_max; i++) {
+        http_response = &http_responses[i];
+        for (j = http_response->iov_index; j < http_response->iov_count; j++) {
+            batch[batch_len++] = http_response->iov[j];
+        }
+        if (http_response->body_fd >= 0 || http_response->multipart != NULL) {
+            break;
         }
-        fd = fileno(err_file);
+    }
 
-        // Transmit response header part
-        write_bytes = write(socket_id, response_msg, strlen(response_msg));
-        if (write_bytes < 0) { // Something wrong with socket during header write
-            return 1;
-        }        
+    return batch_len;
+}
 
-        // Transmit body/file part
-        while((read_bytes = read(fd, socket_buf, CONF_SOCK_BUFSIZE)) > 0) {
-            write_bytes = write(socket_id, socket_buf, read_bytes);
+// Check if gathered segments are followed by more bytes of their last response
+int http_responses_continue(const http_response_t* http_responses, int count)
+{
+    const http_response_t* http_response;
+    int i;
 
-            if (write_bytes < 0) { // Something wrong with socket during file streaming
-                return 1;
+    // Gathering stops at first response with file body or multipart/byteranges parts, its remaining bytes follow right away
+    for (i = 0; i < count; i++) {
+        http_response = &http_responses[i];
+        if (http_response->body_fd >= 0 || http_response->multipart != NULL) {
+            return (http_response->body_fd >= 0 && (http_response->body_remaining > 0 || http_response->body_piped > 0)) ||
+                (http_response->multipart != NULL && http_response->multipart->index <= http_response->multipart->count);
+        }
+    }
+
+    return 0;
+}
+
+// Account sent_bytes of gathered in-memory segments
+void advance_http_responses(http_response_t* http_responses, int count, size_t sent_bytes)
+{
+    http_response_t* http_response;
+    struct iovec* iov;
+    int i;
+
+    // Skip fully sent segments, advance partially sent one
+    for (i = 0; i < count && sent_bytes > 0; i++) {
+        http_response = &http_responses[i];
+        while (http_response->iov_index < http_response->iov_count) {
+            iov = &http_response->iov[http_response->iov_index];
+            if (sent_bytes < iov->iov_len) {
+                iov->iov_base = (char*)iov->iov_base + sent_bytes;
+                iov->iov_len -= sent_bytes;
+                return;
             }
-        }        
-    
-        fclose(err_file);
+            sent_bytes -= iov->iov_len;
+            http_response->iov_index++;
+        }
+    }
+}
 
-        if (read_bytes < 0) { // Something wrong with file during reading
-            return 1;
+// Check if response is fully sent (in-memory segments and file body)
+int http_response_sent(const http_response_t* http_response)
+{
+    return http_response->iov_index == http_response->iov_count &&
+        (http_response->body_fd < 0 || (http_response->body_remaining == 0 && http_response->body_piped == 0)) &&
+        (http_response->multipart == NULL || http_response->multipart->index > http_response->multipart->count);
+}
+
+// Helper function - write in-memory segments of responses (starting with first one), with one sendmsg(...) per attempt
+// Returns HTTP_SEND_DONE when first response's segments are written (partially sent segment is advanced in place), HTTP_SEND_AGAIN or HTTP_SEND_ERROR otherwise
+int send_http_iovecs(int socket_id, http_response_t* http_responses, int count)
+{
+    struct iovec batch[HTTP_SEND_BATCH_IOV_MAX];
+    struct msghdr msg;
+    ssize_t write_bytes;
+    int more;
+
+    memset(&msg, 0, sizeof(msg));
+    while ((msg.msg_iovlen = gather_http_responses(http_responses, count, batch, HTTP_SEND_BATCH_IOV_MAX)) > 0) {
+        msg.msg_iov = batch;
+        more = http_responses_continue(http_responses, count);
+
+        // MSG_NOSIGNAL: peer closing connection mid-response must not kill the whole server with SIGPIPE
+        // MSG_MORE: header is held back until following file body bytes fill the packet (sendfile/splice without it pushes)
+        write_bytes = sendmsg(socket_id, &msg, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (write_bytes < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return HTTP_SEND_AGAIN; }
+            return HTTP_SEND_ERROR;
         }
-    } else {
-        // Transmit response header part
-        write_bytes = write(socket_id, response_msg, strlen(response_msg));
-        if (write_bytes < 0) { // Something wrong with socket during header write
-            return 1;
+        metrics_sent_bytes(write_bytes);
+        advance_http_responses(http_responses, count, write_bytes);
+
+        // Once first response's segments are out, caller continues with its file body and following responses
+        if (http_responses[0].iov_index == http_responses[0].iov_count) {
+            break;
         }
+    }
 
-        // Transmit hardcoded HTML error content
-        write_bytes = write(socket_id, socket_buf, content_length);
-        if (write_bytes < 0) { // Something wrong with socket during header write
-            return 1;
+    return HTTP_SEND_DONE;
+}
+
+// Helper function - move file bytes to socket through a pipe with splice(...), for when sendfile(...) can't be used
+// Returns HTTP_SEND_DONE when whole file body is transmitted, HTTP_SEND_AGAIN or HTTP_SEND_ERROR otherwise
+int splice_file_body(int socket_id, http_response_t* http_response)
+{
+    ssize_t moved;
+    size_t chunk;
+
+    if (http_response->body_pipe[0] < 0 && pipe(http_response->body_pipe) != 0) {
+        return HTTP_SEND_ERROR;
+    }
+
+    while (http_response->body_remaining > 0 || http_response->body_piped > 0) {
+        // Refill pipe from file (file pages are moved, not copied through user-space)
+        if (http_response->body_piped == 0) {
+            chunk = (http_response->body_remaining < HTTP_SPLICE_CHUNK) ? (size_t)http_response->body_remaining : HTTP_SPLICE_CHUNK;
+            moved = splice(http_response->body_fd, &http_response->body_offset, http_response->body_pipe[1], NULL, chunk, SPLICE_F_MOVE);
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved <= 0) { // Something wrong with file during reading (or it got truncated after stat)
+                return HTTP_SEND_ERROR;
+            }
+            http_response->body_remaining -= moved;
+            http_response->body_piped = moved;
         }
+
+        // Drain pipe to socket (SPLICE_F_MORE while file has more chunks, so chunk boundaries don't produce short packets)
+        moved = splice(http_response->body_pipe[0], NULL, socket_id, NULL, http_response->body_piped,
+            SPLICE_F_MOVE | SPLICE_F_NONBLOCK | ((http_response->body_remaining > 0) ? SPLICE_F_MORE : 0));
+        if (moved < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return HTTP_SEND_AGAIN; }
+            return HTTP_SEND_ERROR;
+        }
+        http_response->body_piped -= moved;
+        metrics_sent_bytes(moved);
     }
 
-    if (http_request != NULL) {
-        printf("[INFO] [socket: %d] Client: \"%s %s %s\" => Server: \"%s %d %s\"\n", 
-            socket_id, 
-            http_request->method, http_request->uri, http_request->version,
-            HTTP_VERSION, status, http_status_str(status));
-    } else {
-        printf("[INFO] [socket: %d] Client: \" ... \" => Server: \"%s %d %s\"\n", 
-            socket_id, 
-            HTTP_VERSION, status, http_status_str(status));
+    return HTTP_SEND_DONE;
+}
+
+// Helper function - transmit document file body with sendfile(...) (zero-copy, handles partial sends)
+// Returns HTTP_SEND_DONE when whole file body is transmitted, HTTP_SEND_AGAIN or HTTP_SEND_ERROR otherwise
+int send_file_body(int socket_id, http_response_t* http_response)
+{
+    ssize_t sent;
+
+    // Once fallback pipe is in use, keep using it (it may still hold file bytes)
+    if (http_response->body_pipe[0] >= 0) {
+        return splice_file_body(socket_id, http_response);
     }
 
-    return 0;
-}
\ No newline at end of file
+    while (http_response->body_remaining > 0) {
+        sent = sendfile(socket_id, http_response->body_fd, &http_response->body_offset, http_response->body_remaining);
+        if (sent < 0) {
+            if (errno == EINTR) { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) { return HTTP_SEND_AGAIN; }
+            if (errno == EINVAL || errno == ENOSYS) { return splice_file_body(socket_id, http_response); } // File type not supported by sendfile
+            return HTTP_SEND_ERROR;
+        }
+        if (sent == 0) { // File got truncated after stat
+            return HTTP_SEND_ERROR;
+        }
+        http_response->body_remaining -= sent;
+        metrics_sent_bytes(sent);
+    }
+
+    return HTTP_SEND_DONE;
+}
+
+// Send (or continue sending) count prepared HTTP responses, in order, through socket_id socket
+int send_http_responses(int socket_id, http_response_t* http_responses, int count, int* sent)
+{
+    http_response_t* http_response;
+    int send_ec;
+
+    while (*sent < count) {
+        http_response = &http_responses[*sent];
+
+        // Transmit in-memory parts (header and in-memory body) of this and following responses
+        if (http_response->iov_index < http_response->iov_count) {
+            send_ec = send_http_iovecs(socket_id, http_response, count - *sent);
+            if (send_ec != HTTP_SEND_DONE) {
+                return send_ec;
+            }
+        }
+
+        // Transmit document file body part
+        if (http_response->body_fd >= 0 && (send_ec = send_file_body(socket_id, http_response)) != HTTP_SEND_DONE) {
+            return send_ec;
+        }
+
+        // Multi-range response continues with its next part
+        if (next_http_response_part(http_response)) {
+            continue;
+        }
+
+        // Responses following it may have been sent together with it
+        do {
+            (*sent)++;
+        } while (*sent < count && http_response_sent(&http_responses[*sent]));
+    }
+
+    return HTTP_SEND_DONE;
+}
+
+// Send (or continue sending) prepared HTTP response through socket_id socket
+int send_http_response(int socket_id, http_response_t* http_response)
+{
+    int sent = 0;
+
+    return send_http_responses(socket_id, http_response, 1, &sent);
+}
+
+// Release resources held by prepared response (open document file, splice pipe, cache entry)
+void release_http_response(http_response_t* http_response)
+{
+    if (http_response->body_cache != NULL) {
+        file_cache_release(http_response->body_cache);
+        http_response->body_cache = NULL;
+    }
+    if (http_response->body_map != NULL) {
+        map_cache_release(http_response->body_map);
+        http_response->body_map = NULL;
+    }
+    if (http_response->body_fd >= 0) {
+        close(http_response->body_fd);
+        http_response->body_fd = -1;
+    }
+    if (http_response->body_pipe[0] >= 0) {
+        close(http_response->body_pipe[0]);
+        close(http_response->body_pipe[1]);
+        http_response->body_pipe[0] = -1;
+        http_response->body_pipe[1] = -1;
+    }
+    if (http_response->multipart != NULL) {
+        free(http_response->multipart);
+        http_response->multipart = NULL;
+    }
+    if (http_response->body_buffer != NULL) {
+        free(http_response->body_buffer);
+        http_response->body_buffer = NULL;
+    }
+    if (http_response->error_pages != NULL) {
+        pthread_mutex_lock(&error_pages_lock);
+        put_http_error_pages(http_response->error_pages);
+        pthread_mutex_unlock(&error_pages_lock);
+        http_response->error_pages = NULL;
+    }
+}
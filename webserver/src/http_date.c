@@ -0,0 +1,108 @@
+#include <http_date.h>
+
+// Process-wide Date header value, re-formatted by whichever thread first notices that the second changed
+// Readers copy it under seqlock: odd sequence means update in progress, changed sequence means retry
+static atomic_uint date_seq = 0;
+static _Atomic time_t date_second = -1; // Second date_str was (or is being) formatted for
+static char date_str[HTTP_DATE_MAX];
+static size_t date_len = 0;
+
+// Format time as HTTP date (HTTP_DATETIME_FORMAT, GMT) into out (HTTP_DATE_MAX bytes)
+size_t format_http_date(time_t t, char* out)
+{
+    struct tm tm_date;
+    size_t len = 0;
+
+    if (gmtime_r(&t, &tm_date) != NULL) {
+        len = strftime(out, HTTP_DATE_MAX, HTTP_DATETIME_FORMAT, &tm_date);
+    }
+    if (len == 0) {
+        len = strlen(HTTP_DEFAULT_DATE);
+        memcpy(out, HTTP_DEFAULT_DATE, len + 1);
+    }
+
+    return len;
+}
+
+// Parse HTTP date of value_len bytes into t
+int parse_http_date(const char* value, size_t value_len, time_t* t)
+{
+    static const char* formats[] = { HTTP_DATETIME_FORMAT, HTTP_DATETIME_FORMAT_RFC850, HTTP_DATETIME_FORMAT_ASCTIME };
+    char buf[HTTP_DATE_MAX];
+    struct tm tm_date;
+    const char* end;
+    unsigned i;
+
+    if (value_len >= HTTP_DATE_MAX) {
+        return 1;
+    }
+    memcpy(buf, value, value_len);
+    buf[value_len] = '\0';
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        memset(&tm_date, 0, sizeof(tm_date));
+        if ((end = strptime(buf, formats[i], &tm_date)) != NULL && *end == '\0') {
+            *t = timegm(&tm_date);
+            return (*t == (time_t)-1) ? 1 : 0;
+        }
+    }
+
+    return 1;
+}
+
+// Format entity tag of document into out (HTTP_ETAG_MAX bytes)
+size_t format_http_etag(const struct stat* stats, char* out)
+{
+    int weak = (stats->st_mtim.tv_sec >= time(0));
+
+    return snprintf(out, HTTP_ETAG_MAX, "%s\"%lx-%lx-%lx.%lx\"", weak ? "W/" : "",
+        (unsigned long)stats->st_ino, (unsigned long)stats->st_size,
+        (unsigned long)stats->st_mtim.tv_sec, (unsigned long)stats->st_mtim.tv_nsec);
+}
+
+// Helper function - re-format shared date string for given second (only one thread wins the update)
+void http_date_update(time_t now, time_t seen)
+{
+    char formatted[HTTP_DATE_MAX];
+    size_t len;
+
+    if (!atomic_compare_exchange_strong(&date_second, &seen, now)) { // Another thread is already updating it
+        return;
+    }
+
+    len = format_http_date(now, formatted);
+
+    atomic_fetch_add_explicit(&date_seq, 1, memory_order_relaxed); // Odd - readers retry
+    atomic_thread_fence(memory_order_release);
+    memcpy(date_str, formatted, len + 1);
+    date_len = len;
+    atomic_fetch_add_explicit(&date_seq, 1, memory_order_release); // Even - stable again
+}
+
+// Copy current Date header value into out (HTTP_DATE_MAX bytes)
+size_t http_date_now(char* out)
+{
+    time_t now = time(0);
+    time_t seen = atomic_load_explicit(&date_second, memory_order_relaxed);
+    unsigned int seq_before;
+    unsigned int seq_after;
+    size_t len;
+
+    if (seen != now) {
+        http_date_update(now, seen);
+    }
+
+    do {
+        seq_before = atomic_load_explicit(&date_seq, memory_order_acquire);
+        len = date_len;
+        if ((seq_before & 1) || len == 0) { // Update in progress (or very first one not finished yet)
+            seq_after = seq_before + 1;
+            continue;
+        }
+        memcpy(out, date_str, len + 1);
+        atomic_thread_fence(memory_order_acquire);
+        seq_after = atomic_load_explicit(&date_seq, memory_order_relaxed);
+    } while (seq_before != seq_after);
+
+    return len;
+}
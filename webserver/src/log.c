@@ -0,0 +1,478 @@
+#include <log.h>
+
+// Log file owned by writer thread (or by direct, synchronous logging before log_start())
+typedef struct {
+    int fd; // -1 if destination is disabled
+    int dir_fd; // Directory of log file (opened before chroot, for rotation), -1 if file is not rotated (stdout)
+    char name[NAME_MAX+1]; // File name inside dir_fd
+    size_t size; // Current file size
+    time_t opened; // When current file was opened
+    char buf[LOG_WRITE_BUFSIZE]; // Records waiting for write(...)
+    size_t buf_len;
+} log_file_t;
+
+// Record header in ring buffers
+typedef struct {
+    uint32_t len;
+    uint32_t dest;
+} log_record_t;
+
+// Formatted timestamps of one second (refreshed per thread, when second changes)
+typedef struct {
+    time_t second;
+    char error_time[32]; // e.g. "2018-10-10 15:26:09"
+    char access_time[32]; // e.g. "10/Oct/2018:15:26:09 +0000"
+} log_time_t;
+
+static log_file_t log_files[LOG_DEST_COUNT];
+static atomic_int min_level = LOG_LEVEL_INFO; // Changed by config reload while other threads log
+static access_log_format_t access_format = ACCESS_LOG_COMMON;
+static size_t rotate_size = 0;
+static int rotate_interval = 0;
+
+static atomic_int writer_running = 0;
+static atomic_int writer_stopping = 0;
+static pthread_t writer_thread;
+static pthread_mutex_t direct_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes direct logging (before writer thread starts)
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER; // Protects ring registration/reuse (not record writing)
+static _Atomic(log_ring_t*) rings = NULL;
+static pthread_key_t ring_key;
+static __thread log_ring_t* thread_ring = NULL;
+static __thread log_time_t thread_time = { -1, "", "" };
+
+// Helper function - write whole buffer to file descriptor (retrying on interrupts and partial writes)
+void log_write_all(int fd, const char* buf, size_t len)
+{
+    ssize_t written;
+
+    while (len > 0) {
+        written = write(fd, buf, len);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return;
+        }
+        buf += written;
+        len -= written;
+    }
+}
+
+// Helper function - open log file for appending, remember its directory for rotation
+// Returns 0 on success, 1 on failure
+int log_open_file(log_file_t* file, const char* path)
+{
+    char dir_path[PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    struct stat file_stats;
+
+    if (slash == NULL) {
+        strcpy(dir_path, ".");
+        slash = path - 1;
+    } else if (slash == path) {
+        strcpy(dir_path, "/");
+    } else {
+        snprintf(dir_path, PATH_MAX, "%.*s", (int)(slash - path), path);
+    }
+    if (strlen(slash + 1) == 0 || strlen(slash + 1) > NAME_MAX) {
+        errno = EINVAL;
+        return 1;
+    }
+    strcpy(file->name, slash + 1);
+
+    if ((file->dir_fd = open(dir_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+        return 1;
+    }
+    if ((file->fd = openat(file->dir_fd, file->name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        close(file->dir_fd);
+        file->dir_fd = -1;
+        return 1;
+    }
+
+    file->size = (fstat(file->fd, &file_stats) == 0) ? (size_t)file_stats.st_size : 0;
+    file->opened = time(0);
+    return 0;
+}
+
+// Helper function - release ring of exiting thread (writer thread drains it and makes it reusable)
+void log_ring_release(void* ring)
+{
+    atomic_store_explicit(&((log_ring_t*)ring)->state, LOG_RING_RELEASED, memory_order_release);
+}
+
+// Open log files (error_log, access_log) and apply log level from config
+int log_init(const config_t* conf)
+{
+    int i;
+
+    for (i = 0; i < LOG_DEST_COUNT; i++) {
+        log_files[i].fd = -1;
+        log_files[i].dir_fd = -1;
+        log_files[i].buf_len = 0;
+    }
+    atomic_store_explicit(&min_level, conf->log_level, memory_order_relaxed);
+    access_format = conf->access_log_format;
+    rotate_size = conf->log_rotate_size;
+    rotate_interval = conf->log_rotate_interval;
+
+    if (conf->error_log[0] == '\0') {
+        log_files[LOG_DEST_ERROR].fd = STDOUT_FILENO;
+    } else if (log_open_file(&log_files[LOG_DEST_ERROR], conf->error_log) != 0) {
+        printf("[ERROR] [log_init] Failed to open error log \"%s\", error: %s\n", conf->error_log, strerror(errno));
+        return 1;
+    }
+
+    if (conf->access_log[0] != '\0' && log_open_file(&log_files[LOG_DEST_ACCESS], conf->access_log) != 0) {
+        printf("[ERROR] [log_init] Failed to open access log \"%s\", error: %s\n", conf->access_log, strerror(errno));
+        return 1;
+    }
+
+    if (pthread_key_create(&ring_key, log_ring_release) != 0) {
+        printf("[ERROR] [log_init] Failed to create ring buffer thread key\n");
+        return 1;
+    }
+
+    fflush(stdout); // Earlier printf(...) output must come before log records
+    return 0;
+}
+
+// Change minimum logged level
+void log_set_level(log_level_t level)
+{
+    atomic_store_explicit(&min_level, level, memory_order_relaxed);
+}
+
+// Check if messages of given level are logged
+int log_enabled(log_level_t level)
+{
+    log_level_t current = (log_level_t)atomic_load_explicit(&min_level, memory_order_relaxed);
+
+    return level >= current && current != LOG_LEVEL_OFF;
+}
+
+// Check if access log is enabled
+int log_access_enabled()
+{
+    return log_files[LOG_DEST_ACCESS].fd >= 0;
+}
+
+// Helper function - get (or register) ring buffer of calling thread
+// Returns NULL if ring couldn't be allocated
+log_ring_t* log_thread_ring()
+{
+    log_ring_t* ring;
+
+    if (thread_ring != NULL) {
+        return thread_ring;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+
+    // Reuse drained ring of exited thread (only writer thread marks rings free, only registration takes them)
+    for (ring = atomic_load_explicit(&rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        if (atomic_load_explicit(&ring->state, memory_order_acquire) == LOG_RING_FREE) {
+            atomic_store_explicit(&ring->state, LOG_RING_ACTIVE, memory_order_relaxed);
+            break;
+        }
+    }
+
+    // Otherwise add new ring to registry (published fully initialized, writer thread walks registry without lock)
+    if (ring == NULL && (ring = (log_ring_t*)calloc(1, sizeof(log_ring_t))) != NULL) {
+        atomic_init(&ring->head, 0);
+        atomic_init(&ring->tail, 0);
+        atomic_init(&ring->state, LOG_RING_ACTIVE);
+        atomic_init(&ring->dropped, 0);
+        ring->next = atomic_load_explicit(&rings, memory_order_relaxed);
+        atomic_store_explicit(&rings, ring, memory_order_release);
+    }
+
+    pthread_mutex_unlock(&rings_lock);
+
+    if (ring != NULL) {
+        pthread_setspecific(ring_key, ring);
+        thread_ring = ring;
+    }
+    return ring;
+}
+
+// Helper function - copy bytes into ring at (unwrapped) position pos
+void log_ring_write(log_ring_t* ring, size_t pos, const void* src, size_t len)
+{
+    size_t offset = pos & (LOG_RING_SIZE - 1);
+    size_t first = (len < LOG_RING_SIZE - offset) ? len : LOG_RING_SIZE - offset;
+
+    memcpy(ring->data + offset, src, first);
+    memcpy(ring->data, (const char*)src + first, len - first);
+}
+
+// Helper function - copy bytes out of ring from (unwrapped) position pos
+void log_ring_read(const log_ring_t* ring, size_t pos, void* dst, size_t len)
+{
+    size_t offset = pos & (LOG_RING_SIZE - 1);
+    size_t first = (len < LOG_RING_SIZE - offset) ? len : LOG_RING_SIZE - offset;
+
+    memcpy(dst, ring->data + offset, first);
+    memcpy((char*)dst + first, ring->data, len - first);
+}
+
+// Helper function - hand formatted record to its log destination
+// With writer thread running this only copies record into calling thread's ring (dropped if ring is full)
+void log_submit(log_dest_t dest, const char* record, size_t len)
+{
+    log_ring_t* ring;
+    log_record_t header;
+    size_t head, tail;
+
+    if (!atomic_load_explicit(&writer_running, memory_order_acquire) || (ring = log_thread_ring()) == NULL) {
+        pthread_mutex_lock(&direct_lock);
+        log_write_all(log_files[dest].fd, record, len);
+        pthread_mutex_unlock(&direct_lock);
+        return;
+    }
+
+    head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (LOG_RING_SIZE - (head - tail) < sizeof(header) + len) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    header.len = len;
+    header.dest = dest;
+    log_ring_write(ring, head, &header, sizeof(header));
+    log_ring_write(ring, head + sizeof(header), record, len);
+    atomic_store_explicit(&ring->head, head + sizeof(header) + len, memory_order_release);
+}
+
+// Helper function - formatted timestamps of current second (UTC)
+const log_time_t* log_now()
+{
+    time_t now = time(0);
+    struct tm tm_now;
+
+    if (thread_time.second != now && gmtime_r(&now, &tm_now) != NULL) {
+        strftime(thread_time.error_time, sizeof(thread_time.error_time), "%Y-%m-%d %H:%M:%S", &tm_now);
+        strftime(thread_time.access_time, sizeof(thread_time.access_time), "%d/%b/%Y:%H:%M:%S +0000", &tm_now);
+        thread_time.second = now;
+    }
+    return &thread_time;
+}
+
+// Helper function - clamp snprintf(...) result to buffer size (leaving room for newline)
+size_t log_clamp(int len, size_t max)
+{
+    if (len < 0) {
+        return 0;
+    }
+    return ((size_t)len < max - 1) ? (size_t)len : max - 2;
+}
+
+// Log formatted server message (newline is appended)
+void log_msg(log_level_t level, const char* format, ...)
+{
+    static const char* level_names[] = { "INFO", "WARN", "ERROR" };
+    char record[LOG_RECORD_MAX];
+    size_t len;
+    va_list args;
+
+    if (!log_enabled(level)) {
+        return;
+    }
+
+    len = log_clamp(snprintf(record, LOG_RECORD_MAX, "%s [%s] ", log_now()->error_time, level_names[level]), LOG_RECORD_MAX);
+    va_start(args, format);
+    len += log_clamp(vsnprintf(record + len, LOG_RECORD_MAX - len, format, args), LOG_RECORD_MAX - len);
+    va_end(args);
+    record[len++] = '\n';
+
+    log_submit(LOG_DEST_ERROR, record, len);
+}
+
+// Log response to access log in Common Log Format (or Combined Log Format)
+// Example lines:
+/*
+127.0.0.1 - - [10/Oct/2018:15:26:09 +0000] "GET /index.html HTTP/1.1" 200 1019
+127.0.0.1 - - [10/Oct/2018:15:26:09 +0000] "GET /index.html HTTP/1.1" 200 1019 "http://localhost/" "curl/7.58.0"
+*/
+void log_access(const char* client_addr, const char* method, const char* uri, const char* version, int status, off_t body_len,
+    const char* referer, size_t referer_len, const char* user_agent, size_t user_agent_len)
+{
+    char record[LOG_RECORD_MAX];
+    char body_len_str[32];
+    size_t len;
+
+    if (!log_access_enabled()) {
+        return;
+    }
+
+    if (body_len > 0) {
+        snprintf(body_len_str, sizeof(body_len_str), "%ld", (long)body_len);
+    } else {
+        strcpy(body_len_str, "-");
+    }
+
+    if (method != NULL) {
+        len = log_clamp(snprintf(record, LOG_RECORD_MAX, "%s - - [%s] \"%s %s %s\" %d %s",
+            client_addr, log_now()->access_time, method, uri, version, status, body_len_str), LOG_RECORD_MAX);
+    } else {
+        len = log_clamp(snprintf(record, LOG_RECORD_MAX, "%s - - [%s] \"-\" %d %s",
+            client_addr, log_now()->access_time, status, body_len_str), LOG_RECORD_MAX);
+    }
+    if (access_format == ACCESS_LOG_COMBINED) {
+        len += log_clamp(snprintf(record + len, LOG_RECORD_MAX - len, " \"%.*s\" \"%.*s\"",
+            referer ? (int)referer_len : 1, referer ? referer : "-",
+            user_agent ? (int)user_agent_len : 1, user_agent ? user_agent : "-"), LOG_RECORD_MAX - len);
+    }
+    record[len++] = '\n';
+
+    log_submit(LOG_DEST_ACCESS, record, len);
+}
+
+// Helper function - write buffered records of log file
+void log_flush(log_file_t* file)
+{
+    log_write_all(file->fd, file->buf, file->buf_len);
+    file->size += file->buf_len;
+    file->buf_len = 0;
+}
+
+// Helper function - add record to log file's output buffer (writer thread)
+void log_buffer(log_file_t* file, const char* record, size_t len)
+{
+    if (file->fd < 0) {
+        return;
+    }
+    if (file->buf_len + len > LOG_WRITE_BUFSIZE) {
+        log_flush(file);
+    }
+    memcpy(file->buf + file->buf_len, record, len);
+    file->buf_len += len;
+}
+
+// Helper function - move records from ring into log file buffers (writer thread)
+void log_drain_ring(log_ring_t* ring)
+{
+    char record[LOG_RECORD_MAX];
+    char dropped_msg[128];
+    log_record_t header;
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned long dropped;
+    int state = atomic_load_explicit(&ring->state, memory_order_acquire);
+
+    while (tail < head) {
+        log_ring_read(ring, tail, &header, sizeof(header));
+        log_ring_read(ring, tail + sizeof(header), record, header.len);
+        log_buffer(&log_files[header.dest], record, header.len);
+        tail += sizeof(header) + header.len;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    if ((dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed)) > 0) {
+        snprintf(dropped_msg, sizeof(dropped_msg), "%s [WARN] [log_writer] Dropped %lu log records (ring buffer full)\n", log_now()->error_time, dropped);
+        log_buffer(&log_files[LOG_DEST_ERROR], dropped_msg, strlen(dropped_msg));
+    }
+
+    // Owner exited before drain started (so nothing can be written anymore) - ring can be reused
+    if (state == LOG_RING_RELEASED && atomic_load_explicit(&ring->head, memory_order_acquire) == tail) {
+        atomic_store_explicit(&ring->state, LOG_RING_FREE, memory_order_release);
+    }
+}
+
+// Helper function - rotate log file if it got too big or too old (writer thread)
+// Current file is renamed to <name>.<YYYYmmdd-HHMMSS> and new one is created
+void log_rotate(log_file_t* file, time_t now)
+{
+    char rotated_name[NAME_MAX+64];
+    struct stat rotated_stats;
+    struct tm tm_now;
+    int new_fd;
+    int suffix;
+    int len;
+
+    if (file->fd < 0 || file->dir_fd < 0 || file->size == 0) {
+        return;
+    }
+    if ((rotate_size == 0 || file->size < rotate_size) && (rotate_interval == 0 || now - file->opened < rotate_interval)) {
+        return;
+    }
+
+    // Rotations within the same second get numbered suffix, existing rotated files are never overwritten
+    gmtime_r(&now, &tm_now);
+    len = snprintf(rotated_name, sizeof(rotated_name), "%s.%04d%02d%02d-%02d%02d%02d", file->name,
+        tm_now.tm_year + 1900, tm_now.tm_mon + 1, tm_now.tm_mday, tm_now.tm_hour, tm_now.tm_min, tm_now.tm_sec);
+    for (suffix = 1; fstatat(file->dir_fd, rotated_name, &rotated_stats, 0) == 0; suffix++) {
+        snprintf(rotated_name + len, sizeof(rotated_name) - len, ".%d", suffix);
+    }
+
+    file->opened = now; // Failed rotation is not retried before next interval (or size check)
+    if (renameat(file->dir_fd, file->name, file->dir_fd, rotated_name) != 0) {
+        return;
+    }
+    if ((new_fd = openat(file->dir_fd, file->name, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+        return; // Keep writing into renamed file
+    }
+    close(file->fd);
+    file->fd = new_fd;
+    file->size = 0;
+}
+
+// Writer thread function - periodically drain all ring buffers into log files
+void* log_writer_run(void* unused)
+{
+    struct timespec interval = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+    log_ring_t* ring;
+    time_t now;
+    int stopping;
+    int i;
+
+    // Last pass after stop request writes out records submitted before it
+    while (1) {
+        stopping = atomic_load_explicit(&writer_stopping, memory_order_acquire);
+        if (!stopping) {
+            nanosleep(&interval, NULL);
+        }
+
+        for (ring = atomic_load_explicit(&rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+            log_drain_ring(ring);
+        }
+
+        now = time(0);
+        for (i = 0; i < LOG_DEST_COUNT; i++) {
+            if (log_files[i].fd >= 0) {
+                log_flush(&log_files[i]);
+                log_rotate(&log_files[i], now);
+            }
+        }
+
+        if (stopping) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Start background writer thread
+int log_start()
+{
+    if (pthread_create(&writer_thread, NULL, log_writer_run, NULL) != 0) {
+        printf("[ERROR] [log_start] Failed to pthread_create log writer thread\n");
+        return 1;
+    }
+
+    atomic_store_explicit(&writer_running, 1, memory_order_release);
+    return 0;
+}
+
+// Stop background writer thread after it wrote out buffered records
+void log_stop()
+{
+    if (!atomic_exchange_explicit(&writer_running, 0, memory_order_acq_rel)) {
+        return;
+    }
+
+    // Messages logged from now on are written directly, writer thread makes its last pass over rings
+    atomic_store_explicit(&writer_stopping, 1, memory_order_release);
+    pthread_join(writer_thread, NULL);
+}
@@ -1,6 +1,20 @@
 #include <common.h>
 #include <config.h>
 #include <net_thread.h>
+#include <event_loop.h>
+#include <uring_loop.h>
+#include <file_cache.h>
+#include <map_cache.h>
+#include <meta_cache.h>
+#include <conn_pool.h>
+#include <conf_snapshot.h>
+#include <mime.h>
+#include <fs_watch.h>
+#include <signals.h>
+#include <handoff.h>
+#include <drain.h>
+#include <http.h>
+#include <log.h>
 
 // Detach as daemon
 // Returns child PID if you are parent/exiting process, returns 0 if you are child/daemon process, Returns -1 if forking failed
@@ -51,6 +65,7 @@ int main(int argc, char const *argv[])
     config_t config;
     const char* conf_filename = DEFAULT_CONF_FILE;
     int daemon_ret;
+    int exit_code;
 
     // Required/special argument parsing
     for (int i = 0; i < argc; i++) {
@@ -82,6 +97,11 @@ int main(int argc, char const *argv[])
     printf("[INFO] [main] Printing loaded config object ...\n");
     print_conf(&config);
 
+    // Take over listening sockets passed by systemd socket activation or by previous instance on handoff (before fork changes PID)
+    if (handoff_inherit() != 0) {
+        return 1;
+    }
+
     // Daemon handling
     if (config.as_daemon == 1) {
         printf("[INFO] [main] Creating daemon process for the server...\n");
@@ -96,12 +116,95 @@ int main(int argc, char const *argv[])
         }
     }
 
+    // Exec helper (started before any thread and outside of chroot) starts new instances on handoff (SIGUSR2)
+    if (handoff_start_helper(argv) != 0) {
+        return 1;
+    }
+
+    // Keep pid file directory reachable (outside of chroot), file is written once server is listening
+    if (config.pid_file[0] != '\0' && handoff_set_pid_file(config.pid_file) != 0) {
+        return 1;
+    }
+
+    // Open log files while their paths are still reachable (outside of chroot)
+    if (log_init(&config) != 0) {
+        return 1;
+    }
+
+    // Load Content-Type table while mime.types file is still reachable (outside of chroot)
+    if (mime_load(config.mime_types) != 0) {
+        return 1;
+    }
+
+    // Keep config file reachable for reloads on SIGHUP (outside of chroot)
+    if (conf_reload_init(conf_filename) != 0) {
+        return 1;
+    }
+
     // chroot document root directory
     if (chroot_doc_root(&config) != 0) {
         printf("[ERROR] [main] Failed to chroot doc root \"%s\", error: %s (Reminder: chroot requires root privilege, e.g. sudo)\n", config.doc_root_dir, strerror(errno));
         return 1;
     }
 
-    // Start HTTP 1.0 web-server listening service
-    return thread_listen(&config);
+    // Signal handling thread must exist before any other thread, so they all inherit blocked signal mask
+    if (start_signal_thread() != 0) {
+        return 1;
+    }
+
+    // From now on log records are written by background writer thread
+    if (log_start() != 0) {
+        return 1;
+    }
+
+    // Pre-render error responses from (now chroot-ed) /_errors/ directory
+    if (load_http_error_pages() != 0) {
+        return 1;
+    }
+
+    // Setup document, mapping and metadata caches, invalidated by file change notifications for (now chroot-ed) document root
+    file_cache_init(&config);
+    map_cache_init(&config);
+    meta_cache_init(&config);
+    if (fs_watch_start("/") != 0) {
+        log_msg(LOG_LEVEL_WARN, "[main] File change notifications are not available, disabling document, mapping and metadata caches");
+        config.file_cache_size = 0;
+        config.mmap_cache_size = 0;
+        config.meta_cache_entries = 0;
+        file_cache_init(&config);
+        map_cache_init(&config);
+        meta_cache_init(&config);
+    }
+
+    // Connection limit follows from memory ceiling and per-connection cost of configured connection handling model
+    conn_pool_init(&config);
+
+    // Connections are served with published config snapshot, which SIGHUP replaces with reloaded one
+    if (conf_publish(&config) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[main] Failed to publish config snapshot");
+        return 1;
+    }
+
+    // Listeners stop accepting once SIGQUIT/SIGTERM (or new instance after handoff) starts draining
+    if (drain_init() != 0) {
+        return 1;
+    }
+
+    // Start HTTP 1.0 web-server listening service in configured connection handling model (returns after draining)
+    if (config.server_mode == SERVER_MODE_EPOLL) {
+        exit_code = epoll_listen(&config);
+    } else if (config.server_mode == SERVER_MODE_POOL) {
+        exit_code = pool_listen(&config);
+    } else if (config.server_mode == SERVER_MODE_REUSEPORT) {
+        exit_code = reuseport_listen(&config);
+    } else if (config.server_mode == SERVER_MODE_URING) {
+        exit_code = uring_listen(&config);
+    } else {
+        exit_code = thread_listen(&config);
+    }
+
+    handoff_remove_pid_file();
+    log_msg(LOG_LEVEL_INFO, "[main] Server stopped (exit code %d)", exit_code);
+    log_stop();
+    return exit_code;
 }
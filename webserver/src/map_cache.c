@@ -0,0 +1,217 @@
+#include <map_cache.h>
+#include <fs_watch.h>
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static map_cache_entry_t* buckets[MAP_CACHE_BUCKETS];
+static map_cache_entry_t* lru_head = NULL;
+static map_cache_entry_t* lru_tail = NULL;
+static size_t used_bytes = 0;
+static size_t budget_bytes = 0; // 0 - mmap serving disabled
+static size_t min_file_bytes = 0; // Smaller documents belong to document cache
+static size_t max_file_bytes = 0;
+
+// Helper function - FNV-1a hash of resolved_path, reduced to bucket index
+unsigned int map_cache_bucket(const char* resolved_path)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*resolved_path) {
+        hash ^= (unsigned char)*resolved_path++;
+        hash *= 16777619u;
+    }
+
+    return hash & (MAP_CACHE_BUCKETS - 1);
+}
+
+// Check if stats describe the same file version
+int map_cache_same_file(const struct stat* a, const struct stat* b)
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+        a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+// Helper function - drop one reference, unmap entry when nobody uses it anymore (cache lock must be held)
+void map_cache_unref(map_cache_entry_t* entry)
+{
+    if (--entry->refs > 0) {
+        return;
+    }
+
+    munmap(entry->data, entry->stats.st_size);
+    free(entry->resolved_path);
+    free(entry);
+}
+
+// Helper function - unlink entry from LRU list (cache lock must be held)
+void map_cache_lru_unlink(map_cache_entry_t* entry)
+{
+    if (entry->lru_prev != NULL) { entry->lru_prev->lru_next = entry->lru_next; } else { lru_head = entry->lru_next; }
+    if (entry->lru_next != NULL) { entry->lru_next->lru_prev = entry->lru_prev; } else { lru_tail = entry->lru_prev; }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+// Helper function - put entry to the front of LRU list (cache lock must be held)
+void map_cache_lru_push(map_cache_entry_t* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head != NULL) { lru_head->lru_prev = entry; } else { lru_tail = entry; }
+    lru_head = entry;
+}
+
+// Helper function - remove entry from the cache, dropping cache's reference (cache lock must be held)
+void map_cache_remove(map_cache_entry_t* entry)
+{
+    map_cache_entry_t** link = &buckets[map_cache_bucket(entry->resolved_path)];
+
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    map_cache_lru_unlink(entry);
+    used_bytes -= entry->stats.st_size;
+    map_cache_unref(entry);
+}
+
+// Helper function - find entry by resolved_path (cache lock must be held)
+map_cache_entry_t* map_cache_find(const char* resolved_path)
+{
+    map_cache_entry_t* entry = buckets[map_cache_bucket(resolved_path)];
+
+    while (entry != NULL && strcmp(entry->resolved_path, resolved_path) != 0) {
+        entry = entry->hash_next;
+    }
+
+    return entry;
+}
+
+// Change callback - drop mappings of changed file, or of every file below changed directory
+// (responses still sending from them keep their mapping until they are done)
+void map_cache_invalidate(const char* path)
+{
+    map_cache_entry_t* entry;
+    map_cache_entry_t* next;
+    size_t path_len = (path != NULL) ? strlen(path) : 0;
+    int i;
+
+    pthread_mutex_lock(&cache_lock);
+    for (i = 0; i < MAP_CACHE_BUCKETS; i++) {
+        for (entry = buckets[i]; entry != NULL; entry = next) {
+            next = entry->hash_next;
+            if (path == NULL || (strncmp(entry->resolved_path, path, path_len) == 0 &&
+                (entry->resolved_path[path_len] == '\0' || entry->resolved_path[path_len] == '/'))) {
+                map_cache_remove(entry);
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Setup process-wide mapping cache
+void map_cache_init(const config_t* conf)
+{
+    budget_bytes = conf->mmap_cache_size;
+    min_file_bytes = (conf->file_cache_size > 0) ? conf->file_cache_max_file : 0;
+    max_file_bytes = conf->mmap_max_file;
+
+    if (budget_bytes > 0) {
+        fs_watch_subscribe(map_cache_invalidate);
+    }
+}
+
+// Check if document of given size is allowed to be mapped (nothing is, once file changes could go unnoticed)
+int map_cache_accepts(off_t size)
+{
+    return budget_bytes > 0 && !fs_watch_lost() && size > 0 && (size_t)size > min_file_bytes && (size_t)size <= max_file_bytes && (size_t)size <= budget_bytes;
+}
+
+// Get mapping of resolved_path file
+map_cache_entry_t* map_cache_lookup(const char* resolved_path, const struct stat* stats)
+{
+    map_cache_entry_t* entry;
+
+    if (budget_bytes == 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    if ((entry = map_cache_find(resolved_path)) != NULL) {
+        if (map_cache_same_file(&entry->stats, stats)) {
+            map_cache_lru_unlink(entry);
+            map_cache_lru_push(entry);
+            entry->refs++;
+        } else { // Mapped version is outdated (change notification may not have arrived yet)
+            map_cache_remove(entry);
+            entry = NULL;
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    return entry;
+}
+
+// Map document file and add it to the cache
+map_cache_entry_t* map_cache_insert(const char* resolved_path, int fd, const struct stat* stats)
+{
+    map_cache_entry_t* entry;
+    map_cache_entry_t* existing;
+    struct stat fd_stats;
+    void* data;
+
+    if (!S_ISREG(stats->st_mode) || !map_cache_accepts(stats->st_size)) {
+        return NULL;
+    }
+
+    // File could have been replaced since it was resolved, mapping must be of the version response header describes
+    if (fstat(fd, &fd_stats) != 0 || !map_cache_same_file(&fd_stats, stats)) {
+        return NULL;
+    }
+
+    if ((data = mmap(NULL, stats->st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        return NULL;
+    }
+    // Responses read mapping front to back: read-ahead aggressively, drop pages behind reader early, start reading now
+    madvise(data, stats->st_size, MADV_SEQUENTIAL);
+    madvise(data, stats->st_size, MADV_WILLNEED);
+
+    if ((entry = (map_cache_entry_t*)calloc(1, sizeof(map_cache_entry_t))) == NULL ||
+        (entry->resolved_path = strdup(resolved_path)) == NULL) {
+        free(entry);
+        munmap(data, stats->st_size);
+        return NULL;
+    }
+    entry->data = (char*)data;
+    entry->stats = *stats;
+    entry->refs = 2; // Cache's own reference and caller's reference
+
+    pthread_mutex_lock(&cache_lock);
+
+    // Another request could have mapped the same file meanwhile
+    if ((existing = map_cache_find(resolved_path)) != NULL) {
+        map_cache_remove(existing);
+    }
+
+    // Unmap least recently used files (once their responses are done) until new one fits into budget
+    while (lru_tail != NULL && used_bytes + stats->st_size > budget_bytes) {
+        map_cache_remove(lru_tail);
+    }
+
+    entry->hash_next = buckets[map_cache_bucket(resolved_path)];
+    buckets[map_cache_bucket(resolved_path)] = entry;
+    map_cache_lru_push(entry);
+    used_bytes += stats->st_size;
+
+    pthread_mutex_unlock(&cache_lock);
+
+    return entry;
+}
+
+// Release reference to cache entry
+void map_cache_release(map_cache_entry_t* entry)
+{
+    pthread_mutex_lock(&cache_lock);
+    map_cache_unref(entry);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,258 @@
+#include <meta_cache.h>
+#include <fs_watch.h>
+
+// Shard: independently locked part of the cache (doc_path hash picks the shard)
+typedef struct {
+    pthread_mutex_t lock;
+    meta_cache_entry_t* buckets[META_CACHE_SHARD_BUCKETS];
+    meta_cache_entry_t* lru_head;
+    meta_cache_entry_t* lru_tail;
+    int count;
+} meta_cache_shard_t;
+
+static meta_cache_shard_t shards[META_CACHE_SHARDS];
+static int shard_capacity = 0; // 0 - cache disabled
+static int negative_ttl = 0;
+static atomic_ulong generation = 0;
+
+// Helper function - FNV-1a hash of doc_path (low bits pick shard, next bits pick bucket)
+unsigned int meta_cache_hash(const char* doc_path)
+{
+    unsigned int hash = 2166136261u;
+
+    while (*doc_path) {
+        hash ^= (unsigned char)*doc_path++;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+// Helper function - free entry
+void meta_cache_free(meta_cache_entry_t* entry)
+{
+    free(entry->doc_path);
+    free(entry->resolved_path);
+    free(entry);
+}
+
+// Helper function - unlink entry from shard LRU list (shard lock must be held)
+void meta_cache_lru_unlink(meta_cache_shard_t* shard, meta_cache_entry_t* entry)
+{
+    if (entry->lru_prev != NULL) { entry->lru_prev->lru_next = entry->lru_next; } else { shard->lru_head = entry->lru_next; }
+    if (entry->lru_next != NULL) { entry->lru_next->lru_prev = entry->lru_prev; } else { shard->lru_tail = entry->lru_prev; }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+// Helper function - put entry to the front of shard LRU list (shard lock must be held)
+void meta_cache_lru_push(meta_cache_shard_t* shard, meta_cache_entry_t* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = shard->lru_head;
+    if (shard->lru_head != NULL) { shard->lru_head->lru_prev = entry; } else { shard->lru_tail = entry; }
+    shard->lru_head = entry;
+}
+
+// Helper function - remove entry from shard and free it (shard lock must be held)
+void meta_cache_remove(meta_cache_shard_t* shard, meta_cache_entry_t* entry)
+{
+    meta_cache_entry_t** link = &shard->buckets[(meta_cache_hash(entry->doc_path) / META_CACHE_SHARDS) & (META_CACHE_SHARD_BUCKETS - 1)];
+
+    while (*link != entry) {
+        link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    meta_cache_lru_unlink(shard, entry);
+    shard->count--;
+    meta_cache_free(entry);
+}
+
+// Helper function - check if path is changed path itself or lies below it
+int meta_cache_path_below(const char* path, const char* changed, size_t changed_len)
+{
+    return path != NULL && strncmp(path, changed, changed_len) == 0 && (path[changed_len] == '\0' || path[changed_len] == '/');
+}
+
+// Change callback - drop entries of changed file, or of every file below changed directory
+// Entries are matched by doc_path too, so negative entries of files which just appeared are dropped as well
+void meta_cache_invalidate(const char* path)
+{
+    meta_cache_shard_t* shard;
+    meta_cache_entry_t* entry;
+    meta_cache_entry_t* next;
+    size_t path_len = (path != NULL) ? strlen(path) : 0;
+    int i, j;
+
+    atomic_fetch_add(&generation, 1);
+    for (i = 0; i < META_CACHE_SHARDS; i++) {
+        shard = &shards[i];
+        pthread_mutex_lock(&shard->lock);
+        for (j = 0; j < META_CACHE_SHARD_BUCKETS; j++) {
+            for (entry = shard->buckets[j]; entry != NULL; entry = next) {
+                next = entry->hash_next;
+                if (path == NULL || meta_cache_path_below(entry->resolved_path, path, path_len) ||
+                    meta_cache_path_below(entry->doc_path, path, path_len)) {
+                    meta_cache_remove(shard, entry);
+                }
+            }
+        }
+        pthread_mutex_unlock(&shard->lock);
+    }
+}
+
+// Setup process-wide metadata cache
+void meta_cache_init(const config_t* conf)
+{
+    static int initialized = 0;
+    int i;
+
+    if (!initialized) {
+        for (i = 0; i < META_CACHE_SHARDS; i++) {
+            pthread_mutex_init(&shards[i].lock, NULL);
+        }
+        initialized = 1;
+    }
+
+    shard_capacity = (conf->meta_cache_entries + META_CACHE_SHARDS - 1) / META_CACHE_SHARDS;
+    negative_ttl = conf->meta_cache_negative_ttl;
+
+    if (shard_capacity > 0) {
+        fs_watch_subscribe(meta_cache_invalidate);
+    }
+}
+
+// Get cached metadata of doc_path
+int meta_cache_lookup(const char* doc_path, doc_meta_t* meta)
+{
+    unsigned int hash;
+    meta_cache_shard_t* shard;
+    meta_cache_entry_t* entry;
+
+    if (shard_capacity == 0) {
+        return 1;
+    }
+
+    hash = meta_cache_hash(doc_path);
+    shard = &shards[hash & (META_CACHE_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    entry = shard->buckets[(hash / META_CACHE_SHARDS) & (META_CACHE_SHARD_BUCKETS - 1)];
+    while (entry != NULL && strcmp(entry->doc_path, doc_path) != 0) {
+        entry = entry->hash_next;
+    }
+    if (entry != NULL && entry->error != 0 && time(0) >= entry->expires) { // Expired negative entry
+        meta_cache_remove(shard, entry);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        pthread_mutex_unlock(&shard->lock);
+        return 1;
+    }
+
+    meta_cache_lru_unlink(shard, entry);
+    meta_cache_lru_push(shard, entry);
+    meta->error = entry->error;
+    if (entry->resolved_path != NULL) {
+        strcpy(meta->resolved_path, entry->resolved_path);
+    }
+    meta->stats = entry->stats;
+    meta->content_type = entry->content_type;
+    pthread_mutex_unlock(&shard->lock);
+
+    return 0;
+}
+
+// Generation of cache contents (changes on every invalidation)
+unsigned long meta_cache_generation()
+{
+    return atomic_load(&generation);
+}
+
+// Add resolved metadata of doc_path to the cache
+void meta_cache_insert(const char* doc_path, const doc_meta_t* meta, unsigned long read_generation)
+{
+    unsigned int hash;
+    meta_cache_shard_t* shard;
+    meta_cache_entry_t* entry;
+    meta_cache_entry_t** link;
+
+    if (shard_capacity == 0 || fs_watch_lost() || (meta->error != 0 && meta->error != ENOENT && meta->error != EACCES) ||
+        (meta->error != 0 && negative_ttl == 0)) {
+        return;
+    }
+
+    if ((entry = (meta_cache_entry_t*)calloc(1, sizeof(meta_cache_entry_t))) == NULL) {
+        return;
+    }
+    entry->doc_path = strdup(doc_path);
+    entry->resolved_path = (meta->error == 0) ? strdup(meta->resolved_path) : NULL;
+    if (entry->doc_path == NULL || (meta->error == 0 && entry->resolved_path == NULL)) {
+        meta_cache_free(entry);
+        return;
+    }
+    entry->error = meta->error;
+    entry->stats = meta->stats;
+    entry->content_type = meta->content_type;
+    entry->expires = time(0) + negative_ttl;
+
+    hash = meta_cache_hash(doc_path);
+    shard = &shards[hash & (META_CACHE_SHARDS - 1)];
+    link = &shard->buckets[(hash / META_CACHE_SHARDS) & (META_CACHE_SHARD_BUCKETS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+
+    // Files changed while document was resolved, result might be stale
+    if (read_generation != atomic_load(&generation)) {
+        pthread_mutex_unlock(&shard->lock);
+        meta_cache_free(entry);
+        return;
+    }
+
+    // Another request could have cached the same doc_path meanwhile
+    while (*link != NULL && strcmp((*link)->doc_path, doc_path) != 0) {
+        link = &(*link)->hash_next;
+    }
+    if (*link != NULL) {
+        meta_cache_remove(shard, *link);
+    }
+
+    // Evict least recently used entries of the shard until new one fits
+    while (shard->lru_tail != NULL && shard->count >= shard_capacity) {
+        meta_cache_remove(shard, shard->lru_tail);
+    }
+
+    link = &shard->buckets[(hash / META_CACHE_SHARDS) & (META_CACHE_SHARD_BUCKETS - 1)];
+    entry->hash_next = *link;
+    *link = entry;
+    meta_cache_lru_push(shard, entry);
+    shard->count++;
+
+    pthread_mutex_unlock(&shard->lock);
+}
+
+// Drop cached metadata of doc_path
+void meta_cache_forget(const char* doc_path)
+{
+    unsigned int hash;
+    meta_cache_shard_t* shard;
+    meta_cache_entry_t* entry;
+
+    if (shard_capacity == 0) {
+        return;
+    }
+
+    hash = meta_cache_hash(doc_path);
+    shard = &shards[hash & (META_CACHE_SHARDS - 1)];
+
+    pthread_mutex_lock(&shard->lock);
+    entry = shard->buckets[(hash / META_CACHE_SHARDS) & (META_CACHE_SHARD_BUCKETS - 1)];
+    while (entry != NULL && strcmp(entry->doc_path, doc_path) != 0) {
+        entry = entry->hash_next;
+    }
+    if (entry != NULL) {
+        meta_cache_remove(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+}
@@ -0,0 +1,164 @@
+#include <metrics.h>
+
+static metrics_shard_t shards[METRICS_SHARDS];
+static atomic_uint next_shard = 0;
+static __thread metrics_shard_t* thread_shard = NULL;
+
+static const char* method_names[METRICS_METHOD_COUNT] = METRICS_METHODS;
+static const http_status_t statuses[METRICS_STATUS_COUNT] = METRICS_STATUSES;
+static const unsigned long latency_bounds[METRICS_LATENCY_BOUND_COUNT] = METRICS_LATENCY_BOUNDS;
+
+// Helper function - shard of calling thread (assigned round-robin on first use)
+metrics_shard_t* metrics_shard()
+{
+    if (thread_shard == NULL) {
+        thread_shard = &shards[atomic_fetch_add_explicit(&next_shard, 1, memory_order_relaxed) & (METRICS_SHARDS - 1)];
+    }
+    return thread_shard;
+}
+
+// Count accepted connection
+void metrics_connection_opened()
+{
+    metrics_shard_t* shard = metrics_shard();
+
+    atomic_fetch_add_explicit(&shard->connections_total, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->connections_active, 1, memory_order_relaxed);
+}
+
+// Count closed connection
+void metrics_connection_closed()
+{
+    atomic_fetch_sub_explicit(&metrics_shard()->connections_active, 1, memory_order_relaxed);
+}
+
+// Count request which couldn't be parsed
+void metrics_parse_failure()
+{
+    atomic_fetch_add_explicit(&metrics_shard()->parse_failures, 1, memory_order_relaxed);
+}
+
+// Count connection closed because it missed its deadline
+void metrics_connection_timeout()
+{
+    atomic_fetch_add_explicit(&metrics_shard()->connection_timeouts, 1, memory_order_relaxed);
+}
+
+// Count connection refused because connection limit was reached
+void metrics_connection_rejected()
+{
+    atomic_fetch_add_explicit(&metrics_shard()->connections_rejected, 1, memory_order_relaxed);
+}
+
+// Count bytes written to client socket
+void metrics_sent_bytes(size_t bytes)
+{
+    atomic_fetch_add_explicit(&metrics_shard()->sent_bytes, bytes, memory_order_relaxed);
+}
+
+// Count fully sent response and its handling latency
+void metrics_response(const char* method, http_status_t status, unsigned long latency_us)
+{
+    metrics_shard_t* shard = metrics_shard();
+    int method_index = METRICS_METHOD_COUNT - 1;
+    int status_index, bucket;
+
+    if (method != NULL && strcmp(method, HTTP_METHOD_GET) == 0) {
+        method_index = 0;
+    } else if (method != NULL && strcmp(method, HTTP_METHOD_HEAD) == 0) {
+        method_index = 1;
+    }
+    for (status_index = 0; status_index < METRICS_STATUS_COUNT && statuses[status_index] != status; status_index++);
+    for (bucket = 0; bucket < METRICS_LATENCY_BOUND_COUNT && latency_us > latency_bounds[bucket]; bucket++);
+
+    if (status_index < METRICS_STATUS_COUNT) {
+        atomic_fetch_add_explicit(&shard->requests[method_index][status_index], 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&shard->latency_buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&shard->latency_sum_us, latency_us, memory_order_relaxed);
+}
+
+// Microseconds of monotonic clock
+unsigned long metrics_now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Helper function - sum counter over all shards (offset of counter within shard)
+unsigned long metrics_sum(size_t offset)
+{
+    unsigned long sum = 0;
+    int i;
+
+    for (i = 0; i < METRICS_SHARDS; i++) {
+        sum += atomic_load_explicit((atomic_ulong*)((char*)&shards[i] + offset), memory_order_relaxed);
+    }
+    return sum;
+}
+
+// Render sum of all shards in Prometheus text exposition format
+size_t metrics_render(char* buf, size_t size)
+{
+    size_t len = 0;
+    unsigned long count = 0;
+    long active = 0;
+    int i, j;
+
+    // Appends formatted text while it fits (len keeps counting past size, so truncation is detectable)
+    #define METRICS_APPEND(...) len += snprintf(buf + ((len < size) ? len : size), (len < size) ? size - len : 0, __VA_ARGS__)
+
+    METRICS_APPEND("# HELP webserver_requests_total Fully sent responses by request method and status code.\n"
+        "# TYPE webserver_requests_total counter\n");
+    for (i = 0; i < METRICS_METHOD_COUNT; i++) {
+        for (j = 0; j < METRICS_STATUS_COUNT; j++) {
+            METRICS_APPEND("webserver_requests_total{method=\"%s\",code=\"%d\"} %lu\n", method_names[i], statuses[j],
+                metrics_sum(offsetof(metrics_shard_t, requests[i][j])));
+        }
+    }
+
+    METRICS_APPEND("# HELP webserver_sent_bytes_total Bytes written to client sockets.\n"
+        "# TYPE webserver_sent_bytes_total counter\n"
+        "webserver_sent_bytes_total %lu\n", metrics_sum(offsetof(metrics_shard_t, sent_bytes)));
+
+    METRICS_APPEND("# HELP webserver_connections_total Accepted client connections.\n"
+        "# TYPE webserver_connections_total counter\n"
+        "webserver_connections_total %lu\n", metrics_sum(offsetof(metrics_shard_t, connections_total)));
+
+    for (i = 0; i < METRICS_SHARDS; i++) {
+        active += atomic_load_explicit(&shards[i].connections_active, memory_order_relaxed);
+    }
+    METRICS_APPEND("# HELP webserver_connections_active Currently open client connections.\n"
+        "# TYPE webserver_connections_active gauge\n"
+        "webserver_connections_active %ld\n", (active > 0) ? active : 0);
+
+    METRICS_APPEND("# HELP webserver_connection_timeouts_total Connections of slow or stalled clients closed for missing their request header or send deadline.\n"
+        "# TYPE webserver_connection_timeouts_total counter\n"
+        "webserver_connection_timeouts_total %lu\n", metrics_sum(offsetof(metrics_shard_t, connection_timeouts)));
+
+    METRICS_APPEND("# HELP webserver_connections_rejected_total Accepted connections closed right away because connection limit was reached.\n"
+        "# TYPE webserver_connections_rejected_total counter\n"
+        "webserver_connections_rejected_total %lu\n", metrics_sum(offsetof(metrics_shard_t, connections_rejected)));
+
+    METRICS_APPEND("# HELP webserver_parse_failures_total Requests rejected as malformed or too long.\n"
+        "# TYPE webserver_parse_failures_total counter\n"
+        "webserver_parse_failures_total %lu\n", metrics_sum(offsetof(metrics_shard_t, parse_failures)));
+
+    METRICS_APPEND("# HELP webserver_request_duration_seconds Time from request received until its response was fully sent.\n"
+        "# TYPE webserver_request_duration_seconds histogram\n");
+    for (i = 0; i <= METRICS_LATENCY_BOUND_COUNT; i++) {
+        count += metrics_sum(offsetof(metrics_shard_t, latency_buckets[i]));
+        if (i < METRICS_LATENCY_BOUND_COUNT) {
+            METRICS_APPEND("webserver_request_duration_seconds_bucket{le=\"%g\"} %lu\n", latency_bounds[i] / 1e6, count);
+        } else {
+            METRICS_APPEND("webserver_request_duration_seconds_bucket{le=\"+Inf\"} %lu\n", count);
+        }
+    }
+    METRICS_APPEND("webserver_request_duration_seconds_sum %.6f\n"
+        "webserver_request_duration_seconds_count %lu\n", metrics_sum(offsetof(metrics_shard_t, latency_sum_us)) / 1e6, count);
+
+    #undef METRICS_APPEND
+    return len;
+}
@@ -0,0 +1,264 @@
+#include <mime.h>
+#include <config.h>
+#include <http.h>
+
+// Types known even without mime.types file
+static const char* builtin_types[][2] = {
+    { "txt",  CONTENT_TEXT_PLAIN },
+    { "htm",  CONTENT_TEXT_HTML },
+    { "html", CONTENT_TEXT_HTML },
+    { "css",  CONTENT_TEXT_CSS },
+    { "ico",  CONTENT_IMG_ICO },
+    { "jpeg", CONTENT_IMG_JPEG },
+    { "jpg",  CONTENT_IMG_JPEG },
+    { "png",  CONTENT_IMG_PNG },
+    { "gif",  CONTENT_IMG_GIF },
+    { "js",   CONTENT_APP_JS },
+    { "xml",  CONTENT_APP_XML },
+    { "bin",  CONTENT_APP_OCTET_STREAM },
+};
+
+// Compiled table (hash and displace): extension hash picks bucket, bucket displacement seed picks slot
+// Built once before any request is handled, read-only afterwards
+static mime_entry_t* slots = NULL; // slot_mask + 1 slots, unused ones have NULL ext
+static unsigned int* displacements = NULL; // bucket_mask + 1 seeds
+static unsigned int slot_mask = 0;
+static unsigned int bucket_mask = 0;
+
+// Helper function - seeded FNV-1a hash of lowercased extension with final avalanche (different seeds give independent hashes)
+unsigned int mime_hash(const char* ext, size_t ext_len, unsigned int seed)
+{
+    unsigned int hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    size_t i;
+
+    for (i = 0; i < ext_len; i++) {
+        hash ^= (unsigned char)((ext[i] >= 'A' && ext[i] <= 'Z') ? ext[i] - 'A' + 'a' : ext[i]);
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+
+    return hash;
+}
+
+// Helper function - add or replace extension in unsorted entry list
+// Returns 0 if successful, 1 on allocation failure
+int mime_add(mime_entry_t** entries, int* count, int* capacity, const char* ext, const char* type)
+{
+    mime_entry_t* grown;
+    int i;
+
+    for (i = 0; i < *count; i++) {
+        if (strcasecmp((*entries)[i].ext, ext) == 0) {
+            (*entries)[i].type = type;
+            return 0;
+        }
+    }
+
+    if (*count == *capacity) {
+        *capacity = (*capacity > 0) ? *capacity * 2 : 64;
+        if ((grown = (mime_entry_t*)realloc(*entries, *capacity * sizeof(mime_entry_t))) == NULL) {
+            return 1;
+        }
+        *entries = grown;
+    }
+    if (((*entries)[*count].ext = strdup(ext)) == NULL) {
+        return 1;
+    }
+    for (i = 0; (*entries)[*count].ext[i] != '\0'; i++) {
+        if ((*entries)[*count].ext[i] >= 'A' && (*entries)[*count].ext[i] <= 'Z') {
+            (*entries)[*count].ext[i] += 'a' - 'A';
+        }
+    }
+    (*entries)[*count].type = type;
+    (*count)++;
+
+    return 0;
+}
+
+// Helper function - parse mime.types-style file into entry list (types are interned for process lifetime)
+// Returns 0 if successful, 1 if not
+int mime_read_file(const char* filename, mime_entry_t** entries, int* count, int* capacity)
+{
+    char line[CONFIG_LINE_MAX];
+    char type_buf[MIME_TYPE_MAX];
+    char ext_buf[MIME_EXT_MAX];
+    char* type;
+    char* token;
+    char* save_ptr;
+    int line_num = 0;
+    FILE* file;
+
+    if ((file = fopen(filename, "r")) == NULL) {
+        printf("[ERROR] [mime_load] Failed to open MIME types file \"%s\", error: %s\n", filename, strerror(errno));
+        return 1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_num++;
+        if ((token = strchr(line, '#')) != NULL) {
+            *token = '\0';
+        }
+        if ((token = strtok_r(line, " \t\r\n", &save_ptr)) == NULL) {
+            continue; // Blank line or comment
+        }
+        if (strlen(token) >= MIME_TYPE_MAX || strchr(token, '/') == NULL) {
+            printf("[ERROR] [mime_load] Invalid Content-Type \"%s\" on line %d of \"%s\"\n", token, line_num, filename);
+            fclose(file);
+            return 1;
+        }
+        strcpy(type_buf, token);
+        type = NULL;
+
+        while ((token = strtok_r(NULL, " \t\r\n;", &save_ptr)) != NULL) {
+            if (*token == '.') {
+                token++;
+            }
+            if (*token == '\0' || strlen(token) >= MIME_EXT_MAX) {
+                printf("[ERROR] [mime_load] Invalid extension \"%s\" on line %d of \"%s\"\n", token, line_num, filename);
+                fclose(file);
+                return 1;
+            }
+            strcpy(ext_buf, token);
+            if (type == NULL && (type = strdup(type_buf)) == NULL) {
+                fclose(file);
+                return 1;
+            }
+            if (mime_add(entries, count, capacity, ext_buf, type) != 0) {
+                fclose(file);
+                return 1;
+            }
+        }
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Helper function - compile entry list into hash and displace table
+// Buckets are placed largest first, each one tries displacement seeds until all its extensions land in free slots
+// Returns 0 if successful, 1 if not
+int mime_compile(mime_entry_t* entries, int count)
+{
+    unsigned int slot_count = 1;
+    unsigned int bucket_count = 1;
+    unsigned int* members; // Entry indexes grouped by bucket
+    unsigned int* bucket_start; // Start of every bucket's group in members (bucket_count + 1 offsets)
+    unsigned int* order; // Buckets sorted by size (descending)
+    unsigned int* fill; // Grouped entries of every bucket
+    unsigned int* trial; // Slots taken by currently placed bucket
+    unsigned int seed = 1, slot, bucket, size, tmp;
+    unsigned int i, j, k;
+
+    // Load factor at most 1/2 and 4 extensions per bucket on average keep seed search short
+    while (slot_count < (unsigned int)count * 2) { slot_count <<= 1; }
+    while (bucket_count * 4 < (unsigned int)count) { bucket_count <<= 1; }
+
+    slots = (mime_entry_t*)calloc(slot_count, sizeof(mime_entry_t));
+    displacements = (unsigned int*)calloc(bucket_count, sizeof(unsigned int));
+    members = (unsigned int*)calloc(count + 1, sizeof(unsigned int));
+    bucket_start = (unsigned int*)calloc(bucket_count + 1, sizeof(unsigned int));
+    order = (unsigned int*)calloc(bucket_count, sizeof(unsigned int));
+    fill = (unsigned int*)calloc(bucket_count, sizeof(unsigned int));
+    trial = (unsigned int*)calloc(count + 1, sizeof(unsigned int));
+    if (slots == NULL || displacements == NULL || members == NULL || bucket_start == NULL || order == NULL || fill == NULL || trial == NULL) {
+        free(members); free(bucket_start); free(order); free(fill); free(trial);
+        return 1;
+    }
+    slot_mask = slot_count - 1;
+    bucket_mask = bucket_count - 1;
+
+    // Group entries by bucket (counting sort)
+    for (i = 0; i < (unsigned int)count; i++) {
+        bucket_start[(mime_hash(entries[i].ext, strlen(entries[i].ext), 0) & bucket_mask) + 1]++;
+    }
+    for (i = 0; i < bucket_count; i++) {
+        bucket_start[i + 1] += bucket_start[i];
+        order[i] = i;
+    }
+    for (i = 0; i < (unsigned int)count; i++) {
+        bucket = mime_hash(entries[i].ext, strlen(entries[i].ext), 0) & bucket_mask;
+        members[bucket_start[bucket] + fill[bucket]++] = i;
+    }
+    for (i = 1; i < bucket_count; i++) { // Insertion sort, only done once at startup
+        for (j = i; j > 0 && bucket_start[order[j - 1] + 1] - bucket_start[order[j - 1]] < bucket_start[order[j] + 1] - bucket_start[order[j]]; j--) {
+            tmp = order[j]; order[j] = order[j - 1]; order[j - 1] = tmp;
+        }
+    }
+
+    for (i = 0; i < bucket_count && seed != 0; i++) {
+        bucket = order[i];
+        if ((size = bucket_start[bucket + 1] - bucket_start[bucket]) == 0) {
+            break;
+        }
+
+        for (seed = 1; seed != 0; seed++) {
+            for (j = 0; j < size; j++) {
+                slot = mime_hash(entries[members[bucket_start[bucket] + j]].ext, strlen(entries[members[bucket_start[bucket] + j]].ext), seed) & slot_mask;
+                for (k = 0; k < j && trial[k] != slot; k++);
+                if (slots[slot].ext != NULL || k < j) {
+                    break;
+                }
+                trial[j] = slot;
+            }
+            if (j == size) {
+                break;
+            }
+        }
+
+        displacements[bucket] = seed;
+        for (j = 0; j < size && seed != 0; j++) {
+            slots[trial[j]] = entries[members[bucket_start[bucket] + j]];
+        }
+    }
+
+    free(members); free(bucket_start); free(order); free(fill); free(trial);
+    return (seed != 0) ? 0 : 1; // Exhausted every displacement seed, can't really happen
+}
+
+// Build extension lookup table
+int mime_load(const char* filename)
+{
+    mime_entry_t* entries = NULL;
+    int count = 0;
+    int capacity = 0;
+    int i;
+
+    for (i = 0; i < (int)(sizeof(builtin_types) / sizeof(builtin_types[0])); i++) {
+        if (mime_add(&entries, &count, &capacity, builtin_types[i][0], builtin_types[i][1]) != 0) {
+            printf("[ERROR] [mime_load] Failed to allocate MIME types table\n");
+            return 1;
+        }
+    }
+
+    if (filename != NULL && filename[0] != '\0' && mime_read_file(filename, &entries, &count, &capacity) != 0) {
+        return 1;
+    }
+
+    if (mime_compile(entries, count) != 0) {
+        printf("[ERROR] [mime_load] Failed to build MIME types table\n");
+        return 1;
+    }
+    free(entries); // Extension strings now belong to slots
+
+    printf("[INFO] [mime_load] Loaded %d MIME type extensions (%u slots)\n", count, slot_mask + 1);
+    return 0;
+}
+
+// Get Content-Type of extension
+const char* mime_lookup(const char* ext, size_t ext_len)
+{
+    const mime_entry_t* entry;
+
+    if (slots == NULL) {
+        return NULL;
+    }
+
+    entry = &slots[mime_hash(ext, ext_len, displacements[mime_hash(ext, ext_len, 0) & bucket_mask]) & slot_mask];
+    if (entry->ext == NULL || strncasecmp(entry->ext, ext, ext_len) != 0 || entry->ext[ext_len] != '\0') {
+        return NULL;
+    }
+
+    return entry->type;
+}
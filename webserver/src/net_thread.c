@@ -1,24 +1,50 @@
 #include <net_thread.h>
 #include <common.h>
 #include <http.h>
+#include <conn.h>
+#include <worker_pool.h>
+#include <handoff.h>
+#include <drain.h>
+#include <conf_snapshot.h>
+#include <log.h>
 
-// Starts thread-based web listening, requests get split off in their own separate threads
-// Returns exit-error
-int thread_listen(config_t* conf)
+// Create, bind and start listening on IPv4 server socket for conf->port (or take over inherited one bound to it)
+// Listening socket never blocks: event loops accept until EAGAIN, blocking modes poll it together with drain notification
+// (io_uring accept still waits for next connection, kernel polls non-blocking socket for it)
+// Returns listening socket, -1 on failure
+int open_listen_socket(const config_t* conf, int reuse_port)
 {
-    pthread_t thread_id;
-    thread_data_t* td;
-    socklen_t socklen; // Sizeof(sockaddr_in)
-    int listen_sock, client_sock;
-    struct sockaddr_in server, client;
+    int listen_sock;
+    int enable = 1;
+    struct sockaddr_in server;
     char server_ip_str[INET_ADDRSTRLEN];
-    char client_ip_str[INET_ADDRSTRLEN];
+
+    // Socket inherited from previous instance (or systemd) is already bound and queues connections, only its backlog is reapplied
+    if ((listen_sock = handoff_take_listen_socket(conf->port)) >= 0) {
+        listen(listen_sock, conf->listen_backlog);
+        fcntl(listen_sock, F_SETFL, fcntl(listen_sock, F_GETFL, 0) | O_NONBLOCK);
+        handoff_add_listen_socket(listen_sock);
+        log_msg(LOG_LEVEL_INFO, "[open_listen_socket] Server listening for connections on inherited socket [port %d]...", conf->port);
+        return listen_sock;
+    }
 
     // Create listening socket
-    listen_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP); // We want TCP protocol for HTTP
+    listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP); // We want TCP protocol for HTTP
     if (listen_sock == -1) {
-        printf("[ERROR] [thread_listen] Failed to create listening sock, error: %s\n", strerror(errno));
-        return 1;
+        log_msg(LOG_LEVEL_ERROR, "[open_listen_socket] Failed to create listening sock, error: %s", strerror(errno));
+        return -1;
+    }
+
+    // Restarted server must be able to bind port while connections of its previous run are still in TIME_WAIT
+    if (setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) < 0) {
+        log_msg(LOG_LEVEL_WARN, "[open_listen_socket] Failed to enable SO_REUSEADDR, error: %s", strerror(errno));
+    }
+
+    // Several sockets bound to the same port, kernel spreads incoming connections between them
+    if (reuse_port && setsockopt(listen_sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[open_listen_socket] Failed to enable SO_REUSEPORT, error: %s", strerror(errno));
+        close(listen_sock);
+        return -1;
     }
 
     // Setup listening socket's sockeaddr_in
@@ -29,128 +55,203 @@ int thread_listen(config_t* conf)
 
     // Bind listening socket
     if ( bind(listen_sock, (struct sockaddr*)&server, sizeof(server)) < 0 ) {
-        printf("[ERROR] [thread_listen] Failed to bind listening sock [%s:%d], error: %s\n", server_ip_str, ntohs(server.sin_port), strerror(errno));
-        return 1;
+        log_msg(LOG_LEVEL_ERROR, "[open_listen_socket] Failed to bind listening sock [%s:%d], error: %s", server_ip_str, ntohs(server.sin_port), strerror(errno));
+        close(listen_sock);
+        return -1;
     }
 
-    // Turn on listening mode (can queue up to SOMAXCONN connections for listening)
-    listen(listen_sock, SOMAXCONN);
+    // Turn on listening mode (can queue up to conf->listen_backlog connections, capped by kernel at net.core.somaxconn)
+    listen(listen_sock, conf->listen_backlog);
+    fcntl(listen_sock, F_SETFL, fcntl(listen_sock, F_GETFL, 0) | O_NONBLOCK);
+    handoff_add_listen_socket(listen_sock);
+    log_msg(LOG_LEVEL_INFO, "[open_listen_socket] Server [%s:%d] listening for connections...", server_ip_str, ntohs(server.sin_port));
+
+    return listen_sock;
+}
 
-    // While we can accept new socket connections without issue (non-zero client_sock), continue listen/accept loop
-    socklen = (socklen_t)sizeof(struct sockaddr_in);
-    printf("[INFO] [thread_listen] Server [%s:%d] listening for connections...\n", server_ip_str, ntohs(server.sin_port));
+// Helper function - wait for and accept next client connection (retrying on interrupts and aborted handshakes)
+// Listening socket is polled together with drain notification, and may be shared with other processes (handoff),
+// so connection signalled by poll(...) can be taken by another process already (non-blocking accept then fails with EAGAIN)
+// flags: accept4(...) flags of client socket besides SOCK_CLOEXEC (SOCK_NONBLOCK for worker pool)
+// Returns client socket, -1 on failure or when server starts draining
+int accept_client(int listen_sock, int flags, const char* caller)
+{
+    struct pollfd fds[2];
+    int client_sock;
+    socklen_t socklen;
+    struct sockaddr_storage client;
+    char client_ip_str[INET6_ADDRSTRLEN];
+    int client_port;
 
-    while ( (client_sock = accept(listen_sock, (struct sockaddr*)&client, &socklen)) ) {
-        // For debug logging
-        inet_ntop( AF_INET, &client.sin_addr, client_ip_str, INET_ADDRSTRLEN );
-        printf("[INFO] [thread_listen] Accepted connection: [%s:%d] -> [%s:%d]\n", client_ip_str, ntohs(client.sin_port), server_ip_str, ntohs(server.sin_port));
+    fds[0].fd = listen_sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = drain_event_fd();
+    fds[1].events = POLLIN;
 
-        // Allocate and setup thread data (it will be freed by the thread)
-        td = (thread_data_t*)malloc(sizeof(thread_data_t));
-        td->socket_id = client_sock;
-        td->conf = conf;
+    while (1) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_msg(LOG_LEVEL_ERROR, "[%s] Failed to poll listening socket, error: %s", caller, strerror(errno));
+            return -1;
+        }
+        if (fds[1].revents != 0) {
+            return -1;
+        }
 
-        // Create request handling thread and handoff newly allocated thread_data object
-        if ( pthread_create(&thread_id, NULL, thread_handle_request, (void*) td) < 0 ) {
-            printf("[ERROR] [thread_listen] Failed to pthread_create request handler thread, error: %s\n", strerror(errno));
-            return 1;
+        socklen = (socklen_t)sizeof(client);
+        client_sock = accept4(listen_sock, (struct sockaddr*)&client, &socklen, SOCK_CLOEXEC | flags);
+        if (client_sock >= 0) {
+            break;
+        }
+        if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN && errno != EWOULDBLOCK) {
+            log_msg(LOG_LEVEL_ERROR, "[%s] Failed to accept client connection, error: %s", caller, strerror(errno));
+            return -1;
         }
     }
 
-    if (client_sock < 0) {
-        printf("[ERROR] [thread_listen] Failed to accept client connection, error: %s\n", strerror(errno));
-        return 1;
+    // For debug logging (skipped completely when info messages are off)
+    if (log_enabled(LOG_LEVEL_INFO)) {
+        client_port = conn_addr_str(&client, client_ip_str, sizeof(client_ip_str));
+        log_msg(LOG_LEVEL_INFO, "[%s] Accepted connection: [%s:%d]", caller, client_ip_str, client_port);
     }
 
-    return 0;
+    return client_sock;
 }
 
-// Request processing function for POSIX thread
-void* thread_handle_request(void* thread_data)
+// Stack size of connection serving threads (configured one, or system default which threads get without it)
+size_t thread_stack_bytes(const config_t* conf)
 {
-    // Stack variable declarations
-    http_request_t request;
-    int terminated = 0; // Flag for message termination when encountering \r\n\r\n or \n\n
-    int too_big = 0; // Flag for message being too big (no termination and exceeded buffer size)
-    int read_bytes;
-    char byte1 = '\0', byte2 = '\0', byte3 = '\0', byte4 = '\0'; // For determining HTTP request termination
-    int sbuffer_itr = 0;
-    int message_itr = 0;
-    int response_send_ec = 0; // Response sending exit code
-    char socket_buffer[CONF_SOCK_BUFSIZE+1];
-    char message_buffer[CONF_REQ_BUFSIZE+1];
-    memset(message_buffer, 0, CONF_REQ_BUFSIZE+1); // Make sure message buffer is 100% clear/clean
-
-    // Cast void* back to proper type
-    thread_data_t* td = (thread_data_t*) thread_data;
-
-    // Begin read-loop
-    // Example request from client:
-    /*
-        GET /index.html HTTP/1.0\r\n
-        Host: www.example.com\r\n
-        \r\n
-    */
-    while ( (read_bytes = recv(td->socket_id, socket_buffer, CONF_SOCK_BUFSIZE, 0)) > 0 ) {
-        // Delimiter at the end of received bytes
-        socket_buffer[read_bytes] = '\0';
-        sbuffer_itr = 0;
-
-        // Go through bytes, check for termination, otherwise write to message buffer
-        while (socket_buffer[sbuffer_itr] != '\0') {
-            // Message too big (return 400 - Bad Request)
-            if (message_itr > CONF_REQ_BUFSIZE) {
-                too_big = 1;
-                break;
-            }
+    pthread_attr_t thread_attr;
+    size_t stack_size = conf->thread_stack_size;
 
-            // This shifts and saves last 4 bytes during iteration
-            byte4 = byte3; byte3 = byte2; byte2 = byte1;
-            byte1 = socket_buffer[sbuffer_itr];
+    if (stack_size == 0) {
+        pthread_attr_init(&thread_attr);
+        pthread_attr_getstacksize(&thread_attr, &stack_size);
+        pthread_attr_destroy(&thread_attr);
+    }
 
-            // Write to message buffer
-            message_buffer[message_itr] = socket_buffer[sbuffer_itr];
+    return stack_size;
+}
 
-            // Termination signal: \r\n\r\n (correct) or \n\n (tolerant)
-            if ((byte4 == '\r' && byte3 == '\n' && byte2 == '\r' && byte1 == '\n') || (byte2 == '\n' && byte1 == '\n')) {
-                terminated = 1;
-                break;
-            }
+// Setup attributes of connection serving threads (stack size of conf->thread_stack_size, unless it is 0)
+void init_thread_attr(pthread_attr_t* thread_attr, const config_t* conf)
+{
+    pthread_attr_init(thread_attr);
+    if (conf->thread_stack_size > 0 && pthread_attr_setstacksize(thread_attr, conf->thread_stack_size) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[init_thread_attr] Failed to set thread stack size %zu, using system default", conf->thread_stack_size);
+    }
+}
 
-            sbuffer_itr++;
-            message_itr++;
-        }
+// Starts thread-based web listening, requests get split off in their own separate threads
+// Returns exit-error
+int thread_listen(config_t* conf)
+{
+    pthread_t thread_id;
+    pthread_attr_t thread_attr;
+    conn_t* conn;
+    int listen_sock, client_sock;
 
-        // If request was too long (no termination detected), return 400 - Bad Request
-        if (too_big == 1) {
-            response_send_ec = send_http_error_response(td->socket_id, td->conf, NULL, HTTP_STATUS_BADREQUEST);
-            break;
+    if ((listen_sock = open_listen_socket(conf, 0)) < 0) {
+        return 1;
+    }
+
+    handoff_ready();
+
+    // Request threads are never joined, so they are created detached (their resources are released when they exit)
+    init_thread_attr(&thread_attr, conf);
+    pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_DETACHED);
+
+    // While we can accept new socket connections without issue, continue listen/accept loop
+    while ( (client_sock = accept_client(listen_sock, 0, "thread_listen")) >= 0 ) {
+        // Connection object is taken before its thread is created, so connections over the limit never cost a thread
+        if ((conn = conn_create(client_sock)) == NULL) {
+            conn_create_failed(client_sock);
+            close(client_sock);
+            continue;
         }
 
-        if (terminated == 1) {
-            printf("[INFO] [socket: %d] Received %ld content-length request payload\n", td->socket_id, strlen(message_buffer));
-            if (parse_http_request(message_buffer, &request) == 0) { 
-                response_send_ec = send_http_response(td->socket_id, td->conf, &request);
-            } else {
-                response_send_ec = send_http_error_response(td->socket_id, td->conf, NULL, HTTP_STATUS_BADREQUEST);
-            }
-            break;
+        // Create request handling thread and handoff connection object (it will be destroyed by the thread)
+        if ( pthread_create(&thread_id, &thread_attr, thread_handle_request, (void*) conn) != 0 ) {
+            log_msg(LOG_LEVEL_ERROR, "[thread_listen] Failed to pthread_create request handler thread, dropping connection");
+            conn_destroy(conn); // Closes the socket/connection
         }
     }
 
-    // Check if something bad happened to connection
-    if (read_bytes < 0) {
-        printf("[ERROR] [socket: %d] Connection issue, error: %s\n", td->socket_id, strerror(errno));
+    if (!draining()) {
+        return 1;
+    }
+    close(listen_sock);
+    drain_finish();
+    return 0;
+}
+
+// Starts worker pool based web listening, accepted sockets are pushed to a fixed-size work-stealing pool
+// Returns exit-error
+int pool_listen(config_t* conf)
+{
+    worker_pool_t* pool;
+    struct timespec interval = { 0, DRAIN_POLL_MS * 1000000L };
+    int listen_sock, client_sock;
+
+    if ((listen_sock = open_listen_socket(conf, 0)) < 0) {
+        return 1;
+    }
+
+    if ((pool = worker_pool_create(conf, conf->pool_size, conf->pool_queue_depth)) == NULL) {
+        log_msg(LOG_LEVEL_ERROR, "[pool_listen] Failed to create worker pool");
+        return 1;
     }
+    log_msg(LOG_LEVEL_INFO, "[pool_listen] Started worker pool of %d workers (queue depth %d)", conf->pool_size, conf->pool_queue_depth);
+    handoff_ready();
 
-    // Check if response was formed and sent successfully
-    if (response_send_ec != 0) {
-        printf("[ERROR] [socket: %d] Failed to send HTTP response, error: %s\n", td->socket_id, strerror(errno));
+    // Accept loop, blocks in worker_pool_push(...) when all workers are busy and their deques are full
+    while ( (client_sock = accept_client(listen_sock, SOCK_NONBLOCK, "pool_listen")) >= 0 ) {
+        worker_pool_push(pool, client_sock);
     }
 
-    // Cleanup and exit
-    close(td->socket_id); // Close the socket/connection
-    free(td); // Free thread_data object memory from heap
+    if (!draining()) {
+        return 1;
+    }
+    close(listen_sock);
+
+    // Sockets still queued in the pool have no connection object yet, so they are waited for before connections are
+    while (worker_pool_busy(pool) > 0 && !drain_expired()) {
+        nanosleep(&interval, NULL);
+    }
+    drain_finish();
+    return 0;
+}
+
+// Serve client connection on blocking socket (connection state machine runs in one go until connection is finished)
+// Deadlines are enforced with socket timeouts: receive timeout is set to time left before every receive,
+// send timeout makes blocked send give up when client takes no bytes for conf->send_timeout seconds
+void serve_conn(conn_t* conn)
+{
+    struct timeval send_timeout;
+
+    conn->blocking = 1;
+    conn->conf = conf_current(); // Connection thread of thread mode reads snapshot it holds itself, not accepting thread's one
+
+    send_timeout.tv_sec = conn->conf->send_timeout;
+    send_timeout.tv_usec = 0;
+    if (setsockopt(conn->socket_id, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout)) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[socket: %d] Failed to set send timeout, error: %s", conn->socket_id, strerror(errno));
+    }
+
+    // Returns before CONN_STATE_CLOSE only when connection missed its deadline
+    if (conn_process(conn) != CONN_STATE_CLOSE) {
+        conn_timed_out(conn);
+    }
+    conn_destroy(conn); // Closes the socket/connection
+}
+
+// Request processing function for POSIX thread
+void* thread_handle_request(void* conn)
+{
+    serve_conn((conn_t*) conn);
+
     //pthread_exit(NULL); // Exit this pthread, causes issues when running with chroot
     return NULL;
-}
\ No newline at end of file
+}
@@ -0,0 +1,69 @@
+#include <signals.h>
+#include <http.h>
+#include <log.h>
+#include <conf_snapshot.h>
+#include <handoff.h>
+#include <drain.h>
+
+// Helper function - fill set with signals handled by signal thread
+void handled_signals(sigset_t* set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGHUP);
+    sigaddset(set, SIGUSR2);
+    sigaddset(set, SIGQUIT);
+    sigaddset(set, SIGTERM);
+}
+
+// Signal thread function - wait for handled signals and act on them
+void* signal_thread_run(void* unused)
+{
+    sigset_t set;
+    int sig;
+
+    handled_signals(&set);
+    while (1) {
+        if (sigwait(&set, &sig) != 0) {
+            continue;
+        }
+
+        if (sig == SIGHUP) {
+            log_msg(LOG_LEVEL_INFO, "[signal_thread_run] SIGHUP received, reloading config file and error pages ...");
+            conf_reload();
+            load_http_error_pages();
+        } else if (sig == SIGUSR2) {
+            log_msg(LOG_LEVEL_INFO, "[signal_thread_run] SIGUSR2 received, handing listening sockets over to new server instance ...");
+            handoff_exec();
+        } else if (sig == SIGQUIT || sig == SIGTERM) {
+            log_msg(LOG_LEVEL_INFO, "[signal_thread_run] %s received, shutting down gracefully ...", (sig == SIGQUIT) ? "SIGQUIT" : "SIGTERM");
+            drain_start();
+        }
+    }
+
+    return NULL;
+}
+
+// Block handled signals and start signal handling thread
+int start_signal_thread()
+{
+    pthread_t thread_id;
+    sigset_t set;
+
+    // Peer closing connection during sendfile(...)/splice(...) (they have no MSG_NOSIGNAL), e.g. stalled client giving up,
+    // must fail only that send with EPIPE instead of killing the whole server
+    signal(SIGPIPE, SIG_IGN);
+
+    handled_signals(&set);
+    if (pthread_sigmask(SIG_BLOCK, &set, NULL) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[start_signal_thread] Failed to block handled signals");
+        return 1;
+    }
+
+    if (pthread_create(&thread_id, NULL, signal_thread_run, NULL) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[start_signal_thread] Failed to pthread_create signal thread");
+        return 1;
+    }
+    pthread_detach(thread_id);
+
+    return 0;
+}
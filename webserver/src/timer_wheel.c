@@ -0,0 +1,136 @@
+#include <timer_wheel.h>
+
+// Milliseconds of monotonic clock
+unsigned long timer_now_ms()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now); // Few milliseconds resolution is plenty for 100ms ticks, and it is cheaper
+    return (unsigned long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Setup empty wheel starting at now_ms
+void timer_wheel_init(timer_wheel_t* wheel, unsigned long now_ms)
+{
+    memset(wheel->slots, 0, sizeof(wheel->slots));
+    wheel->now = now_ms / TIMER_WHEEL_TICK_MS;
+    wheel->count = 0;
+}
+
+// Setup timer which is not scheduled yet
+void wheel_timer_init(wheel_timer_t* timer, void* data)
+{
+    timer->expires = 0;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->data = data;
+}
+
+// Helper function - link timer into slot matching its distance from current tick
+// (level 0 holds timers of next TIMER_WHEEL_SLOTS ticks, each level above holds TIMER_WHEEL_SLOTS times longer distances)
+void timer_wheel_link(timer_wheel_t* wheel, wheel_timer_t* timer)
+{
+    unsigned long delta = timer->expires - wheel->now;
+    wheel_timer_t** slot;
+    int level = 0;
+
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1UL << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    slot = &wheel->slots[level][(timer->expires >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+
+    timer->next = *slot;
+    if (*slot != NULL) {
+        (*slot)->pprev = &timer->next;
+    }
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+// Helper function - unlink timer from its slot
+void timer_wheel_unlink(wheel_timer_t* timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+// (Re)schedule timer to fire at deadline_ms
+void timer_wheel_schedule(timer_wheel_t* wheel, wheel_timer_t* timer, unsigned long deadline_ms)
+{
+    unsigned long expires = (deadline_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    unsigned long max_delta = (1UL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+
+    if (expires <= wheel->now) {
+        expires = wheel->now + 1;
+    } else if (expires - wheel->now > max_delta) {
+        expires = wheel->now + max_delta;
+    }
+
+    // Rescheduling with unchanged deadline (most state changes of connection) keeps timer where it is
+    if (timer->pprev != NULL) {
+        if (timer->expires == expires) {
+            return;
+        }
+        timer_wheel_unlink(timer);
+        wheel->count--;
+    }
+
+    timer->expires = expires;
+    timer_wheel_link(wheel, timer);
+    wheel->count++;
+}
+
+// Cancel timer
+void timer_wheel_cancel(timer_wheel_t* wheel, wheel_timer_t* timer)
+{
+    if (timer->pprev != NULL) {
+        timer_wheel_unlink(timer);
+        wheel->count--;
+    }
+}
+
+// Advance wheel to now_ms
+wheel_timer_t* timer_wheel_advance(timer_wheel_t* wheel, unsigned long now_ms)
+{
+    unsigned long now = now_ms / TIMER_WHEEL_TICK_MS;
+    wheel_timer_t* fired = NULL;
+    wheel_timer_t* timer;
+    wheel_timer_t* cascaded;
+    int level;
+
+    // Nothing can fire on an empty wheel, skip idle ticks at once
+    if (wheel->count == 0) {
+        if (now > wheel->now) {
+            wheel->now = now;
+        }
+        return NULL;
+    }
+
+    while (wheel->now < now) {
+        wheel->now++;
+
+        // Whenever lower level completes a lap, timers of next slot above are re-linked closer to their deadline
+        for (level = 1; level < TIMER_WHEEL_LEVELS && (wheel->now & ((1UL << (TIMER_WHEEL_BITS * level)) - 1)) == 0; level++) {
+            cascaded = wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)];
+            wheel->slots[level][(wheel->now >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)] = NULL;
+            while ((timer = cascaded) != NULL) {
+                cascaded = timer->next;
+                timer_wheel_link(wheel, timer);
+            }
+        }
+
+        // Every timer left in current level 0 slot expires at this tick
+        while ((timer = wheel->slots[0][wheel->now & (TIMER_WHEEL_SLOTS - 1)]) != NULL) {
+            timer_wheel_unlink(timer);
+            wheel->count--;
+            timer->next = fired;
+            fired = timer;
+        }
+    }
+
+    return fired;
+}
@@ -0,0 +1,502 @@
+#include <uring_loop.h>
+#include <event_loop.h>
+#include <net_thread.h>
+#include <handoff.h>
+#include <drain.h>
+#include <log.h>
+#include <metrics.h>
+
+// Operations required from kernel, otherwise server falls back to epoll
+static const int required_ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SENDMSG, IORING_OP_SPLICE, IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL };
+
+// Helper function - io_uring_setup(2) (no libc wrapper)
+int uring_sys_setup(unsigned entries, struct io_uring_params* params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+// Helper function - io_uring_enter(2) (no libc wrapper)
+int uring_sys_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Helper function - check that kernel supports every operation this loop submits
+// Returns 0 if all are supported, 1 otherwise
+int uring_probe_ops(int ring_fd)
+{
+    struct io_uring_probe* probe;
+    size_t probe_size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    unsigned i;
+    int op;
+
+    if ((probe = (struct io_uring_probe*)calloc(1, probe_size)) == NULL) {
+        return 1;
+    }
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        free(probe);
+        return 1;
+    }
+
+    for (i = 0; i < sizeof(required_ops) / sizeof(required_ops[0]); i++) {
+        op = required_ops[i];
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            free(probe);
+            return 1;
+        }
+    }
+
+    free(probe);
+    return 0;
+}
+
+// Helper function - create io_uring instance and map its queues
+// Returns 0 on success, 1 if io_uring is not available
+int uring_init(uring_t* ring)
+{
+    struct io_uring_params params;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = URING_CQ_ENTRIES;
+    if ((ring->ring_fd = uring_sys_setup(URING_SQ_ENTRIES, &params)) < 0) {
+        return 1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) || uring_probe_ops(ring->ring_fd) != 0) {
+        close(ring->ring_fd);
+        errno = ENOSYS;
+        return 1;
+    }
+
+    // Submission and completion rings share one mapping (IORING_FEAT_SINGLE_MMAP), entries have their own
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (ring->cq_ring_size > ring->sq_ring_size) {
+        ring->sq_ring_size = ring->cq_ring_size;
+    }
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->ring_fd);
+        return 1;
+    }
+    ring->cq_ring = ring->sq_ring;
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->ring_fd);
+        return 1;
+    }
+
+    ring->sq_head = (unsigned*)((char*)ring->sq_ring + params.sq_off.head);
+    ring->sq_tail = (unsigned*)((char*)ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)((char*)ring->sq_ring + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->cq_head = (unsigned*)((char*)ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned*)((char*)ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+    ring->to_submit = 0;
+
+    return 0;
+}
+
+// Helper function - pass queued entries to kernel and wait for at least wait_for completions
+// Returns 0 on success, 1 on failure
+int uring_submit(uring_t* ring, unsigned wait_for)
+{
+    int submitted;
+
+    while (1) {
+        submitted = uring_sys_enter(ring->ring_fd, ring->to_submit, wait_for, wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            ring->to_submit -= submitted;
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return 1;
+        }
+        if (errno != EINTR) { // Completion queue is backed up, entries are submitted once completions are reaped
+            return 0;
+        }
+    }
+}
+
+// Helper function - get next free submission entry (submits queued entries first if queue is full)
+// Returns zeroed entry, NULL on failure
+struct io_uring_sqe* uring_get_sqe(uring_t* ring)
+{
+    struct io_uring_sqe* sqe;
+    unsigned tail = *ring->sq_tail;
+    unsigned index;
+
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+        if (uring_submit(ring, 0) != 0 || tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    index = tail & *ring->sq_mask;
+    sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ring->to_submit++;
+
+    return sqe;
+}
+
+// Helper function - queue accept of next client connection
+int uring_queue_accept(uring_t* ring, int listen_sock, struct sockaddr_storage* client, socklen_t* socklen)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_get_sqe(ring)) == NULL) {
+        return 1;
+    }
+    *socklen = sizeof(*client);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_sock;
+    sqe->addr = (unsigned long)client;
+    sqe->addr2 = (unsigned long)socklen;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_TAG_ACCEPT;
+    return 0;
+}
+
+// Helper function - queue cancellation of pending accept (draining server stops accepting)
+int uring_queue_accept_cancel(uring_t* ring)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_get_sqe(ring)) == NULL) {
+        return 1;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = URING_TAG_ACCEPT;
+    sqe->user_data = URING_TAG_CANCEL;
+    return 0;
+}
+
+// Helper function - queue timeout of one timer wheel tick (wakes loop up for connection deadline checks)
+int uring_queue_timeout(uring_t* ring, struct __kernel_timespec* timeout)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = uring_get_sqe(ring)) == NULL) {
+        return 1;
+    }
+    timeout->tv_sec = 0;
+    timeout->tv_nsec = TIMER_WHEEL_TICK_MS * 1000000L;
+    sqe->opcode = IORING_OP_TIMEOUT;
+    sqe->fd = -1;
+    sqe->addr = (unsigned long)timeout;
+    sqe->len = 1; // One timespec (kernel rejects anything else)
+    sqe->off = 0; // Completion count 0 - pure timer, other completions don't make it fire early
+    sqe->user_data = URING_TAG_TIMEOUT;
+    return 0;
+}
+
+// Helper function - queue next operation for connection matching its state
+// (receive more request bytes, or continue sending queued responses)
+// Returns 0 on success, 1 on failure
+int uring_queue_conn(uring_t* ring, uring_conn_t* uconn)
+{
+    conn_t* conn = uconn->conn;
+    http_response_t* response;
+    struct io_uring_sqe* sqe;
+    int batch_len;
+
+    if ((sqe = uring_get_sqe(ring)) == NULL) {
+        return 1;
+    }
+    sqe->user_data = (unsigned long)uconn;
+
+    if (conn->state == CONN_STATE_READ) {
+        uconn->op = URING_OP_RECV;
+        sqe->opcode = IORING_OP_RECV;
+        sqe->fd = conn->socket_id;
+        sqe->addr = (unsigned long)(conn->request_buf + conn->request_len);
+        sqe->len = conn->conf->request_buffer_size - conn->request_len;
+        return 0;
+    }
+
+    // In-memory segments of consecutive responses go out in single gathered write
+    // (multi-range response first loads its next part, if current one is done)
+    response = &conn->responses[conn->response_sent];
+    next_http_response_part(response);
+    batch_len = gather_http_responses(response, conn->response_count - conn->response_sent, uconn->batch, HTTP_SEND_BATCH_IOV_MAX);
+    if (batch_len > 0) {
+        memset(&uconn->msg, 0, sizeof(uconn->msg));
+        uconn->msg.msg_iov = uconn->batch;
+        uconn->msg.msg_iovlen = batch_len;
+        uconn->op = URING_OP_SENDMSG;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn->socket_id;
+        sqe->addr = (unsigned long)&uconn->msg;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL | (http_responses_continue(response, conn->response_count - conn->response_sent) ? MSG_MORE : 0);
+        return 0;
+    }
+
+    // Document file body goes file -> pipe -> socket (page references are moved, not copied)
+    if (response->body_pipe[0] < 0 && pipe2(response->body_pipe, O_CLOEXEC) != 0) {
+        return 1;
+    }
+    if (response->body_piped == 0) {
+        uconn->op = URING_OP_SPLICE_IN;
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = response->body_fd;
+        sqe->splice_off_in = response->body_offset;
+        sqe->fd = response->body_pipe[1];
+        sqe->off = (unsigned long long)-1;
+        sqe->len = (response->body_remaining < HTTP_SPLICE_CHUNK) ? (unsigned)response->body_remaining : HTTP_SPLICE_CHUNK;
+        sqe->splice_flags = SPLICE_F_MOVE;
+    } else {
+        uconn->op = URING_OP_SPLICE_OUT;
+        sqe->opcode = IORING_OP_SPLICE;
+        sqe->splice_fd_in = response->body_pipe[0];
+        sqe->splice_off_in = (unsigned long long)-1;
+        sqe->fd = conn->socket_id;
+        sqe->off = (unsigned long long)-1;
+        sqe->len = response->body_piped;
+        sqe->splice_flags = SPLICE_F_MOVE | ((response->body_remaining > 0) ? SPLICE_F_MORE : 0);
+    }
+    return 0;
+}
+
+// Helper function - handle completed connection operation (res is syscall result or -errno)
+// Returns new connection state
+conn_state_t uring_complete_conn(uring_conn_t* uconn, int res)
+{
+    conn_t* conn = uconn->conn;
+    http_response_t* response;
+
+    switch (uconn->op) {
+        case URING_OP_RECV:
+            if (res < 0) {
+                log_msg(LOG_LEVEL_ERROR, "[socket: %d] Connection issue, error: %s", conn->socket_id, strerror(-res));
+            }
+            if (res <= 0) { // Client closed connection (or idle connection was shut down)
+                conn->state = CONN_STATE_CLOSE;
+                return CONN_STATE_CLOSE;
+            }
+            return conn_received(conn, res);
+
+        case URING_OP_SENDMSG:
+            if (res < 0) {
+                errno = -res;
+                return conn_sent(conn, HTTP_SEND_ERROR);
+            }
+            metrics_sent_bytes(res);
+            advance_http_responses(&conn->responses[conn->response_sent], conn->response_count - conn->response_sent, res);
+            return conn_sent(conn, HTTP_SEND_DONE);
+
+        case URING_OP_SPLICE_IN:
+        case URING_OP_SPLICE_OUT:
+            response = &conn->responses[conn->response_sent];
+            if (res <= 0) { // File got truncated after stat, or socket failure
+                errno = (res < 0) ? -res : EIO;
+                return conn_sent(conn, HTTP_SEND_ERROR);
+            }
+            if (uconn->op == URING_OP_SPLICE_IN) {
+                response->body_offset += res;
+                response->body_remaining -= res;
+                response->body_piped = res;
+            } else {
+                response->body_piped -= res;
+                metrics_sent_bytes(res);
+            }
+            return conn_sent(conn, HTTP_SEND_DONE);
+    }
+
+    return CONN_STATE_CLOSE;
+}
+
+// Helper function - add connection to the front of open connection list
+void uring_conn_add(uring_conn_t** uconns, uring_conn_t* uconn)
+{
+    uconn->prev = NULL;
+    uconn->next = *uconns;
+    if (*uconns != NULL) {
+        (*uconns)->prev = uconn;
+    }
+    *uconns = uconn;
+}
+
+// Helper function - remove connection from open connection list, cancel its deadline and destroy it
+void uring_conn_destroy(uring_conn_t** uconns, timer_wheel_t* wheel, uring_conn_t* uconn)
+{
+    if (uconn->prev != NULL) {
+        uconn->prev->next = uconn->next;
+    } else {
+        *uconns = uconn->next;
+    }
+    if (uconn->next != NULL) {
+        uconn->next->prev = uconn->prev;
+    }
+    timer_wheel_cancel(wheel, &uconn->conn->timer);
+    conn_destroy(uconn->conn); // Connection state lives in connection object, it is recycled with it
+}
+
+// Helper function - shut down connections which missed their deadline (idle, slow request header or stalled send)
+// Their pending operation completes with 0 bytes or an error, then they are destroyed
+void uring_close_expired(timer_wheel_t* wheel)
+{
+    wheel_timer_t* timer = timer_wheel_advance(wheel, timer_now_ms());
+    uring_conn_t* uconn;
+
+    for (; timer != NULL; timer = timer->next) {
+        uconn = (uring_conn_t*)timer->data;
+        conn_timed_out(uconn->conn);
+        uconn->timed_out = 1;
+        shutdown(uconn->conn->socket_id, SHUT_RDWR);
+    }
+}
+
+// Helper function - create connection for accepted client socket and queue its first receive
+void uring_accept_client(uring_t* ring, uring_conn_t** uconns, timer_wheel_t* wheel, int client_sock, const struct sockaddr_storage* client)
+{
+    char client_ip_str[INET6_ADDRSTRLEN];
+    int client_port;
+    conn_t* conn;
+    uring_conn_t* uconn;
+
+    // For debug logging (skipped completely when info messages are off)
+    if (log_enabled(LOG_LEVEL_INFO)) {
+        client_port = conn_addr_str(client, client_ip_str, sizeof(client_ip_str));
+        log_msg(LOG_LEVEL_INFO, "[uring_listen] Accepted connection: [%s:%d]", client_ip_str, client_port);
+    }
+
+    if ((conn = conn_create(client_sock)) == NULL) {
+        conn_create_failed(client_sock);
+        close(client_sock);
+        return;
+    }
+    uconn = (uring_conn_t*)conn->backend;
+    uconn->conn = conn;
+    uconn->timed_out = 0;
+    uconn->conn->timer.data = uconn;
+    uring_conn_add(uconns, uconn);
+
+    if (uring_queue_conn(ring, uconn) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to queue connection receive", client_sock);
+        uring_conn_destroy(uconns, wheel, uconn);
+        return;
+    }
+    timer_wheel_schedule(wheel, &uconn->conn->timer, uconn->conn->deadline_ms);
+}
+
+// Starts io_uring based web listening
+// Returns exit-error
+int uring_listen(config_t* conf)
+{
+    uring_t ring;
+    int listen_sock;
+    struct sockaddr_storage client;
+    socklen_t socklen;
+    struct __kernel_timespec timeout;
+    struct io_uring_cqe* cqe;
+    uring_conn_t* uconns = NULL; // Open connections
+    uring_conn_t* uconn;
+    timer_wheel_t wheel; // Deadlines of open connections
+    unsigned cq_head;
+    unsigned long user_data;
+    int res;
+    int accepting = 1;
+    int accept_pending = 1;
+
+    if (uring_init(&ring) != 0) {
+        log_msg(LOG_LEVEL_WARN, "[uring_listen] io_uring is not available (error: %s), falling back to epoll", strerror(errno));
+        return epoll_listen(conf);
+    }
+
+    if ((listen_sock = open_listen_socket(conf, 0)) < 0) {
+        return 1;
+    }
+    handoff_ready();
+
+    if (uring_queue_accept(&ring, listen_sock, &client, &socklen) != 0 || uring_queue_timeout(&ring, &timeout) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to queue initial operations");
+        return 1;
+    }
+    timer_wheel_init(&wheel, timer_now_ms());
+
+    // Event loop: submit everything queued since previous iteration and wait for completions in one system call,
+    // then handle all completions (which queue follow-up operations for next iteration)
+    // Loop wakes up at least every wheel tick (timeout operation), so drain start is noticed within one tick
+    while (1) {
+        if (uring_submit(&ring, 1) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to submit io_uring operations, error: %s", strerror(errno));
+            return 1;
+        }
+
+        cq_head = *ring.cq_head;
+        while (cq_head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &ring.cqes[cq_head & *ring.cq_mask];
+            user_data = cqe->user_data;
+            res = cqe->res;
+            cq_head++;
+            __atomic_store_n(ring.cq_head, cq_head, __ATOMIC_RELEASE); // Entry is copied out, slot can be reused
+
+            if (user_data == URING_TAG_ACCEPT) {
+                // Connection accepted just before cancellation is still served
+                if (res >= 0) {
+                    uring_accept_client(&ring, &uconns, &wheel, res, &client);
+                } else if (res != -EINTR && res != -ECONNABORTED && res != -ECANCELED) {
+                    log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to accept client connection, error: %s", strerror(-res));
+                }
+                if (!accepting) {
+                    accept_pending = 0;
+                } else if (uring_queue_accept(&ring, listen_sock, &client, &socklen) != 0) {
+                    log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to queue accept");
+                    return 1;
+                }
+                continue;
+            }
+
+            if (user_data == URING_TAG_CANCEL) {
+                continue;
+            }
+
+            if (user_data == URING_TAG_TIMEOUT) {
+                if (res != -ETIME) {
+                    log_msg(LOG_LEVEL_ERROR, "[uring_listen] Timeout operation failed, error: %s", strerror(-res));
+                    return 1;
+                }
+                uring_close_expired(&wheel);
+                if (uring_queue_timeout(&ring, &timeout) != 0) {
+                    log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to queue timeout");
+                    return 1;
+                }
+                continue;
+            }
+
+            // Advance connection with result of its operation, then queue its next one (until its new deadline)
+            uconn = (uring_conn_t*)user_data;
+            if (uconn->timed_out || uring_complete_conn(uconn, res) == CONN_STATE_CLOSE || uring_queue_conn(&ring, uconn) != 0) {
+                uring_conn_destroy(&uconns, &wheel, uconn);
+            } else {
+                timer_wheel_schedule(&wheel, &uconn->conn->timer, uconn->conn->deadline_ms);
+            }
+        }
+
+        // Pending accept holds its own reference of listening socket, so socket can be closed right away
+        if (accepting && draining()) {
+            if (uring_queue_accept_cancel(&ring) != 0) {
+                log_msg(LOG_LEVEL_ERROR, "[uring_listen] Failed to queue accept cancellation");
+                return 1;
+            }
+            close(listen_sock);
+            accepting = 0;
+        }
+        if (!accepting && ((!accept_pending && uconns == NULL) || drain_expired())) {
+            break;
+        }
+    }
+
+    drain_finish();
+    return 0;
+}
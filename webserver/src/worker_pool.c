@@ -0,0 +1,420 @@
+#include <worker_pool.h>
+#include <net_thread.h>
+#include <event_loop.h>
+#include <timer_wheel.h>
+#include <log.h>
+
+// Helper function - push item to the back of deque
+// Returns 0 on success, 1 if deque is full
+int deque_push_back(worker_deque_t* deque, const worker_item_t* item)
+{
+    int pushed = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count < deque->capacity) {
+        deque->items[(deque->front + deque->count) % deque->capacity] = *item;
+        deque->count++;
+        pushed = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return pushed ? 0 : 1;
+}
+
+// Helper function - take oldest item from the front of deque (owner side)
+// Returns 0 on success, 1 if deque is empty
+int deque_pop_front(worker_deque_t* deque, worker_item_t* item)
+{
+    int taken = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        *item = deque->items[deque->front];
+        deque->front = (deque->front + 1) % deque->capacity;
+        deque->count--;
+        taken = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return taken ? 0 : 1;
+}
+
+// Helper function - take newest item from the back of deque (thief side)
+// Returns 0 on success, 1 if deque is empty
+int deque_steal_back(worker_deque_t* deque, worker_item_t* item)
+{
+    int taken = 0;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->count > 0) {
+        deque->count--;
+        *item = deque->items[(deque->front + deque->count) % deque->capacity];
+        taken = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return taken ? 0 : 1;
+}
+
+// Helper function - take item from own deque or steal one from other workers, sleep while there is nothing to do
+// Returns 0 on success, 1 once pool is stopping
+int worker_take(worker_t* worker, worker_item_t* item)
+{
+    worker_pool_t* pool = worker->pool;
+    int found;
+    int i;
+
+    while (1) {
+        found = (deque_pop_front(&worker->deque, item) == 0);
+        for (i = 1; !found && i < pool->size; i++) {
+            found = (deque_steal_back(&pool->workers[(worker->index + i) % pool->size].deque, item) == 0);
+        }
+
+        pthread_mutex_lock(&pool->wait_lock);
+        if (found) {
+            pool->queued--;
+            pthread_cond_signal(&pool->space_cond); // Pushing thread might wait for free deque slot
+            pthread_mutex_unlock(&pool->wait_lock);
+            return 0;
+        }
+        while (pool->queued == 0 && !pool->stopping) {
+            pthread_cond_wait(&pool->work_cond, &pool->wait_lock);
+        }
+        if (pool->stopping) {
+            pthread_mutex_unlock(&pool->wait_lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&pool->wait_lock);
+    }
+}
+
+// Helper function - push item to the pool (blocks while all deques are full)
+void worker_pool_push_item(worker_pool_t* pool, const worker_item_t* item)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->wait_lock);
+    while (pool->queued >= pool->size * pool->workers[0].deque.capacity) {
+        pthread_cond_wait(&pool->space_cond, &pool->wait_lock);
+    }
+
+    // There is space in at least one deque (pushing threads hold wait_lock), spread items round-robin
+    // Item is counted only once it is in deque, so woken up workers find it (worker which takes it before
+    // that waits for wait_lock with its decrement)
+    for (i = 0; ; i = (i + 1) % pool->size) {
+        if (deque_push_back(&pool->workers[(pool->next_push + i) % pool->size].deque, item) == 0) {
+            pool->next_push = (pool->next_push + i + 1) % pool->size;
+            break;
+        }
+    }
+    pool->queued++;
+    pool->busy++;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->wait_lock);
+}
+
+// Helper function - hand connection which has to wait for its client over to poller
+void worker_pool_park(worker_pool_t* pool, conn_t* conn)
+{
+    uint64_t one = 1;
+    int wake;
+
+    // Poller takes whole list at once, so only connection parked into empty list has to wake it up
+    pthread_mutex_lock(&pool->park_lock);
+    wake = (pool->parking == NULL);
+    conn->next = pool->parking;
+    pool->parking = conn;
+    pthread_mutex_unlock(&pool->park_lock);
+
+    if (wake && write(pool->wake_fd, &one, sizeof(one)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[worker_pool_park] Failed to wake up poller, error: %s", strerror(errno));
+    }
+}
+
+// Helper function - serve taken item until its connection is finished or would block (then it is parked)
+void worker_serve(worker_pool_t* pool, const worker_item_t* item)
+{
+    conn_t* conn = item->conn;
+
+    if (conn == NULL && (conn = conn_create(item->socket_id)) == NULL) {
+        conn_create_failed(item->socket_id);
+        close(item->socket_id);
+        return;
+    }
+
+    if (conn_process(conn) == CONN_STATE_CLOSE) {
+        conn_destroy(conn); // Closes the socket/connection
+        return;
+    }
+    worker_pool_park(pool, conn);
+}
+
+// Worker thread function - serve work items until process exits (or pool is stopped)
+void* worker_run(void* worker_data)
+{
+    worker_t* worker = (worker_t*) worker_data;
+    worker_item_t item;
+
+    while (worker_take(worker, &item) == 0) {
+        worker_serve(worker->pool, &item);
+
+        pthread_mutex_lock(&worker->pool->wait_lock);
+        worker->pool->busy--;
+        pthread_mutex_unlock(&worker->pool->wait_lock);
+    }
+
+    return NULL;
+}
+
+// Helper function - (re)arm parked connection in poller for readiness event matching its state (one-shot, so
+// connection is reported once and stays with its worker until it is parked again)
+// Returns 0 on success, 1 on failure
+int worker_poll_conn(worker_pool_t* pool, conn_t* conn)
+{
+    struct epoll_event ev;
+
+    ev.events = ((conn->state == CONN_STATE_WRITE) ? EPOLLOUT : EPOLLIN) | EPOLLONESHOT;
+    ev.data.ptr = conn;
+
+    // Connections parked before are still registered (disarmed), new ones are not
+    if (epoll_ctl(pool->poll_fd, EPOLL_CTL_MOD, conn->socket_id, &ev) == 0) {
+        return 0;
+    }
+    return (errno == ENOENT && epoll_ctl(pool->poll_fd, EPOLL_CTL_ADD, conn->socket_id, &ev) == 0) ? 0 : 1;
+}
+
+// Helper function - register connections parked since last call and schedule their deadlines
+void worker_poller_register(worker_pool_t* pool, timer_wheel_t* wheel)
+{
+    conn_t* conn;
+    conn_t* next;
+
+    pthread_mutex_lock(&pool->park_lock);
+    conn = pool->parking;
+    pool->parking = NULL;
+    pthread_mutex_unlock(&pool->park_lock);
+
+    for (; conn != NULL; conn = next) {
+        next = conn->next;
+        if (worker_poll_conn(pool, conn) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[socket: %d] Failed to register connection in epoll, error: %s", conn->socket_id, strerror(errno));
+            conn_destroy(conn);
+            continue;
+        }
+        timer_wheel_schedule(wheel, &conn->timer, conn->deadline_ms);
+    }
+}
+
+// Poller thread function - register parked connections, push those whose socket is ready back to the pool
+// and close those which missed their deadline (runs until process exits or pool is stopped)
+void* worker_poller_run(void* pool_data)
+{
+    worker_pool_t* pool = (worker_pool_t*) pool_data;
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+    int event_count, i;
+    uint64_t wakeups;
+    timer_wheel_t wheel; // Deadlines of parked connections
+    wheel_timer_t* timer;
+    wheel_timer_t* next;
+    worker_item_t item;
+    int stopping;
+
+    timer_wheel_init(&wheel, timer_now_ms());
+    item.socket_id = -1;
+
+    // Wakes up every wheel tick while there are parked connections
+    while (1) {
+        event_count = epoll_wait(pool->poll_fd, events, EPOLL_MAX_EVENTS, (wheel.count > 0) ? TIMER_WHEEL_TICK_MS : -1);
+        if (event_count < 0) {
+            if (errno == EINTR) { continue; }
+            log_msg(LOG_LEVEL_ERROR, "[worker_poller_run] Failed to wait for epoll events, error: %s", strerror(errno));
+            return NULL;
+        }
+
+        for (i = 0; i < event_count; i++) {
+            if (events[i].data.ptr == NULL) {
+                if (read(pool->wake_fd, &wakeups, sizeof(wakeups)) < 0 && errno != EAGAIN) {
+                    log_msg(LOG_LEVEL_ERROR, "[worker_poller_run] Failed to read wakeups, error: %s", strerror(errno));
+                }
+                pthread_mutex_lock(&pool->wait_lock);
+                stopping = pool->stopping;
+                pthread_mutex_unlock(&pool->wait_lock);
+                if (stopping) {
+                    return NULL;
+                }
+                continue;
+            }
+
+            item.conn = (conn_t*)events[i].data.ptr;
+            timer_wheel_cancel(&wheel, &item.conn->timer);
+            worker_pool_push_item(pool, &item);
+        }
+
+        worker_poller_register(pool, &wheel);
+
+        // Only fired timers are looked at, so cost doesn't grow with amount of parked connections
+        for (timer = timer_wheel_advance(&wheel, timer_now_ms()); timer != NULL; timer = next) {
+            next = timer->next;
+            conn_timed_out((conn_t*)timer->data);
+            conn_destroy((conn_t*)timer->data); // Closing socket also removes it from epoll
+        }
+    }
+}
+
+// Helper function - stop poller (if started) and first started workers, wait for them and free pool with deques
+// of first allocated workers
+void worker_pool_unwind(worker_pool_t* pool, int poller_started, int started, int allocated)
+{
+    uint64_t one = 1;
+    int i;
+
+    pthread_mutex_lock(&pool->wait_lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->wait_lock);
+
+    if (poller_started) {
+        if (write(pool->wake_fd, &one, sizeof(one)) < 0) {
+            log_msg(LOG_LEVEL_ERROR, "[worker_pool_unwind] Failed to wake up poller, error: %s", strerror(errno));
+        }
+        pthread_join(pool->poller_id, NULL);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(pool->workers[i].thread_id, NULL);
+    }
+    for (i = 0; i < allocated; i++) {
+        free(pool->workers[i].deque.items);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+
+    if (pool->wake_fd >= 0) {
+        close(pool->wake_fd);
+    }
+    if (pool->poll_fd >= 0) {
+        close(pool->poll_fd);
+    }
+    pthread_mutex_destroy(&pool->park_lock);
+    pthread_cond_destroy(&pool->space_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->wait_lock);
+    free(pool->workers);
+    free(pool);
+}
+
+// Helper function - create epoll instance of poller with its wakeup eventfd registered
+// Returns 0 on success, 1 on failure
+int worker_pool_poll_init(worker_pool_t* pool)
+{
+    struct epoll_event ev;
+
+    if ((pool->poll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[worker_pool_create] Failed to create epoll instance, error: %s", strerror(errno));
+        return 1;
+    }
+    if ((pool->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[worker_pool_create] Failed to create poller eventfd, error: %s", strerror(errno));
+        return 1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(pool->poll_fd, EPOLL_CTL_ADD, pool->wake_fd, &ev) < 0) {
+        log_msg(LOG_LEVEL_ERROR, "[worker_pool_create] Failed to register poller eventfd in epoll, error: %s", strerror(errno));
+        return 1;
+    }
+
+    return 0;
+}
+
+// Create worker pool with given amount of workers, each with deque of queue_depth items, and start its threads
+// Returns NULL on failure
+worker_pool_t* worker_pool_create(const config_t* conf, int size, int queue_depth)
+{
+    worker_pool_t* pool;
+    worker_t* worker;
+    pthread_attr_t thread_attr;
+    int i;
+
+    if ((pool = (worker_pool_t*)malloc(sizeof(worker_pool_t))) == NULL) {
+        return NULL;
+    }
+    if ((pool->workers = (worker_t*)calloc(size, sizeof(worker_t))) == NULL) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->conf = conf;
+    pool->size = size;
+    pool->next_push = 0;
+    pool->queued = 0;
+    pool->busy = 0;
+    pool->stopping = 0;
+    pool->poll_fd = -1;
+    pool->wake_fd = -1;
+    pool->parking = NULL;
+    pthread_mutex_init(&pool->wait_lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->space_cond, NULL);
+    pthread_mutex_init(&pool->park_lock, NULL);
+
+    // Deques are fully allocated up front, so memory use stays bounded no matter the load
+    for (i = 0; i < size; i++) {
+        worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.capacity = queue_depth;
+        worker->deque.front = 0;
+        worker->deque.count = 0;
+        if ((worker->deque.items = (worker_item_t*)malloc(queue_depth * sizeof(worker_item_t))) == NULL) {
+            pthread_mutex_destroy(&worker->deque.lock);
+            worker_pool_unwind(pool, 0, 0, i);
+            return NULL;
+        }
+    }
+    if (worker_pool_poll_init(pool) != 0) {
+        worker_pool_unwind(pool, 0, 0, size);
+        return NULL;
+    }
+
+    init_thread_attr(&thread_attr, conf);
+    if (pthread_create(&pool->poller_id, &thread_attr, worker_poller_run, (void*) pool) != 0) {
+        log_msg(LOG_LEVEL_ERROR, "[worker_pool_create] Failed to pthread_create poller");
+        pthread_attr_destroy(&thread_attr);
+        worker_pool_unwind(pool, 0, 0, size);
+        return NULL;
+    }
+    for (i = 0; i < size; i++) {
+        worker = &pool->workers[i];
+        if (pthread_create(&worker->thread_id, &thread_attr, worker_run, (void*) worker) != 0) {
+            log_msg(LOG_LEVEL_ERROR, "[worker_pool_create] Failed to pthread_create worker %d", i);
+            pthread_attr_destroy(&thread_attr);
+            worker_pool_unwind(pool, 1, i, size);
+            return NULL;
+        }
+    }
+    pthread_attr_destroy(&thread_attr);
+
+    return pool;
+}
+
+// Push accepted client socket to the pool (blocks while all deques are full)
+void worker_pool_push(worker_pool_t* pool, int socket_id)
+{
+    worker_item_t item;
+
+    item.socket_id = socket_id;
+    item.conn = NULL;
+    worker_pool_push_item(pool, &item);
+}
+
+// Amount of pushed sockets and resumed connections which are still queued or being served
+int worker_pool_busy(worker_pool_t* pool)
+{
+    int busy;
+
+    pthread_mutex_lock(&pool->wait_lock);
+    busy = pool->busy;
+    pthread_mutex_unlock(&pool->wait_lock);
+
+    return busy;
+}